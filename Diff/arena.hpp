@@ -0,0 +1,93 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "compiled.hpp"
+
+// Сравнение затрат памяти арены и узлов на shared_ptr
+struct arena_memory_report {
+    std::size_t nodes;
+    std::size_t arena_bytes;
+    double arena_bytes_per_node;
+    std::size_t shared_bytes;
+    double shared_bytes_per_node;
+};
+
+// ============================================================================
+// Арена выражений: узлы лежат в одном непрерывном массиве, потомки задаются
+// 32-битными индексами, операции -- кодами op_code, имена переменных
+// интернированы. Потомок всегда имеет меньший индекс, чем родитель, поэтому
+// массив уже упорядочен для вычисления. Одинаковые узлы внутри арены
+// совпадают. Освобождение всех выражений и производных -- один clear().
+// ============================================================================
+template<typename T>
+class expression_arena {
+public:
+    using handle = std::uint32_t;
+
+    struct node {
+        op_code op;
+        // constant: индекс в пуле констант, variable: номер имени,
+        // унарная операция: a -- аргумент, бинарная: a и b -- операнды
+        std::uint32_t a;
+        std::uint32_t b;
+    };
+
+    handle add(const expression<T> &expr);
+    handle constant(T value);
+    handle variable(const std::string &name);
+    handle unary(op_code op, handle child);
+    handle binary(op_code op, handle left, handle right);
+
+    // Производная строится в той же арене с простыми упрощениями (0 и 1)
+    handle differentiate(handle root, const std::string &var);
+
+    // slots -- значения переменных по номерам имён арены (name_id)
+    T evaluate(handle root, const T *slots) const;
+    T evaluate(handle root, const std::map<std::string, T> &variables) const;
+    expression<T> to_expression(handle root) const;
+
+    std::uint32_t name_id(const std::string &name);
+    const std::string& name(std::uint32_t id) const { return names_[id]; }
+    std::size_t name_count() const { return names_.size(); }
+    const node& at(handle h) const { return nodes_[h]; }
+    std::size_t size() const { return nodes_.size(); }
+
+    // Освобождение всех узлов арены разом
+    void clear();
+    arena_memory_report memory_report() const;
+
+private:
+    struct key_hash {
+        std::size_t operator()(const std::pair<std::uint64_t, std::uint32_t> &key) const {
+            return std::hash<std::uint64_t>()(key.first * 31 + key.second);
+        }
+    };
+
+    handle push(node n);
+    handle combine(op_code op, handle left, handle right);
+    const std::vector<handle>& schedule(handle root) const;
+
+    std::vector<node> nodes_;
+    // Узел может бросить при вычислении (деление, ln): такие операнды
+    // поглощающие правила combine() не отбрасывают
+    std::vector<std::uint8_t> fallible_;
+    std::vector<T> constants_;
+    std::vector<std::string> names_;
+    std::unordered_map<std::string, std::uint32_t> name_ids_;
+    // Хеш значения константы -> индексы в пуле с таким хешем
+    std::unordered_multimap<std::size_t, std::uint32_t> constant_ids_;
+    // Ключ узла: (op << 32 | a, b) -> индекс
+    std::unordered_map<std::pair<std::uint64_t, std::uint32_t>, handle, key_hash> index_;
+    // Кэш порядка вычисления (достижимые из корня узлы по возрастанию)
+    mutable std::unordered_map<handle, std::vector<handle>> schedules_;
+    mutable std::mutex schedule_mutex_;
+};
+
+#endif // ARENA_HPP
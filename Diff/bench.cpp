@@ -0,0 +1,934 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <complex>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "head.hpp"
+
+// Счётчик выделений памяти для отчёта о числе аллокаций на операцию.
+// noinline: иначе GCC видит free() после встроенного new и ложно
+// предупреждает о несовпадении функций выделения и освобождения
+static std::atomic<std::size_t> allocation_count{0};
+
+__attribute__((noinline)) void* operator new(std::size_t size) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
+// Время выполнения func в миллисекундах
+template<typename Func>
+double measure_ms(Func func) {
+    auto start = std::chrono::steady_clock::now();
+    func();
+    auto stop = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(stop - start).count();
+}
+
+void report(const std::string &name, double ms, std::size_t rows, double baseline_ms) {
+    std::cout << "  " << name << ": " << ms << " ms, "
+              << rows / ms / 1000.0 << " Mrows/s, x" << baseline_ms / ms << std::endl;
+}
+
+// Пакетное вычисление против вызова expression<double>::evaluate в цикле
+void bench_batch() {
+    const std::size_t rows = 200000;
+    const std::string source = "x*y + x/y - (x - y)*(x + y) + 3*x*x - y/7";
+    std::cout << "batch evaluate, " << rows << " rows: " << source << std::endl;
+
+    auto expr = ExpressionParserT<double>(source).parse();
+    symbol_table symbols;
+    auto program = expr.bind(symbols);
+
+    std::mt19937_64 rng(42);
+    std::uniform_real_distribution<double> dist(0.5, 2.0);
+    std::vector<std::vector<double>> data(symbols.size(), std::vector<double>(rows));
+    for (auto &column : data)
+        for (double &v : column) v = dist(rng);
+    std::vector<const double*> columns;
+    for (auto &column : data) columns.push_back(column.data());
+    std::vector<double> out(rows);
+
+    const std::uint32_t x = symbols.slot("x"), y = symbols.slot("y");
+    double checksum = 0;
+    double tree_ms = measure_ms([&]() {
+        std::map<std::string, double> vars;
+        for (std::size_t i = 0; i < rows; ++i) {
+            vars["x"] = data[x][i];
+            vars["y"] = data[y][i];
+            checksum += expr.evaluate(vars);
+        }
+    });
+    report("tree evaluate", tree_ms, rows, tree_ms);
+
+    double compiled_ms = measure_ms([&]() {
+        std::vector<double> slots(symbols.size());
+        for (std::size_t i = 0; i < rows; ++i) {
+            slots[x] = data[x][i];
+            slots[y] = data[y][i];
+            checksum += program.evaluate(slots.data());
+        }
+    });
+    report("compiled evaluate", compiled_ms, rows, tree_ms);
+
+    const simd_level best = detect_simd_level();
+    for (simd_level level : {simd_level::scalar, simd_level::sse2, simd_level::avx2, simd_level::avx512}) {
+        if (level > best) break;
+        double ms = measure_ms([&]() {
+            program.evaluate_batch(columns.data(), out.data(), rows, level);
+        });
+        checksum += out[rows / 2];
+        report(std::string("batch ") + simd_level_name(level), ms, rows, tree_ms);
+    }
+    std::cout << "  checksum " << checksum << std::endl;
+}
+
+// Рост памяти при повторном дифференцировании: дерево против общих узлов
+void bench_derivative_memory() {
+    const std::string source = "sin(x) * exp(x / 3) + x^3 / (1 + x^2)";
+    std::cout << "repeated derivatives: " << source << std::endl;
+    auto expr = ExpressionParserT<double>(source).parse();
+    for (int order = 1; order <= 6; ++order) {
+        double ms = measure_ms([&]() { expr = expr.differentiate("x"); });
+        auto m = expr.metrics();
+        std::cout << "  d^" << order << ": " << ms << " ms, tree nodes " << m.tree_nodes
+                  << ", shared nodes " << m.unique_nodes << ", " << m.bytes << " bytes" << std::endl;
+    }
+}
+
+// n-е производные без упрощения и с упрощением: размер и время вычисления
+void bench_simplify() {
+    const std::string sources[] = {
+        "x^3 - 2*x^2 + 5*x - 7",
+        "sin(x) * exp(x / 3) + x^3 / (1 + x^2)",
+        "ln(1 + x^2) * cos(2*x) - exp(0.5 * x) * x^4"
+    };
+    const int evaluations = 20000;
+    for (const std::string &source : sources) {
+        std::cout << "simplify derivatives: " << source << std::endl;
+        auto expr = ExpressionParserT<double>(source).parse();
+        auto raw = expr, simple = expr;
+        for (int order = 1; order <= 4; ++order) {
+            raw = raw.differentiate("x", false);
+            simple = simple.differentiate("x");
+            auto raw_program = raw.compile(), simple_program = simple.compile();
+            double x = 0.7, sum = 0;
+            double raw_ms = measure_ms([&]() {
+                for (int i = 0; i < evaluations; ++i) sum += raw_program.evaluate(&x);
+            });
+            double simple_ms = measure_ms([&]() {
+                for (int i = 0; i < evaluations; ++i) sum += simple_program.evaluate(&x);
+            });
+            std::cout << "  d^" << order << ": raw " << raw.metrics().tree_nodes << " nodes / "
+                      << raw_ms * 1e6 / evaluations << " ns, simplified " << simple.metrics().tree_nodes
+                      << " nodes / " << simple_ms * 1e6 / evaluations << " ns (" << sum << ")" << std::endl;
+        }
+    }
+}
+
+// Градиент по k переменным: обратный режим против k символьных производных
+void bench_gradient() {
+    // Буква i зарезервирована парсером под мнимую единицу
+    const std::string letters = "abcdefghjklmnopqrstu";
+    const int k = static_cast<int>(letters.size());
+    std::string source;
+    std::map<std::string, double> point;
+    for (int i = 0; i < k; ++i) {
+        std::string var(1, letters[i]), next(1, letters[(i + 1) % k]);
+        if (i) source += " + ";
+        source += "sin(" + var + ") * " + next + "^2 / (1 + exp(" + var + " * " + next + "))";
+        point[var] = 0.1 * (i + 1);
+    }
+    std::cout << "gradient over " << k << " variables" << std::endl;
+    auto expr = ExpressionParserT<double>(source).parse();
+    double sum = 0;
+    double symbolic_ms = measure_ms([&]() {
+        for (auto &binding : point)
+            sum += expr.differentiate(binding.first).compile().evaluate(point);
+    });
+    double reverse_ms = measure_ms([&]() {
+        for (auto &partial : gradient(expr, point)) sum += partial.second;
+    });
+    auto program = expr.compile();
+    std::vector<double> slots(program.slot_count()), grad(program.slot_count());
+    for (std::size_t i = 0; i < program.variables().size(); ++i)
+        slots[program.slots()[i]] = point[program.variables()[i]];
+    const int repeats = 10000;
+    double eval_ms = measure_ms([&]() {
+        for (int i = 0; i < repeats; ++i) sum += program.evaluate(slots.data());
+    });
+    double tape_ms = measure_ms([&]() {
+        for (int i = 0; i < repeats; ++i) sum += program.gradient(slots.data(), grad.data());
+    });
+    std::cout << "  k symbolic derivatives + evaluate: " << symbolic_ms << " ms" << std::endl;
+    std::cout << "  reverse mode from expression: " << reverse_ms << " ms" << std::endl;
+    std::cout << "  compiled gradient / evaluate cost: x" << tape_ms / eval_ms << " (" << sum << ")" << std::endl;
+}
+
+// Производная в точке для шага Ньютона: символьная производная против dual
+void bench_dual() {
+    const std::string source = "x^5 - 3*x^3 + sin(x) * exp(x / 4) - 2";
+    std::cout << "newton derivative: " << source << std::endl;
+    auto expr = ExpressionParserT<double>(source).parse();
+    auto program = expr.compile();
+    const int steps = 2000;
+    double x = 1.5, sum = 0;
+    double symbolic_ms = measure_ms([&]() {
+        for (int i = 0; i < steps; ++i)
+            sum += expr.differentiate("x").evaluate({{"x", x + 1e-6 * i}});
+    });
+    double dual_ms = measure_ms([&]() {
+        const double one = 1;
+        for (int i = 0; i < steps; ++i) {
+            double point = x + 1e-6 * i;
+            sum += program.evaluate_dual(&point, &one).derivative;
+        }
+    });
+    std::cout << "  differentiate + evaluate: " << symbolic_ms * 1000 / steps << " us/step" << std::endl;
+    std::cout << "  evaluate_dual: " << dual_ms * 1000 / steps << " us/step (" << sum << ")" << std::endl;
+}
+
+// Семейство производных в арене: память на узел и скорость вычисления
+void bench_arena() {
+    const std::string source = "sin(x) * exp(y / 3) + x^3 / (1 + y^2) - ln(1 + x*y)";
+    std::cout << "arena derivative family: " << source << std::endl;
+    auto expr = ExpressionParserT<double>(source).parse();
+    expression_arena<double> arena;
+    std::vector<expression_arena<double>::handle> family{arena.add(expr)};
+    std::vector<expression<double>> trees{expr};
+    double build_ms = measure_ms([&]() {
+        for (int order = 0; order < 4; ++order) {
+            family.push_back(arena.differentiate(family.back(), order % 2 ? "y" : "x"));
+        }
+    });
+    double tree_build_ms = measure_ms([&]() {
+        for (int order = 0; order < 4; ++order)
+            trees.push_back(trees.back().differentiate(order % 2 ? "y" : "x", false));
+    });
+    auto report = arena.memory_report();
+    std::cout << "  build: arena " << build_ms << " ms, shared_ptr tree " << tree_build_ms << " ms" << std::endl;
+    std::cout << "  " << report.nodes << " nodes: arena " << report.arena_bytes_per_node << " B/node ("
+              << report.arena_bytes << " B), shared_ptr " << report.shared_bytes_per_node << " B/node ("
+              << report.shared_bytes << " B)" << std::endl;
+
+    std::map<std::string, double> point{{"x", 0.7}, {"y", 1.3}};
+    std::vector<double> slots(arena.name_count());
+    for (std::uint32_t id = 0; id < arena.name_count(); ++id) slots[id] = point[arena.name(id)];
+    const int repeats = 2000;
+    double sum = 0;
+    double arena_ms = measure_ms([&]() {
+        for (int i = 0; i < repeats; ++i) sum += arena.evaluate(family.back(), slots.data());
+    });
+    double tree_ms = measure_ms([&]() {
+        for (int i = 0; i < repeats / 100; ++i) sum += trees.back().evaluate(point);
+    }) * 100;
+    std::cout << "  evaluate last derivative: arena " << arena_ms * 1000 / repeats << " us, tree "
+              << tree_ms * 1000 / repeats << " us (" << sum << ")" << std::endl;
+    double release_ms = measure_ms([&]() { arena.clear(); });
+    std::cout << "  bulk release: " << release_ms << " ms" << std::endl;
+}
+
+// Нативное ядро: время сборки, повторная загрузка из кэша и ускорение
+void bench_jit() {
+    const std::string source = "sin(x) * exp(y / 3) + x^3 / (1 + y^2) - ln(1 + x*y) + x*y*(x - y)";
+    const std::size_t rows = 200000;
+    std::cout << "native kernel: " << source << std::endl;
+    auto expr = ExpressionParserT<double>(source).parse();
+    auto program = expr.compile();
+    jit_options options;
+    // Отдельный каталог на запуск, чтобы первая сборка действительно компилировала
+    options.cache_dir = "/tmp/differ-jit-bench-" + std::to_string(
+        std::chrono::steady_clock::now().time_since_epoch().count());
+    auto kernel = jit_compile(program, options);
+    auto again = jit_compile(program, options);
+    if (!kernel.native()) {
+        std::cout << "  compiler not available, interpreter fallback" << std::endl;
+        return;
+    }
+    std::cout << "  compile: " << kernel.compile_ms() << " ms, cached load: " << again.compile_ms() << " ms"
+              << std::endl;
+
+    std::mt19937_64 rng(7);
+    std::uniform_real_distribution<double> dist(0.5, 2.0);
+    std::vector<std::vector<double>> data(program.slot_count(), std::vector<double>(rows));
+    for (auto &column : data)
+        for (double &v : column) v = dist(rng);
+    std::vector<const double*> columns;
+    for (auto &column : data) columns.push_back(column.data());
+    std::vector<double> out(rows);
+    double checksum = 0;
+
+    double interp_ms = measure_ms([&]() {
+        std::vector<double> slots(program.slot_count());
+        for (std::size_t i = 0; i < rows; ++i) {
+            for (std::size_t s = 0; s < slots.size(); ++s) slots[s] = data[s][i];
+            checksum += program.evaluate(slots.data());
+        }
+    });
+    report("interpreter evaluate", interp_ms, rows, interp_ms);
+    double native_ms = measure_ms([&]() {
+        std::vector<double> slots(program.slot_count());
+        for (std::size_t i = 0; i < rows; ++i) {
+            for (std::size_t s = 0; s < slots.size(); ++s) slots[s] = data[s][i];
+            checksum += kernel.evaluate(slots.data());
+        }
+    });
+    report("native evaluate", native_ms, rows, interp_ms);
+    double batch_ms = measure_ms([&]() { program.evaluate_batch(columns.data(), out.data(), rows); });
+    checksum += out[rows / 2];
+    report("interpreter batch", batch_ms, rows, interp_ms);
+    double native_batch_ms = measure_ms([&]() { kernel.evaluate_batch(columns.data(), out.data(), rows); });
+    checksum += out[rows / 2];
+    report("native batch", native_batch_ms, rows, interp_ms);
+    std::cout << "  break-even after " << kernel.compile_ms() / (interp_ms - native_ms) * rows
+              << " rows (" << checksum << ")" << std::endl;
+}
+
+// Разбор длинных сумм и глубоких скобок: время должно расти линейно
+void bench_parse() {
+    std::cout << "parse scaling" << std::endl;
+    for (int terms : {10000, 100000, 1000000}) {
+        std::string source;
+        for (int k = 0; k < terms; ++k) {
+            if (k) source += k % 3 ? " + " : " - ";
+            source += std::to_string(k % 97) + ".25 * sin(x" + std::string(1, 'a' + k % 8) + ")";
+        }
+        std::size_t nodes = 0;
+        double ms = measure_ms([&]() { nodes = ExpressionParserT<double>(source).parse().compile().size(); });
+        std::cout << "  sum of " << terms << " terms, " << source.size() / 1e6 << " MB: " << ms << " ms, "
+                  << source.size() / ms / 1000.0 << " MB/s, " << nodes << " instructions" << std::endl;
+    }
+    const int depth = 1000000;
+    std::string nested = std::string(depth, '(') + "x" + std::string(depth, ')');
+    double ms = measure_ms([&]() { ExpressionParserT<double>(nested).parse(); });
+    std::cout << "  " << depth << " nested parentheses: " << ms << " ms" << std::endl;
+}
+
+// Печать большой производной: размер вывода и скорость для каждого стиля
+void bench_print() {
+    const std::string source = "sin(x) * exp(x / 3) + x^3 / (1 + x^2) - ln(1 + x*x)";
+    auto expr = ExpressionParserT<double>(source).parse();
+    for (int order = 0; order < 6; ++order) expr = expr.differentiate("x", false);
+    std::cout << "print d^6 of " << source << ", " << expr.metrics().tree_nodes << " tree nodes" << std::endl;
+    for (print_style style : {print_style::full, print_style::minimal, print_style::compact}) {
+        std::string text;
+        double ms = measure_ms([&]() { text = expr.to_string(style); });
+        std::ostringstream sink;
+        double stream_ms = measure_ms([&]() { expr.print(sink, style); });
+        const char *name = style == print_style::full ? "full" : style == print_style::minimal ? "minimal" : "compact";
+        std::cout << "  " << name << ": " << text.size() / 1e6 << " MB, to_string " << ms << " ms ("
+                  << text.size() / ms / 1000.0 << " MB/s), stream " << stream_ms << " ms" << std::endl;
+    }
+}
+
+// От вызова differentiate до первого значения: ленивая производная против
+// построения и упрощения дерева
+void bench_lazy() {
+    std::cout << "first value of a derivative" << std::endl;
+    for (std::size_t n : {100, 300, 1000}) {
+        std::string source = "x";
+        for (std::size_t k = 0; k < n; ++k)
+            source = std::string(k % 2 ? "cos" : "sin") + "(0.5 * " + source + " + y) * x";
+        auto expr = ExpressionParserT<double>(source).parse();
+        const std::map<std::string, double> point{{"x", 0.3}, {"y", 0.7}};
+        double eager_value = 0, lazy_value = 0;
+        std::size_t before = allocation_count.load();
+        double eager_ms = measure_ms([&]() { eager_value = expr.differentiate("x").evaluate(point); });
+        const std::size_t eager_allocs = allocation_count.load() - before;
+        before = allocation_count.load();
+        double lazy_ms = measure_ms([&]() { lazy_value = expr.differentiate_lazy("x").evaluate(point); });
+        const std::size_t lazy_allocs = allocation_count.load() - before;
+        std::cout << "  depth " << n << ": eager " << eager_ms << " ms / " << eager_allocs << " allocs, lazy "
+                  << lazy_ms << " ms / " << lazy_allocs << " allocs, x" << eager_ms / lazy_ms << " ("
+                  << eager_value - lazy_value << ")" << std::endl;
+    }
+}
+
+// Инкрементальное вычисление против полного при изменении доли переменных
+void bench_incremental() {
+    const std::string letters = "abcdefghjklmnopqrstu";
+    const std::size_t k = 200;
+    auto name = [&](std::size_t v) { return std::string("v") + letters[v / letters.size()] + letters[v % letters.size()]; };
+    std::string source;
+    std::map<std::string, double> point;
+    for (std::size_t v = 0; v < k; ++v) {
+        if (v) source += " + ";
+        source += "sin(" + name(v) + ") * exp(" + name(v) + " / 3) + " + name(v) + "^2 / (1 + " + name((v + 1) % k) + "^2)";
+        point[name(v)] = 0.5 + 0.01 * v;
+    }
+    incremental_evaluator<double> inc(ExpressionParserT<double>(source).parse(), point);
+    const auto &program = inc.program();
+    std::cout << "incremental evaluate, " << k << " variables, " << program.size() << " instructions" << std::endl;
+    std::vector<double> slots(program.slot_count());
+    for (std::size_t v = 0; v < program.variables().size(); ++v)
+        slots[program.slots()[v]] = point[program.variables()[v]];
+    inc.value();
+
+    std::mt19937_64 rng(11);
+    std::vector<std::uint32_t> order(program.slot_count());
+    for (std::uint32_t s = 0; s < order.size(); ++s) order[s] = s;
+    const int steps = 2000;
+    for (std::size_t changed : {std::size_t(1), k / 100 * 2, k / 10, k / 2, k}) {
+        double sum = 0;
+        std::size_t recomputed = 0;
+        double full_ms = 0, inc_ms = 0;
+        for (int step = 0; step < steps; ++step) {
+            std::shuffle(order.begin(), order.end(), rng);
+            for (std::size_t c = 0; c < changed; ++c) slots[order[c]] += 1e-3;
+            full_ms += measure_ms([&]() { sum += program.evaluate(slots.data()); });
+            inc_ms += measure_ms([&]() {
+                for (std::size_t c = 0; c < changed; ++c) inc.set_slot(order[c], slots[order[c]]);
+                sum -= inc.value();
+            });
+            recomputed += inc.last_recomputed();
+        }
+        std::cout << "  " << changed << " changed: full " << full_ms * 1e6 / steps << " ns, incremental "
+                  << inc_ms * 1e6 / steps << " ns, x" << full_ms / inc_ms << ", "
+                  << recomputed / steps << " instructions (" << sum << ")" << std::endl;
+    }
+}
+
+// Формулы, известные при сборке: шаблоны выражений против дерева и ленты
+template<typename Static>
+void bench_static_formula(const std::string &name, const Static &f, const expression<double> &expr) {
+    using namespace static_expr;
+    const int points = 200000;
+    auto program = expr.compile();
+    double sum = 0;
+    double tree_ms = measure_ms([&]() {
+        for (int k = 0; k < points; ++k) sum += expr.evaluate({{"x", 0.5 + 1e-6 * k}, {"y", 1.5}});
+    });
+    // Производная может не зависеть от y: слоты берутся по именам
+    std::vector<double> slots(program.slot_count());
+    std::vector<std::uint32_t> x_slots;
+    for (std::size_t v = 0; v < program.variables().size(); ++v) {
+        if (program.variables()[v] == "x") x_slots.push_back(program.slots()[v]);
+        else slots[program.slots()[v]] = 1.5;
+    }
+    double tape_ms = measure_ms([&]() {
+        for (int k = 0; k < points; ++k) {
+            for (std::uint32_t slot : x_slots) slots[slot] = 0.5 + 1e-6 * k;
+            sum += program.evaluate(slots.data());
+        }
+    });
+    double static_ms = measure_ms([&]() {
+        for (int k = 0; k < points; ++k) sum += f.evaluate(at<'x'>(0.5 + 1e-6 * k), at<'y'>(1.5));
+    });
+    std::cout << "  " << name << ": tree " << tree_ms * 1e6 / points << " ns, tape " << tape_ms * 1e6 / points
+              << " ns, static " << static_ms * 1e6 / points << " ns, x" << tape_ms / static_ms << " against tape ("
+              << sum << ")" << std::endl;
+}
+
+void bench_static() {
+    using namespace static_expr;
+    constexpr var<'x'> x;
+    constexpr var<'y'> y;
+    std::cout << "static expressions (per point)" << std::endl;
+    auto f = pow(x, num<3>) * sin(y) + exp(x / y) - ln(x * y + 1) / cos(x);
+    auto expr = ExpressionParserT<double>("x^3 * sin(y) + exp(x / y) - ln(x * y + 1) / cos(x)").parse();
+    bench_static_formula("f", f, expr);
+    bench_static_formula("df/dx", differentiate<'x'>(f), expr.differentiate("x"));
+    auto p = (num<3> * x - num<2>) * pow(x, num<4>) + x * y / (num<1> + y * y) - num<7>;
+    auto poly = ExpressionParserT<double>("(3 * x - 2) * x^4 + x * y / (1 + y * y) - 7").parse();
+    bench_static_formula("p", p, poly);
+    bench_static_formula("d2p/dx2", differentiate<'x'>(differentiate<'x'>(p)),
+                         poly.differentiate("x").differentiate("x"));
+}
+
+// Масштабирование пакетного вычисления по числу потоков
+void bench_parallel() {
+    const std::size_t rows = 2000000;
+    const std::string source = "sin(x) * exp(y / 3) + x^3 / (1 + y^2) - ln(1 + x*y)";
+    std::cout << "parallel evaluate, " << rows << " rows: " << source << std::endl;
+    auto program = ExpressionParserT<double>(source).parse().compile();
+    std::mt19937_64 rng(11);
+    std::uniform_real_distribution<double> dist(0.5, 2.0);
+    std::vector<std::vector<double>> data(program.slot_count(), std::vector<double>(rows));
+    for (auto &column : data)
+        for (double &v : column) v = dist(rng);
+    std::vector<const double*> columns;
+    for (auto &column : data) columns.push_back(column.data());
+    std::vector<double> out(rows);
+
+    double one_ms = 0;
+    const std::size_t cores = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::size_t> counts;
+    for (std::size_t threads = 1; threads < cores; threads *= 2) counts.push_back(threads);
+    counts.push_back(cores);
+    for (std::size_t threads : counts) {
+        thread_pool pool(threads);
+        double ms = measure_ms([&]() { parallel_evaluate(program, columns.data(), out.data(), rows, pool); });
+        if (threads == 1) one_ms = ms;
+        report(std::to_string(threads) + " threads", ms, rows, one_ms);
+    }
+    std::cout << "  checksum " << out[rows / 3] << std::endl;
+}
+
+// Потоковое вычисление таблицы: разбор, вычисление и вывод конвейером
+void bench_stream() {
+    const std::size_t rows = 1000000;
+    const std::string source = "sin(x) * exp(y / 3) + x^3 / (1 + y^2)";
+    std::cout << "stream evaluate, " << rows << " CSV rows: " << source << std::endl;
+    std::FILE *in = std::tmpfile();
+    std::FILE *out = std::fopen("/dev/null", "w");
+    if (!in || !out) return;
+    std::string input = "x,y\n";
+    std::mt19937_64 rng(5);
+    std::uniform_real_distribution<double> dist(0.5, 2.0);
+    for (std::size_t k = 0; k < rows; ++k)
+        input += std::to_string(dist(rng)) + "," + std::to_string(dist(rng)) + "\n";
+    std::fwrite(input.data(), 1, input.size(), in);
+    std::rewind(in);
+    auto expr = ExpressionParserT<double>(source).parse();
+    double ms = measure_ms([&]() { stream_evaluate(expr, in, out); });
+    std::cout << "  " << ms << " ms, " << rows / ms / 1000.0 << " Mrows/s, "
+              << input.size() / ms / 1000.0 << " MB/s" << std::endl;
+    std::fclose(in);
+    std::fclose(out);
+}
+
+// Задержка запроса к серверу: повторяющееся выражение из кэша против разбора
+void bench_server() {
+    std::cout << "server request latency" << std::endl;
+    const int requests = 20000;
+    const std::string formula = "sin(x) * exp(y / 3) + x^3 / (1 + y^2) - ln(1 + x*y)";
+    expression_server cached(16);
+    for (int k = 0; k < requests; ++k) cached.handle("eval " + formula + " ; x=0.5 y=" + std::to_string(1 + k % 10));
+    auto hot = cached.latency();
+    std::cout << "  cached eval: p50 " << hot.p50_us << " us, p99 " << hot.p99_us << " us" << std::endl;
+    expression_server cold(1);
+    for (int k = 0; k < requests; ++k)
+        cold.handle("eval " + formula + " + " + std::to_string(k % 2) + " ; x=0.5 y=1.5");
+    auto miss = cold.latency();
+    std::cout << "  parse every request: p50 " << miss.p50_us << " us, p99 " << miss.p99_us << " us" << std::endl;
+}
+
+// Все частные производные модели из 200 переменных: по одной против одного обхода
+void bench_differentiate_all() {
+    const std::string letters = "abcdefghjklmnopqrstuvwxyz";
+    std::vector<std::string> vars;
+    for (std::size_t k = 0; vars.size() < 200; ++k)
+        vars.push_back(std::string(1, letters[k % letters.size()]) + letters[k / letters.size()]);
+    std::string source;
+    for (std::size_t k = 0; k < vars.size(); ++k) {
+        const std::string &v = vars[k], &next = vars[(k + 1) % vars.size()], &far = vars[(k * 7) % vars.size()];
+        if (k) source += " + ";
+        source += "sin(" + v + " * " + next + ") * exp(" + far + " / 5) + ln(1 + " + v + "^2) / (1 + " + next + "^2)";
+    }
+    // Общий множитель делает каждую частную производную зависящей от всего выражения
+    source = "(" + source + ") * (" + source + ")";
+    auto expr = ExpressionParserT<double>(source).parse();
+    std::cout << "differentiate all " << vars.size() << " variables, " << expr.metrics().unique_nodes
+              << " unique nodes" << std::endl;
+    std::size_t nodes = 0;
+    double single_ms = measure_ms([&]() {
+        for (const std::string &v : vars) nodes += expr.differentiate(v).metrics().unique_nodes;
+    });
+    std::cout << "  differentiate per variable: " << single_ms << " ms" << std::endl;
+    const std::size_t cores = std::max(1u, std::thread::hardware_concurrency());
+    for (std::size_t threads : {std::size_t(1), cores}) {
+        double all_ms = measure_ms([&]() {
+            for (auto &partial : expr.differentiate_all(vars, true, threads)) nodes += partial.metrics().unique_nodes;
+        });
+        std::cout << "  differentiate_all, " << threads << " threads: " << all_ms << " ms, x" << single_ms / all_ms
+                  << " (" << nodes << ")" << std::endl;
+        if (cores == 1) break;
+    }
+}
+
+// Понижение стоимости на многочленах: лента с вызовами pow против powi и Горнера
+void bench_strength() {
+    std::string dense;
+    for (int k = 0; k <= 12; ++k)
+        dense += (k ? " + " : "") + std::to_string(k % 5 + 1) + " * x^" + std::to_string(k);
+    const std::vector<std::string> sources = {
+        dense,
+        "(x + 1)^3 * (y - 2)^2 + x^2 * y^3 - 4 * x * y + 7",
+        "sin(x)^2 * cos(y)^3 + sin(y)^4 / (1 + x^2)^2"};
+    const std::size_t rows = 200000;
+    std::mt19937_64 rng(11);
+    std::uniform_real_distribution<double> dist(0.5, 1.5);
+    for (const std::string &source : sources) {
+        auto program = ExpressionParserT<double>(source).parse().compile();
+        auto reduced = program.reduce_strength();
+        std::cout << "strength reduction: " << (source.size() > 60 ? source.substr(0, 57) + "..." : source)
+                  << ", " << program.size() << " -> " << reduced.size() << " instructions" << std::endl;
+        std::vector<std::vector<double>> data(program.slot_count(), std::vector<double>(rows));
+        for (auto &column : data)
+            for (double &v : column) v = dist(rng);
+        std::vector<const double*> columns;
+        for (auto &column : data) columns.push_back(column.data());
+        std::vector<double> out(rows);
+        double checksum = 0;
+        auto scalar = [&](const compiled_expression<double> &tape) {
+            return measure_ms([&]() {
+                std::vector<double> slots(tape.slot_count());
+                for (std::size_t i = 0; i < rows; ++i) {
+                    for (std::size_t s = 0; s < slots.size(); ++s) slots[s] = data[s][i];
+                    checksum += tape.evaluate(slots.data());
+                }
+            });
+        };
+        double pow_ms = scalar(program);
+        report("pow evaluate", pow_ms, rows, pow_ms);
+        report("reduced evaluate", scalar(reduced), rows, pow_ms);
+        double pow_batch_ms = measure_ms([&]() { program.evaluate_batch(columns.data(), out.data(), rows); });
+        checksum += out[rows / 2];
+        report("pow batch", pow_batch_ms, rows, pow_batch_ms);
+        double reduced_batch_ms = measure_ms([&]() { reduced.evaluate_batch(columns.data(), out.data(), rows); });
+        checksum += out[rows / 2];
+        report("reduced batch", reduced_batch_ms, rows, pow_batch_ms);
+        std::cout << "  (" << checksum << ")" << std::endl;
+    }
+}
+
+// Смешанное вычисление: вещественные подвыражения в double против всей ленты в complex
+void bench_mixed() {
+    using C = std::complex<double>;
+    const std::string source =
+        "(sin(x) * exp(y / 3) + x^3 / (1 + y^2) + cos(x * y)^2) * z + (x - y)^4 / (2 + sin(y)) - z^2";
+    const std::size_t rows = 200000;
+    symbol_table symbols;
+    auto program = ExpressionParserT<C>(source).parse().bind(symbols);
+    std::vector<bool> real(program.slot_count(), true);
+    real[symbols.slot("z")] = false;
+    mixed_program mixed(program, real);
+    std::cout << "mixed real/complex: " << mixed.real_instructions() << " of " << mixed.size()
+              << " instructions real" << std::endl;
+
+    std::mt19937_64 rng(5);
+    std::uniform_real_distribution<double> dist(0.5, 2.0);
+    std::vector<C> data(rows * program.slot_count());
+    for (C &v : data) v = C(dist(rng), 0);
+    for (std::size_t i = 0; i < rows; ++i) data[i * program.slot_count() + symbols.slot("z")] = C(dist(rng), dist(rng));
+    C checksum = 0;
+    double complex_ms = measure_ms([&]() {
+        for (std::size_t i = 0; i < rows; ++i) checksum += program.evaluate(data.data() + i * program.slot_count());
+    });
+    report("all complex", complex_ms, rows, complex_ms);
+    double mixed_ms = measure_ms([&]() {
+        for (std::size_t i = 0; i < rows; ++i) checksum += mixed.evaluate(data.data() + i * program.slot_count());
+    });
+    report("mixed", mixed_ms, rows, complex_ms);
+    std::cout << "  (" << checksum << ")" << std::endl;
+}
+
+// ============================================================================
+// Набор регрессионных замеров: разбор, вычисление, дифференцирование,
+// подстановка и печать на синтетических выражениях растущего размера для
+// double и complex<double>. Результаты пишутся в JSON для сравнения запусков.
+// ============================================================================
+struct suite_result {
+    std::string family;
+    std::size_t size;
+    std::string type;
+    std::string op;
+    std::size_t reps;
+    double min_ns;
+    double median_ns;
+    double p99_ns;
+    double allocs_per_op;
+};
+
+// Повторяет op, пока не наберётся 30 мс или 200 повторов (но не меньше 5)
+template<typename Func>
+suite_result measure_case(Func op) {
+    op();
+    std::vector<double> samples;
+    samples.reserve(200);
+    const std::size_t before = allocation_count.load();
+    double total_ms = 0;
+    while (samples.size() < 5 || (total_ms < 30 && samples.size() < 200)) {
+        double ms = measure_ms(op);
+        total_ms += ms;
+        samples.push_back(ms * 1e6);
+    }
+    const std::size_t allocations = allocation_count.load() - before;
+    std::sort(samples.begin(), samples.end());
+    suite_result r{};
+    r.reps = samples.size();
+    r.min_ns = samples.front();
+    r.median_ns = samples[samples.size() / 2];
+    r.p99_ns = samples[std::min(samples.size() - 1, static_cast<std::size_t>(samples.size() * 0.99))];
+    r.allocs_per_op = static_cast<double>(allocations) / samples.size();
+    return r;
+}
+
+// Многочлен степени n: 1.5 + 2.5*x + 3.5*x^2 + ...
+std::string polynomial_source(std::size_t n) {
+    std::string source = "1.5";
+    for (std::size_t k = 1; k <= n; ++k)
+        source += " + " + std::to_string(k % 9 + 1) + ".5 * x^" + std::to_string(k);
+    return source;
+}
+
+// Вложенные функции глубины n: sin(0.5 * cos(0.5 * sin(... x)))
+std::string nested_source(std::size_t n) {
+    std::string source = "x";
+    for (std::size_t k = 0; k < n; ++k)
+        source = std::string(k % 2 ? "cos" : "sin") + "(0.5 * " + source + " + y)";
+    return source;
+}
+
+template<typename T>
+void suite_family(const std::string &family, std::size_t size, const std::string &type, const std::string &source,
+                  const expression<T> &expr, bool parse, std::vector<suite_result> &results) {
+    std::map<std::string, T> point{{"x", T(0.3)}, {"y", T(0.7)}};
+    const expression<T> replacement = expression<T>("y") * expression<T>(T(2));
+    std::size_t sink = 0;
+    auto add = [&](const std::string &op, suite_result r) {
+        r.family = family;
+        r.size = size;
+        r.type = type;
+        r.op = op;
+        std::cout << "  " << family << "/" << size << " " << type << " " << op << ": median " << r.median_ns / 1000
+                  << " us, p99 " << r.p99_ns / 1000 << " us, " << r.allocs_per_op << " allocs" << std::endl;
+        results.push_back(r);
+    };
+    if (parse)
+        add("parse", measure_case([&]() { sink += ExpressionParserT<T>(source).parse().to_string().size() > 0; }));
+    add("evaluate", measure_case([&]() { sink += std::abs(expr.evaluate(point)) > 0; }));
+    auto program = expr.compile();
+    add("evaluate_compiled", measure_case([&]() { sink += std::abs(program.evaluate(point)) > 0; }));
+    auto reduced = program.reduce_strength();
+    add("evaluate_reduced", measure_case([&]() { sink += std::abs(reduced.evaluate(point)) > 0; }));
+    add("differentiate", measure_case([&]() { sink += expr.differentiate("x").metrics().unique_nodes; }));
+    add("substitute", measure_case([&]() { sink += expr.substitute("x", replacement).metrics().unique_nodes; }));
+    add("to_string", measure_case([&]() { sink += expr.to_string().size(); }));
+    if (sink == 0) std::cout << "  (empty)" << std::endl;
+}
+
+template<typename T>
+void suite_type(const std::string &type, std::vector<suite_result> &results) {
+    for (std::size_t n : {10, 100, 1000}) {
+        std::string source = polynomial_source(n);
+        suite_family<T>("polynomial", n, type, source, ExpressionParserT<T>(source).parse(), true, results);
+    }
+    for (std::size_t n : {10, 100, 1000}) {
+        std::string source = nested_source(n);
+        suite_family<T>("nested", n, type, source, ExpressionParserT<T>(source).parse(), true, results);
+    }
+    // Повторные производные: текст разбирается только в исходном виде
+    const std::string base = "sin(x) * exp(x / 3) + x^3 / (1 + x^2) - ln(1 + x*y)";
+    auto expr = ExpressionParserT<T>(base).parse();
+    for (std::size_t order = 1; order <= 4; ++order) {
+        expr = expr.differentiate("x");
+        suite_family<T>("derivative", order, type, base, expr, false, results);
+    }
+}
+
+// Холодный старт: загрузка двоичного файла против повторного разбора текста
+// и дифференцирования
+void bench_binary() {
+    const std::string path = "/tmp/differ-bench-" + std::to_string(::getpid()) + ".bin";
+    std::size_t sink = 0;
+    const std::string source = "sin(x) * exp(x / 3) + x^3 / (1 + x^2) - ln(1 + x*y)";
+    auto derivative = [&]() {
+        auto expr = ExpressionParserT<double>(source).parse();
+        for (int order = 0; order < 5; ++order) expr = expr.differentiate("x");
+        return expr;
+    };
+    auto expr = derivative();
+    expr.save(path);
+    std::cout << "cold start, d^5 of " << source << ": " << expr.metrics().unique_nodes << " unique nodes" << std::endl;
+    double rebuild_ms = measure_ms([&]() { sink += derivative().metrics().unique_nodes; });
+    std::cout << "  parse and differentiate: " << rebuild_ms << " ms" << std::endl;
+    double load_ms = measure_ms([&]() { sink += expression<double>::load(path).metrics().unique_nodes; });
+    std::cout << "  load expression: " << load_ms << " ms, x" << rebuild_ms / load_ms << std::endl;
+    auto program = expr.compile();
+    program.save(path);
+    double compile_ms = measure_ms([&]() { sink += derivative().compile().size(); });
+    double tape_ms = measure_ms([&]() { sink += compiled_expression<double>::load(path).size(); });
+    std::cout << "  load tape: " << tape_ms << " ms, x" << compile_ms / tape_ms << " against "
+              << compile_ms << " ms with compile" << std::endl;
+
+    const std::string text = polynomial_source(5000);
+    ExpressionParserT<double>(text).parse().save(path);
+    double parse_ms = measure_ms([&]() { sink += ExpressionParserT<double>(text).parse().metrics().unique_nodes; });
+    std::cout << "  polynomial of degree 5000, " << text.size() / 1e6 << " MB of text: parse " << parse_ms << " ms";
+    load_ms = measure_ms([&]() { sink += expression<double>::load(path).metrics().unique_nodes; });
+    std::cout << ", load " << load_ms << " ms, x" << parse_ms / load_ms << " (" << sink << ")" << std::endl;
+    std::remove(path.c_str());
+}
+
+// float, double и long double на одной формуле: скорость пакетного
+// вычисления и максимальная относительная ошибка против long double
+template<typename T>
+void bench_precision_type(const std::string &name, const std::string &source, const std::vector<double> &xs,
+                          const std::vector<double> &ys, const std::vector<long double> &reference) {
+    const std::size_t rows = xs.size();
+    auto program = ExpressionParserT<T>(source).parse().compile();
+    std::vector<T> cx(xs.begin(), xs.end()), cy(ys.begin(), ys.end()), out(rows);
+    std::vector<const T*> columns(program.slot_count());
+    for (std::size_t v = 0; v < program.variables().size(); ++v)
+        columns[program.slots()[v]] = program.variables()[v] == "x" ? cx.data() : cy.data();
+    program.evaluate_batch(columns.data(), out.data(), rows);
+    double ms = measure_ms([&]() { program.evaluate_batch(columns.data(), out.data(), rows); });
+    long double error = 0;
+    for (std::size_t k = 0; k < rows; ++k)
+        error = std::max(error, std::fabs((static_cast<long double>(out[k]) - reference[k]) / reference[k]));
+    std::cout << "  " << name << ": " << ms << " ms, " << rows / ms / 1000.0 << " Mrows/s, max rel error "
+              << static_cast<double>(error) << std::endl;
+}
+
+void bench_precision() {
+    const std::size_t rows = 1 << 20;
+    const std::string source = "x*y + x/y - (x - y)*(x + y) + 3*x*x - y/7 + sin(x) * exp(y / 4)";
+    std::cout << "precision, " << rows << " rows: " << source << std::endl;
+    std::mt19937_64 rng(5);
+    std::uniform_real_distribution<double> dist(0.5, 2.0);
+    std::vector<double> xs(rows), ys(rows);
+    for (std::size_t k = 0; k < rows; ++k) {
+        xs[k] = dist(rng);
+        ys[k] = dist(rng);
+    }
+    auto reference_program = ExpressionParserT<long double>(source).parse().compile();
+    std::vector<long double> lx(xs.begin(), xs.end()), ly(ys.begin(), ys.end()), reference(rows);
+    std::vector<const long double*> lcolumns(reference_program.slot_count());
+    for (std::size_t v = 0; v < reference_program.variables().size(); ++v)
+        lcolumns[reference_program.slots()[v]] = reference_program.variables()[v] == "x" ? lx.data() : ly.data();
+    reference_program.evaluate_batch(lcolumns.data(), reference.data(), rows);
+
+    bench_precision_type<float>("float", source, xs, ys, reference);
+    bench_precision_type<double>("double", source, xs, ys, reference);
+    bench_precision_type<long double>("long double", source, xs, ys, reference);
+
+    mixed_precision_program mixed(ExpressionParserT<double>(source).parse().compile());
+    std::vector<const double*> columns(mixed.program().slot_count());
+    for (std::size_t v = 0; v < mixed.program().variables().size(); ++v)
+        columns[mixed.program().slots()[v]] = mixed.program().variables()[v] == "x" ? xs.data() : ys.data();
+    std::vector<double> out(rows);
+    std::size_t rechecked = 0;
+    double ms = measure_ms([&]() { rechecked = mixed.evaluate_batch(columns.data(), out.data(), rows); });
+    long double error = 0;
+    for (std::size_t k = 0; k < rows; ++k)
+        error = std::max(error, std::fabs((out[k] - reference[k]) / reference[k]));
+    std::cout << "  mixed float/double: " << ms << " ms, " << rows / ms / 1000.0 << " Mrows/s, max rel error "
+              << static_cast<double>(error) << ", " << rechecked << " rows rechecked in double" << std::endl;
+}
+
+// Табулирование на сетке: вынос подвыражений, не зависящих от внутренней
+// оси, против вложенных циклов с evaluate и пакетного вычисления всей сетки
+void bench_grid() {
+    const std::string source = "exp(sin(x)) * ln(x^2 + 1) + cos(x) / (2 + x) * y + sin(y) * x + y^2 / (1 + x^2)";
+    const std::size_t nx = 1000, ny = 1000;
+    std::cout << "grid " << nx << " x " << ny << ": " << source << std::endl;
+    auto expr = ExpressionParserT<double>(source).parse();
+    auto program = expr.compile();
+    std::vector<grid_axis<double>> axes{{"x", 0.1, 3.0, nx}, {"y", -2.0, 2.0, ny}};
+    std::vector<double> table(nx * ny), out(nx * ny);
+
+    double sum = 0;
+    double tree_ms = measure_ms([&]() {
+        for (std::size_t i = 0; i < nx; i += 10)
+            for (std::size_t j = 0; j < ny; ++j)
+                sum += expr.evaluate({{"x", axes[0].at(i)}, {"y", axes[1].at(j)}});
+    }) * 10;
+    std::vector<double> slots(program.slot_count());
+    const std::uint32_t x_slot = program.variables()[0] == "x" ? program.slots()[0] : program.slots()[1];
+    const std::uint32_t y_slot = program.variables()[0] == "x" ? program.slots()[1] : program.slots()[0];
+    double tape_ms = measure_ms([&]() {
+        for (std::size_t i = 0; i < nx; ++i) {
+            slots[x_slot] = axes[0].at(i);
+            for (std::size_t j = 0; j < ny; ++j) {
+                slots[y_slot] = axes[1].at(j);
+                out[i * ny + j] = program.evaluate(slots.data());
+            }
+        }
+    });
+    std::vector<double> xs(nx * ny), ys(nx * ny);
+    for (std::size_t i = 0; i < nx; ++i)
+        for (std::size_t j = 0; j < ny; ++j) {
+            xs[i * ny + j] = axes[0].at(i);
+            ys[i * ny + j] = axes[1].at(j);
+        }
+    std::vector<const double*> columns(program.slot_count());
+    columns[x_slot] = xs.data();
+    columns[y_slot] = ys.data();
+    double batch_ms = measure_ms([&]() { program.evaluate_batch(columns.data(), out.data(), nx * ny); });
+    double grid_ms = measure_ms([&]() { tabulate(program, axes, table.data()); });
+
+    double error = 0;
+    for (std::size_t k = 0; k < table.size(); ++k) error = std::max(error, std::fabs(table[k] - out[k]));
+    std::cout << "  (" << sum << ", max difference " << error << ")" << std::endl;
+    report("nested evaluate (tree, extrapolated)", tree_ms, nx * ny, tree_ms);
+    report("nested evaluate (tape)", tape_ms, nx * ny, tree_ms);
+    report("evaluate_batch over the grid", batch_ms, nx * ny, tree_ms);
+    report("tabulate", grid_ms, nx * ny, tree_ms);
+}
+
+void write_json(const std::string &path, const std::vector<suite_result> &results) {
+    std::ofstream out(path);
+    out << "{\n  \"suite\": \"differ\",\n  \"results\": [\n";
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const suite_result &r = results[i];
+        out << "    {\"family\": \"" << r.family << "\", \"size\": " << r.size << ", \"type\": \"" << r.type
+            << "\", \"op\": \"" << r.op << "\", \"reps\": " << r.reps << ", \"min_ns\": " << r.min_ns
+            << ", \"median_ns\": " << r.median_ns << ", \"p99_ns\": " << r.p99_ns
+            << ", \"allocs_per_op\": " << r.allocs_per_op << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+void bench_suite(const std::string &json_path) {
+    std::cout << "regression suite" << std::endl;
+    std::vector<suite_result> results;
+    suite_type<double>("double", results);
+    suite_type<std::complex<double>>("complex", results);
+    write_json(json_path, results);
+    std::cout << "  " << results.size() << " results written to " << json_path << std::endl;
+}
+
+int main(int argc, char **argv) {
+    // --json путь -- файл результатов набора; --suite -- только набор замеров
+    std::string json_path = "bench.json";
+    bool suite_only = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--json" && i + 1 < argc)
+            json_path = argv[++i];
+        else if (arg == "--suite")
+            suite_only = true;
+    }
+    if (suite_only) {
+        bench_suite(json_path);
+        return 0;
+    }
+    bench_batch();
+    bench_derivative_memory();
+    bench_simplify();
+    bench_gradient();
+    bench_dual();
+    bench_arena();
+    bench_jit();
+    bench_parse();
+    bench_print();
+    bench_lazy();
+    bench_incremental();
+    bench_static();
+    bench_parallel();
+    bench_stream();
+    bench_server();
+    bench_differentiate_all();
+    bench_strength();
+    bench_mixed();
+    bench_binary();
+    bench_precision();
+    bench_grid();
+    bench_suite(json_path);
+    return 0;
+}
@@ -5,6 +5,9 @@
 #include <complex>
 #include <stdexcept>
 #include <cctype>
+#include <vector>
+#include <cstdio>
+#include <memory>
 #include "head.hpp"
 
 std::string removeSpaces(const std::string& s) {
@@ -59,11 +62,71 @@ std::complex<double> parseComplex(const std::string& s) {
     return std::complex<double>(realPart, imagPart);
 }
 
+// Проверка, что всем переменным выражения заданы значения
+template<typename T>
+void requireBound(const compiled_expression<T>& program, const std::vector<bool>& bound) {
+    for (std::size_t i = 0; i < program.variables().size(); ++i) {
+        if (!bound[program.slots()[i]])
+            throw std::runtime_error("Variable " + program.variables()[i] + " not found");
+    }
+}
+
+// Счётчики инструментирования (--stats); без сборки с DIFFER_STATS они нулевые
+void printStats() {
+    expression_stats stats = collect_stats();
+    if (!stats.enabled) {
+        std::cerr << "stats: counters disabled, rebuild with make STATS=1" << std::endl;
+        return;
+    }
+    std::cerr << "stats: nodes allocated " << stats.node_allocations << ", reused " << stats.node_reuses
+              << ", clones " << stats.clones << std::endl;
+    std::cerr << "stats: visits";
+    for (std::size_t op = 0; op < op_code_count; ++op) {
+        if (stats.visits[op])
+            std::cerr << " " << op_code_name(static_cast<op_code>(op)) << "=" << stats.visits[op];
+    }
+    std::cerr << std::endl;
+    for (std::size_t phase = 0; phase < static_cast<std::size_t>(stats_phase::count); ++phase) {
+        std::cerr << "stats: " << stats_phase_name(static_cast<stats_phase>(phase)) << " "
+                  << stats.calls[phase] << " calls, " << stats.milliseconds[phase] << " ms" << std::endl;
+    }
+}
+
+// Размер выражения и самые дорогие поддеревья
+template<typename T>
+void printBreakdown(const expression<T>& expr) {
+    expression_metrics m = expr.metrics();
+    std::cerr << "stats: " << m.tree_nodes << " tree nodes, " << m.unique_nodes << " unique, depth "
+              << m.depth << std::endl;
+    for (const subtree_cost& part : expr.cost_breakdown(10)) {
+        std::cerr << "stats: " << part.share * 100 << "% cost " << part.cost << " x" << part.occurrences
+                  << " depth " << part.depth << "  " << part.text << std::endl;
+    }
+}
+
 int main(int argc, char **argv) {
+    // --stats можно указать в любом месте командной строки
+    bool stats = false;
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "--stats") {
+            stats = true;
+            for (int j = i; j + 1 < argc; ++j)
+                argv[j] = argv[j + 1];
+            --argc;
+            break;
+        }
+    }
+
     if (argc < 3) {
         std::cerr << "using:\n"
                   << "  differentiator --eval \"statement\" [var=value ...]\n"
-                  << "  differentiator --diff \"statement\" --by var\n";
+                  << "  differentiator --diff \"statement\" --by var [--minimal | --compact]\n"
+                  << "  differentiator --stream \"statement\" [file | -] [--csv | --tsv]\n"
+                  << "  differentiator --serve socket-path [--cache N]\n"
+                  << "  differentiator --emit-bin \"statement\" file [--by var]\n"
+                  << "  differentiator --load-bin file [var=value ...]\n"
+                  << "  differentiator --grid \"statement\" var=first:last:points ...\n"
+                  << "  --stats with any mode prints counters, timings and the cost breakdown\n";
         return 1;
     }
 
@@ -90,8 +153,12 @@ int main(int argc, char **argv) {
             if (useComplex) {
                 ExpressionParserT<std::complex<double>> parser(exprStr);
                 auto expr = parser.parse();
+                symbol_table symbols;
+                auto program = expr.bind(symbols);
 
-                std::map<std::string, std::complex<double>> vars;
+                std::vector<std::complex<double>> vars(program.slot_count());
+                std::vector<bool> bound(program.slot_count(), false);
+                std::vector<bool> realSlots(program.slot_count(), false);
                 for (int i = 3; i < argc; ++i) {
                     std::string assignment = argv[i];
                     size_t pos = assignment.find('=');
@@ -101,20 +168,32 @@ int main(int argc, char **argv) {
                     }
                     std::string var = assignment.substr(0, pos);
                     std::string valStr = assignment.substr(pos + 1);
-                    if (valStr.find('i') != std::string::npos)
-                        vars[var] = parseComplex(valStr);
-                    else {
-                        double value = std::stod(valStr);
-                        vars[var] = std::complex<double>(value, 0);
-                    }
+                    // Значение разбирается и у переменных, которых нет в выражении
+                    bool real = valStr.find('i') == std::string::npos;
+                    std::complex<double> value = real ? std::complex<double>(std::stod(valStr), 0)
+                                                      : parseComplex(valStr);
+                    if (!symbols.contains(var))
+                        continue;
+                    std::uint32_t slot = symbols.slot(var);
+                    vars[slot] = value;
+                    realSlots[slot] = real;
+                    bound[slot] = true;
                 }
-                auto result = expr.evaluate(vars);
+                requireBound(program, bound);
+                // Вещественные аргументы и подвыражения считаются в double
+                mixed_program mixed(program, realSlots);
+                auto result = mixed.evaluate(vars.data());
                 std::cout << result << std::endl;
+                if (stats)
+                    printBreakdown(expr);
             } else {
                 ExpressionParserT<double> parser(exprStr);
                 auto expr = parser.parse();
+                symbol_table symbols;
+                auto program = expr.bind(symbols);
 
-                std::map<std::string, double> vars;
+                std::vector<double> vars(program.slot_count());
+                std::vector<bool> bound(program.slot_count(), false);
                 for (int i = 3; i < argc; ++i) {
                     std::string assignment = argv[i];
                     size_t pos = assignment.find('=');
@@ -125,10 +204,17 @@ int main(int argc, char **argv) {
                     std::string var = assignment.substr(0, pos);
                     std::string valStr = assignment.substr(pos + 1);
                     double value = std::stod(valStr);
-                    vars[var] = value;
+                    if (!symbols.contains(var))
+                        continue;
+                    std::uint32_t slot = symbols.slot(var);
+                    vars[slot] = value;
+                    bound[slot] = true;
                 }
-                double result = expr.evaluate(vars);
+                requireBound(program, bound);
+                double result = program.evaluate(vars.data());
                 std::cout << result << std::endl;
+                if (stats)
+                    printBreakdown(expr);
             }
         } else if (mode == "--diff") {
             if (argc < 5) {
@@ -142,11 +228,153 @@ int main(int argc, char **argv) {
                 return 1;
             }
             std::string diffVar = argv[4];
+            print_style style = print_style::full;
+            if (argc > 5) {
+                std::string styleFlag = argv[5];
+                if (styleFlag == "--minimal")
+                    style = print_style::minimal;
+                else if (styleFlag == "--compact")
+                    style = print_style::compact;
+                else {
+                    std::cerr << "Unknown flag: " << styleFlag << std::endl;
+                    return 1;
+                }
+            }
 
             ExpressionParserT<double> parser(exprStr);
             auto expr = parser.parse();
             auto deriv = expr.differentiate(diffVar);
-            std::cout << deriv.to_string() << std::endl;
+            deriv.print(std::cout, style);
+            std::cout << std::endl;
+            if (stats)
+                printBreakdown(deriv);
+        } else if (mode == "--stream") {
+            // Заголовок таблицы -- имена переменных, далее по строке значений на вычисление
+            std::string exprStr = argv[2];
+            std::string path = "-";
+            stream_options options;
+            for (int i = 3; i < argc; ++i) {
+                std::string arg = argv[i];
+                if (arg == "--csv")
+                    options.delimiter = ',';
+                else if (arg == "--tsv")
+                    options.delimiter = '\t';
+                else
+                    path = arg;
+            }
+
+            ExpressionParserT<double> parser(exprStr);
+            auto expr = parser.parse();
+            std::FILE *in = stdin;
+            if (path != "-") {
+                in = std::fopen(path.c_str(), "rb");
+                if (!in) {
+                    std::cerr << "ERR: cannot open " << path << std::endl;
+                    return 1;
+                }
+            }
+            std::unique_ptr<std::FILE, int (*)(std::FILE*)> guard(in == stdin ? nullptr : in, std::fclose);
+            stream_evaluate(expr, in, stdout, options);
+            if (stats)
+                printBreakdown(expr);
+        } else if (mode == "--emit-bin") {
+            // Выражение (или его производная) сохраняется в двоичном формате
+            if (argc != 4 && !(argc == 6 && std::string(argv[4]) == "--by")) {
+                std::cerr << "using: differentiator --emit-bin \"statement\" file [--by var]\n";
+                return 1;
+            }
+            ExpressionParserT<double> parser(argv[2]);
+            auto expr = parser.parse();
+            if (argc == 6)
+                expr = expr.differentiate(argv[5]);
+            expr.save(argv[3]);
+            if (stats)
+                printBreakdown(expr);
+        } else if (mode == "--load-bin") {
+            // Без значений переменных выражение печатается, иначе вычисляется
+            auto expr = expression<double>::load(argv[2]);
+            if (argc == 3) {
+                expr.print(std::cout, print_style::minimal);
+                std::cout << std::endl;
+            } else {
+                symbol_table symbols;
+                auto program = expr.bind(symbols);
+                std::vector<double> vars(program.slot_count());
+                std::vector<bool> bound(program.slot_count(), false);
+                for (int i = 3; i < argc; ++i) {
+                    std::string assignment = argv[i];
+                    size_t pos = assignment.find('=');
+                    if (pos == std::string::npos) {
+                        std::cerr << "ERR Variable: " << assignment << std::endl;
+                        return 1;
+                    }
+                    std::string var = assignment.substr(0, pos);
+                    double value = std::stod(assignment.substr(pos + 1));
+                    if (!symbols.contains(var))
+                        continue;
+                    std::uint32_t slot = symbols.slot(var);
+                    vars[slot] = value;
+                    bound[slot] = true;
+                }
+                requireBound(program, bound);
+                std::cout << program.evaluate(vars.data()) << std::endl;
+            }
+            if (stats)
+                printBreakdown(expr);
+        } else if (mode == "--grid") {
+            // Оси в порядке вложенности циклов: первая -- внешняя. Каждая
+            // строка вывода -- значения осей и значение выражения
+            std::vector<grid_axis<double>> axes;
+            for (int i = 3; i < argc; ++i) {
+                std::string spec = argv[i];
+                size_t eq = spec.find('=');
+                size_t colon = spec.find(':', eq == std::string::npos ? 0 : eq);
+                size_t last = colon == std::string::npos ? colon : spec.find(':', colon + 1);
+                if (eq == std::string::npos || last == std::string::npos) {
+                    std::cerr << "ERR Axis: " << spec << " (expected var=first:last:points)" << std::endl;
+                    return 1;
+                }
+                // Число точек -- только положительное целое: stoul принял бы "-1"
+                std::string count = spec.substr(last + 1);
+                size_t used = 0;
+                unsigned long points = 0;
+                if (!count.empty() && std::isdigit(static_cast<unsigned char>(count[0])))
+                    points = std::stoul(count, &used);
+                if (points == 0 || used != count.size()) {
+                    std::cerr << "ERR Axis points: " << spec << " (expected a positive integer)" << std::endl;
+                    return 1;
+                }
+                axes.push_back({spec.substr(0, eq), std::stod(spec.substr(eq + 1, colon - eq - 1)),
+                                std::stod(spec.substr(colon + 1, last - colon - 1)), static_cast<std::size_t>(points)});
+            }
+            ExpressionParserT<double> parser(argv[2]);
+            auto expr = parser.parse();
+            std::vector<double> table = tabulate(expr, axes);
+            std::vector<std::size_t> index(axes.size(), 0);
+            for (double value : table) {
+                for (std::size_t a = 0; a < axes.size(); ++a)
+                    std::cout << axes[a].at(index[a]) << ' ';
+                std::cout << value << '\n';
+                for (std::size_t a = axes.size(); a-- > 0;) {
+                    if (++index[a] < axes[a].points) break;
+                    index[a] = 0;
+                }
+            }
+            std::cout.flush();
+            if (stats)
+                printBreakdown(expr);
+        } else if (mode == "--serve") {
+            std::string path = argv[2];
+            std::size_t capacity = 256;
+            if (argc > 4 && std::string(argv[3]) == "--cache")
+                capacity = std::stoul(argv[4]);
+            expression_server server(capacity);
+            std::cerr << "listening on " << path << std::endl;
+            server.serve(path);
+            latency_report report = server.latency();
+            std::cerr << "served " << report.requests << " requests, p50 " << report.p50_us
+                      << " us, p99 " << report.p99_us << " us, cache hits " << report.cache_hits
+                      << ", misses " << report.cache_misses << std::endl;
         } else {
             std::cerr << "Unknown method: " << mode << std::endl;
             return 1;
@@ -156,5 +384,7 @@ int main(int argc, char **argv) {
         return 1;
     }
 
+    if (stats)
+        printStats();
     return 0;
 }
@@ -0,0 +1,270 @@
+#ifndef COMPILED_HPP
+#define COMPILED_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "dual.hpp"
+
+template<typename T>
+class expression;
+
+// ============================================================================
+// Коды операций узлов дерева и инструкций скомпилированного выражения
+// ============================================================================
+enum class op_code : std::uint8_t {
+    constant,
+    variable,
+    add,
+    sub,
+    mul,
+    div,
+    pow,
+    sin,
+    cos,
+    ln,
+    exp,
+    // Только в ленте после reduce_strength(): целая степень и a * b + c
+    powi,
+    fma,
+    unknown
+};
+
+// Перевод строкового имени операции в код (unknown, если операция не известна)
+op_code binary_op_code(const std::string &op);
+op_code unary_op_code(const std::string &op);
+
+// Обратное преобразование: имя операции по коду ("+", "sin", ...)
+const char* op_code_name(op_code op);
+
+inline bool is_binary(op_code op) {
+    return op >= op_code::add && op <= op_code::pow;
+}
+
+// Набор SIMD-инструкций для пакетного вычисления (для double и float)
+enum class simd_level : std::uint8_t {
+    scalar,
+    sse2,
+    avx2,
+    avx512
+};
+
+// Лучший уровень, поддерживаемый процессором (определяется во время выполнения)
+simd_level detect_simd_level();
+const char* simd_level_name(simd_level level);
+
+// Размер выражения: число узлов при развёртке в дерево, число уникальных
+// (общих) узлов, оценка занимаемой ими памяти в байтах и глубина дерева
+struct expression_metrics {
+    std::size_t tree_nodes;
+    std::size_t unique_nodes;
+    std::size_t bytes;
+    std::size_t depth;
+};
+
+// Доля поддерева в стоимости вычисления дерева. Стоимость -- взвешенное
+// число операций (арифметика -- 1, деление -- 4, ^ и функции -- 20) при
+// вычислении поддерева как дерева; общий узел, встречающийся в дереве
+// occurrences раз, вычисляется столько же раз.
+struct subtree_cost {
+    std::string text;         // поддерево в компактной записи (длинное -- обрезано)
+    double cost;              // стоимость одного вычисления поддерева
+    double occurrences;       // число вхождений в дерево всего выражения
+    double share;             // cost * occurrences от стоимости всего выражения
+    std::size_t tree_nodes;
+    std::size_t depth;
+};
+
+// Формат печати выражения:
+//   full    -- каждая бинарная операция в скобках: ((2 * x) + 1)
+//   minimal -- скобки только там, где их требуют приоритеты: 2 * x + 1
+//   compact -- как minimal, но без пробелов: 2*x+1
+// Отрицательные константы-операнды во всех стилях берутся в скобки:
+// (-1) * x, (x ^ (-1)). Числа в minimal и compact печатаются без потери
+// точности, поэтому вещественное выражение разбирается парсером обратно в
+// то же дерево; full печатает числа как operator<< (6 значащих цифр).
+enum class print_style : std::uint8_t {
+    full,
+    minimal,
+    compact
+};
+
+// ============================================================================
+// Двоичный формат выражений и лент (версия binary_version). За заголовком
+// идут разделы, каждый выровнен на 8 байт:
+//   constants  -- constant_count значений T в машинном представлении;
+//   nodes      -- node_count записей binary_record, потомки и операнды
+//                 ссылаются только на более ранние записи, корень -- последняя;
+//   offsets    -- name_count + 1 смещений имён в names;
+//   slots      -- name_count слотов переменных (только для ленты);
+//   names      -- names_bytes байт имён подряд, без завершающих нулей.
+// Запись выражения: constant -- a индекс в пуле, variable -- a номер имени,
+// операция -- a (и b) номера потомков; операция с неизвестным именем хранит
+// имя в c, у унарной b == binary_unary. Запись ленты совпадает с instruction.
+// ============================================================================
+constexpr std::uint32_t binary_version = 1;
+constexpr std::uint32_t binary_unary = 0xFFFFFFFFu;
+
+enum class binary_kind : std::uint32_t {
+    expression = 1,
+    program = 2
+};
+
+struct binary_header {
+    char magic[8];              // "DIFFBIN" и ноль
+    std::uint32_t version;
+    binary_kind kind;
+    std::uint32_t scalar;       // код типа T (1 -- double, 2 -- complex<double>, ...)
+    std::uint32_t scalar_size;  // sizeof(T)
+    std::uint32_t node_count;
+    std::uint32_t constant_count;
+    std::uint32_t name_count;
+    std::uint32_t slot_count;
+    std::uint64_t names_bytes;
+};
+
+struct binary_record {
+    std::uint32_t op;
+    std::uint32_t a;
+    std::uint32_t b;
+    std::uint32_t c;
+};
+
+// ============================================================================
+// Таблица символов: каждому имени переменной один раз выдаётся плотный
+// целочисленный слот. Имена хранятся в таблице в единственном экземпляре.
+// ============================================================================
+class symbol_table {
+public:
+    // Слот имени (новое имя получает следующий свободный слот)
+    std::uint32_t intern(const std::string &name);
+    // Слот уже известного имени; бросает исключение, если имени нет
+    std::uint32_t slot(const std::string &name) const;
+    bool contains(const std::string &name) const;
+    const std::string& name(std::uint32_t slot) const { return names_[slot]; }
+    std::size_t size() const { return names_.size(); }
+
+private:
+    std::vector<std::string> names_;
+    std::unordered_map<std::string, std::uint32_t> slots_;
+};
+
+// ============================================================================
+// Скомпилированное выражение: плоская лента инструкций в обратной польской
+// записи (post-order) и пул констант. Результат инструкции i лежит в регистре i,
+// операнды a и b -- номера регистров уже вычисленных инструкций. Для constant
+// поле a -- индекс в пуле констант, для variable -- номер слота переменной.
+// Для powi поле b -- показатель (int32), для fma третий операнд -- регистр c.
+// ============================================================================
+template<typename T>
+class compiled_expression {
+public:
+    struct instruction {
+        op_code op;
+        std::uint32_t a;
+        std::uint32_t b;
+        std::uint32_t c;
+    };
+
+    // Значения переменных передаются массивом по слотам таблицы символов,
+    // длина массива -- не меньше slot_count()
+    T evaluate(const T *slots) const;
+    // То же с внешним массивом регистров размером не меньше size()
+    T evaluate(const T *slots, T *regs) const;
+    // Адаптер для старого интерфейса со словарём переменных
+    T evaluate(const std::map<std::string, T> &variables) const;
+    // Прямой режим: значение и производная по направлению direction (массив
+    // той же длины, что и slots) за один проход без построения производной
+    dual<T> evaluate_dual(const T *slots, const T *direction) const;
+
+    // Пакетное вычисление над столбцами (struct-of-arrays): columns[slot] --
+    // массив из count значений переменной со слотом slot, out -- count результатов.
+    // Для double и float операции + - * / выполняются SIMD-ядрами выбранного уровня
+    // (по умолчанию -- лучшего доступного), уровень выше доступного понижается.
+    void evaluate_batch(const T *const *columns, T *out, std::size_t count) const;
+    void evaluate_batch(const T *const *columns, T *out, std::size_t count, simd_level level) const;
+
+    // Обратный режим автоматического дифференцирования: прямой проход по
+    // ленте сохраняет значения регистров, обратный -- накапливает сопряжённые
+    // значения. В grad (slot_count() элементов) записываются частные
+    // производные по всем слотам, возвращается значение выражения.
+    T gradient(const T *slots, T *grad) const;
+
+    // Генерация самостоятельного C++ кода ленты (только double и complex<double>):
+    //   extern "C" int name(const T *slots, T *out);
+    //   extern "C" int name_batch(const T *const *columns, T *out, std::size_t count);
+    // Код возврата: 0 -- успех, 1 -- деление на ноль, 2 -- ln от неположительного
+    std::string emit_cpp(const std::string &name) const;
+
+    // Понижение стоимости операций (включается явно; порядок операций
+    // меняется, поэтому результат может отличаться от исходной ленты --
+    // обычно в пределах нескольких ошибок округления на член суммы):
+    //   x ^ n для целых |n| <= 64 -- возведение в квадрат и умножение (powi);
+    //   многочлены от одной переменной, уже записанные суммой одночленов
+    //   c * x^k (не меньше двух ненулевых членов, степень до 32), -- схема
+    //   Горнера на fma, аппаратном при FP_FAST_FMA. Произведения и степени
+    //   сумм не раскрываются: (x - a)^n остаётся powi от x - a, чтобы не
+    //   терять точность у корня. Ставшие ненужными инструкции удаляются.
+    compiled_expression reduce_strength() const;
+
+    // Двоичный файл ленты (см. binary_header): инструкции, пул констант,
+    // имена и слоты переменных. load отображает файл через mmap и копирует
+    // каждый раздел одним блоком; при повреждённом файле -- исключение.
+    void save(const std::string &path) const;
+    static compiled_expression load(const std::string &path);
+
+    const std::vector<instruction>& code() const { return code_; }
+    const std::vector<T>& constants() const { return constants_; }
+    // Имена используемых переменных и их слоты (в порядке первого появления)
+    const std::vector<std::string>& variables() const { return names_; }
+    const std::vector<std::uint32_t>& slots() const { return slots_; }
+    std::size_t slot_count() const { return slot_count_; }
+    std::size_t size() const { return code_.size(); }
+
+private:
+    friend class expression<T>;
+
+    template<typename V>
+    V execute(const V *slots, V *regs) const;
+
+    std::vector<instruction> code_;
+    std::vector<T> constants_;
+    std::vector<std::string> names_;
+    std::vector<std::uint32_t> slots_;
+    std::size_t slot_count_ = 0;
+};
+
+// ============================================================================
+// Шаг интерпретатора ленты для вычислителей вне compiled_expression
+// (инкрементального, смешанного, сеточного и т. п.): арифметика и ошибки
+// области определения те же, что у evaluate, но без печати в std::cout.
+// Инструкция задаётся полями {op, a, b, c}; constant и variable вызывающий
+// обрабатывает сам.
+// ============================================================================
+
+// Результат операции op над значениями операндов x, y, z (y -- у бинарных
+// операций и fma, z -- у fma); у powi показатель -- exponent
+template<typename T>
+T tape_apply(op_code op, const T &x, const T &y, const T &z, std::int32_t exponent);
+
+// Инструкция над регистрами: операнд a -- regs[a]; у powi поле b -- показатель
+template<typename T>
+T tape_step(op_code op, std::uint32_t a, std::uint32_t b, std::uint32_t c, const T *regs);
+
+// То же для len строк: операнд a -- массив lanes[a], результат пишется в out.
+// При check_domain == false деление на ноль и ln неположительного числа не
+// бросают исключение, а дают inf и NaN (строки проверяет вызывающий).
+template<typename T>
+void tape_step_lanes(op_code op, std::uint32_t a, std::uint32_t b, std::uint32_t c, const T *const *lanes, T *out,
+                     std::size_t len, bool check_domain = true);
+
+// Градиент выражения в точке за один прямой и один обратный проход:
+// частные производные по всем переменным выражения
+template<typename T>
+std::map<std::string, T> gradient(const expression<T> &expr, const std::map<std::string, T> &bindings);
+
+#endif // COMPILED_HPP
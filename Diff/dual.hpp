@@ -0,0 +1,112 @@
+#ifndef DUAL_HPP
+#define DUAL_HPP
+
+#include <cmath>
+#include <complex>
+#include <ostream>
+
+// ============================================================================
+// Дуальное число value + derivative*e, e^2 = 0: прямой режим автоматического
+// дифференцирования. Вычисление выражения над dual<T> за один проход даёт
+// f(x) и производную f'(x)*v по направлению v, заданному в derivative
+// переменных, без построения дерева производной.
+// ============================================================================
+template<typename T>
+struct dual {
+    T value;
+    T derivative;
+
+    dual() : value(), derivative() {}
+    dual(T v) : value(v), derivative() {}
+    dual(T v, T d) : value(v), derivative(d) {}
+
+    dual& operator+=(const dual &other) {
+        value += other.value;
+        derivative += other.derivative;
+        return *this;
+    }
+    dual& operator-=(const dual &other) {
+        value -= other.value;
+        derivative -= other.derivative;
+        return *this;
+    }
+    dual& operator*=(const dual &other) {
+        derivative = derivative * other.value + value * other.derivative;
+        value *= other.value;
+        return *this;
+    }
+    dual& operator/=(const dual &other) {
+        derivative = (derivative * other.value - value * other.derivative) / (other.value * other.value);
+        value /= other.value;
+        return *this;
+    }
+    dual operator-() const { return dual(-value, -derivative); }
+};
+
+template<typename T>
+dual<T> operator+(dual<T> a, const dual<T> &b) { return a += b; }
+template<typename T>
+dual<T> operator-(dual<T> a, const dual<T> &b) { return a -= b; }
+template<typename T>
+dual<T> operator*(dual<T> a, const dual<T> &b) { return a *= b; }
+template<typename T>
+dual<T> operator/(dual<T> a, const dual<T> &b) { return a /= b; }
+
+// Равенство -- по обеим частям; упорядочивание -- по значению
+template<typename T>
+bool operator==(const dual<T> &a, const dual<T> &b) {
+    return a.value == b.value && a.derivative == b.derivative;
+}
+template<typename T>
+bool operator!=(const dual<T> &a, const dual<T> &b) { return !(a == b); }
+template<typename T>
+bool operator<(const dual<T> &a, const dual<T> &b) { return a.value < b.value; }
+template<typename T>
+bool operator<=(const dual<T> &a, const dual<T> &b) { return a.value <= b.value; }
+
+template<typename T>
+dual<T> sin(const dual<T> &x) {
+    using std::sin;
+    using std::cos;
+    return dual<T>(sin(x.value), cos(x.value) * x.derivative);
+}
+
+template<typename T>
+dual<T> cos(const dual<T> &x) {
+    using std::sin;
+    using std::cos;
+    return dual<T>(cos(x.value), -(sin(x.value) * x.derivative));
+}
+
+template<typename T>
+dual<T> log(const dual<T> &x) {
+    using std::log;
+    return dual<T>(log(x.value), x.derivative / x.value);
+}
+
+template<typename T>
+dual<T> exp(const dual<T> &x) {
+    using std::exp;
+    T e = exp(x.value);
+    return dual<T>(e, e * x.derivative);
+}
+
+// При постоянном показателе используется c * a^(c-1) * a', чтобы не брать
+// логарифм отрицательного основания
+template<typename T>
+dual<T> pow(const dual<T> &a, const dual<T> &b) {
+    using std::pow;
+    using std::log;
+    T p = pow(a.value, b.value);
+    if(b.derivative == T(0))
+        return dual<T>(p, b.value * pow(a.value, b.value - T(1)) * a.derivative);
+    return dual<T>(p, p * (b.derivative * log(a.value) + b.value * a.derivative / a.value));
+}
+
+template<typename T>
+std::ostream& operator<<(std::ostream &out, const dual<T> &x) {
+    if(x.derivative == T(0)) return out << x.value;
+    return out << "(" << x.value << "," << x.derivative << ")";
+}
+
+#endif // DUAL_HPP
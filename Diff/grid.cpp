@@ -0,0 +1,184 @@
+#include <algorithm>
+#include <complex>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+#include "head.hpp"
+
+namespace {
+
+// Длина порции внутренней оси: регистры порции помещаются в кэш
+constexpr std::size_t grid_chunk = 256;
+
+// Число точек сетки; произведение, не помещающееся в size_t, -- исключение
+template<typename T>
+std::size_t grid_size(const std::vector<grid_axis<T>> &axes) {
+    std::size_t total = 1;
+    for (const auto &axis : axes) {
+        if (axis.points != 0 && total > std::numeric_limits<std::size_t>::max() / axis.points)
+            throw std::runtime_error("Grid is too large");
+        total *= axis.points;
+    }
+    return total;
+}
+
+} // namespace
+
+template<typename T>
+void tabulate(const compiled_expression<T> &program, const std::vector<grid_axis<T>> &axes, T *out) {
+    DIFFER_TIMER(evaluate);
+    if (axes.empty()) throw std::runtime_error("Grid has no axes");
+    for (std::size_t a = 0; a < axes.size(); ++a)
+        for (std::size_t b = 0; b < a; ++b)
+            if (axes[a].var == axes[b].var) throw std::runtime_error("Axis " + axes[a].var + " given twice");
+    if (grid_size(axes) == 0) return;
+
+    const auto &names = program.variables();
+    const std::size_t d = axes.size();
+    const int inner = static_cast<int>(d) - 1;
+    std::vector<int> slot_axis(program.slot_count(), -1);
+    for (std::size_t v = 0; v < names.size(); ++v) {
+        auto it = std::find_if(axes.begin(), axes.end(), [&](const grid_axis<T> &axis) { return axis.var == names[v]; });
+        if (it == axes.end()) throw std::runtime_error("Variable " + names[v] + " not found");
+        slot_axis[program.slots()[v]] = static_cast<int>(it - axes.begin());
+    }
+
+    // level -- самая глубокая внешняя ось, от которой зависит инструкция
+    // (-1 -- ни одной), varying -- зависимость от последней оси
+    const auto &code = program.code();
+    const std::size_t n = code.size();
+    std::vector<int> level(n, -1);
+    std::vector<std::uint8_t> varying(n, 0);
+    for (std::size_t i = 0; i < n; ++i) {
+        const auto &c = code[i];
+        auto merge = [&](std::uint32_t reg) {
+            level[i] = std::max(level[i], level[reg]);
+            varying[i] |= varying[reg];
+        };
+        if (c.op == op_code::constant) continue;
+        if (c.op == op_code::variable) {
+            if (slot_axis[c.a] == inner) varying[i] = 1;
+            else level[i] = slot_axis[c.a];
+            continue;
+        }
+        merge(c.a);
+        if (is_binary(c.op) || c.op == op_code::fma) merge(c.b);
+        if (c.op == op_code::fma) merge(c.c);
+    }
+
+    // Скаляры по уровням (индекс level + 1); таблицы последней оси считаются
+    // один раз, строковые инструкции -- в каждой строке
+    const std::size_t m = axes[inner].points;
+    std::vector<std::vector<std::uint32_t>> scalars(d);
+    std::vector<std::uint32_t> tables, rows, moving;
+    std::vector<T> regs(n);
+    std::vector<T*> base(n, nullptr);
+    std::vector<const T*> lanes(n, nullptr);
+    std::vector<T> inner_values(m);
+    for (std::size_t k = 0; k < m; ++k) inner_values[k] = axes[inner].at(k);
+    std::size_t table_count = 0, row_count = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+        if (!varying[i]) scalars[level[i] + 1].push_back(static_cast<std::uint32_t>(i));
+        else if (code[i].op == op_code::variable) moving.push_back(static_cast<std::uint32_t>(i));
+        else if (level[i] < 0) ++table_count;
+        else ++row_count;
+    }
+    std::vector<T> table_data(table_count * m), row_data(row_count * grid_chunk);
+    table_count = row_count = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+        if (!varying[i]) continue;
+        if (code[i].op == op_code::variable) {
+            base[i] = inner_values.data();
+        } else if (level[i] < 0) {
+            tables.push_back(static_cast<std::uint32_t>(i));
+            moving.push_back(static_cast<std::uint32_t>(i));
+            base[i] = table_data.data() + table_count++ * m;
+        } else {
+            rows.push_back(static_cast<std::uint32_t>(i));
+            base[i] = row_data.data() + row_count++ * grid_chunk;
+            lanes[i] = base[i];
+        }
+    }
+
+    // Скалярные операнды векторных инструкций размножаются на порцию
+    std::vector<std::vector<std::uint32_t>> spread(d);
+    std::vector<std::vector<T>> spread_data(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        if (!varying[i] || code[i].op == op_code::variable) continue;
+        const auto &c = code[i];
+        auto use = [&](std::uint32_t reg) {
+            if (varying[reg] || !spread_data[reg].empty()) return;
+            spread_data[reg].resize(grid_chunk);
+            lanes[reg] = spread_data[reg].data();
+            spread[level[reg] + 1].push_back(reg);
+        };
+        use(c.a);
+        if (is_binary(c.op) || c.op == op_code::fma) use(c.b);
+        if (c.op == op_code::fma) use(c.c);
+    }
+
+    std::vector<std::size_t> index(d, 0);
+    auto compute_level = [&](int l) {
+        for (std::uint32_t i : scalars[l + 1]) {
+            const auto &c = code[i];
+            if (c.op == op_code::constant) regs[i] = program.constants()[c.a];
+            else if (c.op == op_code::variable) regs[i] = axes[l].at(index[l]);
+            else regs[i] = tape_step(c.op, c.a, c.b, c.c, regs.data());
+        }
+        for (std::uint32_t i : spread[l + 1]) std::fill(spread_data[i].begin(), spread_data[i].end(), regs[i]);
+    };
+    // Порция [start, start + len) последней оси для списка векторных инструкций
+    auto sweep = [&](const std::vector<std::uint32_t> &list, std::size_t start, std::size_t len) {
+        for (std::uint32_t i : moving) lanes[i] = base[i] + start;
+        for (std::uint32_t i : list) {
+            // Таблица пишется на место порции, строка -- в начало своего буфера
+            const auto &c = code[i];
+            tape_step_lanes(c.op, c.a, c.b, c.c, lanes.data(), level[i] < 0 ? base[i] + start : base[i], len);
+        }
+    };
+
+    compute_level(-1);
+    for (std::size_t start = 0; start < m; start += grid_chunk) sweep(tables, start, std::min(grid_chunk, m - start));
+
+    // Внешние оси перебираются как разряды счётчика; при смене оси l
+    // пересчитываются скаляры уровней l и глубже
+    std::size_t outer = 1;
+    for (int a = 0; a < inner; ++a) outer *= axes[a].points;
+    const std::size_t root = n - 1;
+    int changed = 0;
+    for (std::size_t row = 0; row < outer; ++row) {
+        for (int l = changed; l < inner; ++l) compute_level(l);
+        T *target = out + row * m;
+        if (!varying[root]) {
+            std::fill_n(target, m, regs[root]);
+        } else if (code[root].op == op_code::variable || level[root] < 0) {
+            std::copy_n(base[root], m, target);
+        } else {
+            for (std::size_t start = 0; start < m; start += grid_chunk) {
+                const std::size_t len = std::min(grid_chunk, m - start);
+                sweep(rows, start, len);
+                std::copy_n(lanes[root], len, target + start);
+            }
+        }
+        for (changed = inner - 1; changed >= 0; --changed) {
+            if (++index[changed] < axes[changed].points) break;
+            index[changed] = 0;
+        }
+    }
+}
+
+template<typename T>
+std::vector<T> tabulate(const expression<T> &expr, const std::vector<grid_axis<T>> &axes) {
+    const std::size_t total = grid_size(axes);
+    if (total > std::vector<T>().max_size()) throw std::runtime_error("Grid is too large");
+    std::vector<T> out(total);
+    tabulate(expr.compile(), axes, out.data());
+    return out;
+}
+
+template void tabulate(const compiled_expression<double>&, const std::vector<grid_axis<double>>&, double*);
+template void tabulate(const compiled_expression<std::complex<double>>&,
+                       const std::vector<grid_axis<std::complex<double>>>&, std::complex<double>*);
+template std::vector<double> tabulate(const expression<double>&, const std::vector<grid_axis<double>>&);
+template std::vector<std::complex<double>> tabulate(const expression<std::complex<double>>&,
+                                                    const std::vector<grid_axis<std::complex<double>>>&);
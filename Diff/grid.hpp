@@ -0,0 +1,48 @@
+#ifndef GRID_HPP
+#define GRID_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "compiled.hpp"
+
+// Ось сетки: points равноотстоящих значений переменной var от first до
+// last включительно (при points == 1 -- только first)
+template<typename T>
+struct grid_axis {
+    std::string var;
+    T first;
+    T last;
+    std::size_t points;
+
+    T at(std::size_t k) const {
+        if (points < 2 || k == 0) return first;
+        if (k + 1 == points) return last;
+        return first + (last - first) * T(static_cast<double>(k) / static_cast<double>(points - 1));
+    }
+};
+
+// ============================================================================
+// Табулирование выражения на декартовой сетке. Первая ось -- внешний цикл,
+// последняя -- внутренний; результат пишется построчно в непрерывный массив
+// (последняя ось меняется быстрее всех), его длина -- произведение points.
+// Для каждой инструкции ленты определяется, от каких осей она зависит:
+//   не зависит от последней оси -- вычисляется как скаляр один раз при смене
+//   самой глубокой из своих осей (константы -- один раз на всю сетку);
+//   зависит только от последней оси -- вычисляется один раз для всех её
+//   точек и переиспользуется во всех строках;
+//   остальные -- для каждой строки, порциями по всей последней оси (как
+//   evaluate_batch), скалярные операнды подставляются размноженными.
+// Каждая переменная ленты должна быть осью, иначе -- исключение; оси, от
+// которых выражение не зависит, только размножают результат. Произведение
+// points, не помещающееся в size_t, -- тоже исключение.
+// ============================================================================
+template<typename T>
+void tabulate(const compiled_expression<T> &program, const std::vector<grid_axis<T>> &axes, T *out);
+
+// То же для дерева (лента строится expr.compile())
+template<typename T>
+std::vector<T> tabulate(const expression<T> &expr, const std::vector<grid_axis<T>> &axes);
+
+#endif // GRID_HPP
@@ -9,22 +9,43 @@
 #include <stdexcept>
 #include <cctype>
 #include <string>
+#include <string_view>
 #include <memory>
 
+#include "compiled.hpp"
+#include "arena.hpp"
+#include "jit.hpp"
+#include "parallel.hpp"
+#include "stream.hpp"
+#include "server.hpp"
+#include "stats.hpp"
+#include "mixed.hpp"
+#include "incremental.hpp"
+#include "static_expression.hpp"
+#include "precision.hpp"
+#include "grid.hpp"
+
+template<typename T>
+struct lazy_derivative_node;
+
 // ============================================================================
 // Объявление класса expression (шаблонный класс)
 // ============================================================================
 template<typename T>
 class expression {
 public:
-    // Абстрактный базовый класс для узлов дерева выражения
-    struct node_base {
+    // Абстрактный базовый класс для узлов дерева выражения.
+    // Узлы неизменяемы и уникальны (hash-consing): одинаковые поддеревья
+    // представлены одним общим узлом, поэтому clone() не копирует дерево
+    struct node_base : std::enable_shared_from_this<node_base> {
         virtual T evaluate(const std::map<std::string, T>&) const = 0;
         virtual std::string to_string() const = 0;
         virtual std::shared_ptr<node_base> differentiate(const std::string&) const = 0;
         virtual std::shared_ptr<node_base> substitute(const std::string&, const std::shared_ptr<node_base>&) const = 0;
-        virtual std::shared_ptr<node_base> clone() const = 0;
-        virtual ~node_base() {}
+        virtual std::shared_ptr<node_base> clone() const;
+        virtual op_code kind() const = 0;
+        // Потомки освобождаются в цикле, без рекурсии по глубине дерева
+        virtual ~node_base();
     };
 
     // Конструкторы
@@ -36,10 +57,52 @@ public:
     expression& operator=(expression &&other) noexcept;
     ~expression();
 
-    std::string to_string() const;
+    std::string to_string(print_style style = print_style::full) const;
+    // Печать без рекурсии и промежуточных строк: дописывает в buffer или
+    // пишет в поток кусками
+    void print(std::string &buffer, print_style style = print_style::full) const;
+    void print(std::ostream &out, print_style style = print_style::full) const;
     T evaluate(const std::map<std::string, T> &variables) const;
-    expression differentiate(const std::string &var) const;
+    // Производная по переменной; по умолчанию результат упрощается simplify()
+    expression differentiate(const std::string &var, bool simplified = true) const;
+    // Ленивая производная: возвращается лёгкий узел со ссылкой на исходное
+    // выражение и переменную, дерево производной не строится. evaluate
+    // разворачивает производную по узлам: правило каждого узла применяется
+    // при первом вычислении и запоминается, без упрощения. Нужные переменные
+    // и ошибки вычисления те же, что у differentiate(var, false), значение --
+    // как у differentiate(var, simplified) с точностью до округления. Печать,
+    // упрощение, компиляция и любые другие операции один раз строят дерево
+    // differentiate(var, simplified) и дальше работают с ним.
+    expression differentiate_lazy(const std::string &var, bool simplified = true) const;
+    // Все частные производные за один обход: результат i -- производная по
+    // vars[i]. Общие подвыражения производных строятся один раз; для больших
+    // выражений группы переменных распределяются по потокам (threads == 0 --
+    // общий пул по числу ядер). Нельзя вызывать из задачи общего пула.
+    std::vector<expression> differentiate_all(const std::vector<std::string> &vars, bool simplified = true,
+                                              std::size_t threads = 0) const;
     expression substitute(const std::string &var, const expression &value) const;
+    // Свёртка констант, удаление нейтральных элементов, сбор подобных членов
+    expression simplify() const;
+
+    // Компиляция дерева в плоскую ленту инструкций
+    compiled_expression<T> compile() const;
+    // Компиляция с выдачей слотов переменных из общей таблицы символов
+    compiled_expression<T> bind(symbol_table &symbols) const;
+    // C++ код скомпилированного выражения (см. compiled_expression::emit_cpp)
+    std::string emit_cpp(const std::string &name) const;
+
+    // Двоичный файл выражения: таблица общих узлов, имена и пул констант
+    // (формат -- binary_header в compiled.hpp). Загрузка не разбирает текст:
+    // записи читаются из отображённого через mmap файла и сразу становятся узлами.
+    void save(const std::string &path) const;
+    static expression load(const std::string &path);
+
+    // Размер выражения (дерево против общих узлов) и число живых уникальных узлов
+    expression_metrics metrics() const;
+    static std::size_t interned_nodes();
+    // Самые дорогие поддеревья (не больше top) по убыванию доли в стоимости
+    // вычисления; первым идёт всё выражение
+    std::vector<subtree_cost> cost_breakdown(std::size_t top = 10) const;
 
     expression operator+(const expression &other) const;
     expression operator-(const expression &other) const;
@@ -51,8 +114,12 @@ public:
     static expression make_unary(const std::string &op, const expression &operand);
 
 private:
+    friend class expression_arena<T>;
+    friend struct lazy_derivative_node<T>;
     // Конструктор от указателя на узел (используется внутри реализации)
     expression(std::shared_ptr<node_base> node);
+    // Корень для обхода: ленивая производная разворачивается в дерево
+    const std::shared_ptr<node_base>& tree() const;
     std::shared_ptr<node_base> root_;
 };
 
@@ -63,71 +130,79 @@ private:
 // Узел константы
 template<typename T>
 struct constant_node : public expression<T>::node_base {
-    T value;
+    const T value;
     constant_node(T val);
     T evaluate(const std::map<std::string, T>&) const override;
     std::string to_string() const override;
     std::shared_ptr<typename expression<T>::node_base> differentiate(const std::string &) const override;
     std::shared_ptr<typename expression<T>::node_base> substitute(const std::string &, const std::shared_ptr<typename expression<T>::node_base>&) const override;
-    std::shared_ptr<typename expression<T>::node_base> clone() const override;
+    op_code kind() const override;
 };
 
 // Узел переменной
 template<typename T>
 struct variable_node : public expression<T>::node_base {
-    std::string name;
+    const std::string name;
     variable_node(const std::string &n);
     T evaluate(const std::map<std::string, T>& vars) const override;
     std::string to_string() const override;
     std::shared_ptr<typename expression<T>::node_base> differentiate(const std::string &var) const override;
     std::shared_ptr<typename expression<T>::node_base> substitute(const std::string &var, const std::shared_ptr<typename expression<T>::node_base>& val) const override;
-    std::shared_ptr<typename expression<T>::node_base> clone() const override;
+    op_code kind() const override;
 };
 
 // Узел бинарной операции
 template<typename T>
 struct binary_op_node : public expression<T>::node_base {
-    std::string op;
-    std::shared_ptr<typename expression<T>::node_base> left;
-    std::shared_ptr<typename expression<T>::node_base> right;
+    const std::string op;
+    const op_code code;
+    const std::shared_ptr<typename expression<T>::node_base> left;
+    const std::shared_ptr<typename expression<T>::node_base> right;
     binary_op_node(const std::string &o, std::shared_ptr<typename expression<T>::node_base> l, std::shared_ptr<typename expression<T>::node_base> r);
+    ~binary_op_node() override;
     T evaluate(const std::map<std::string, T>& vars) const override;
     std::string to_string() const override;
     std::shared_ptr<typename expression<T>::node_base> differentiate(const std::string &var) const override;
     std::shared_ptr<typename expression<T>::node_base> substitute(const std::string &var, const std::shared_ptr<typename expression<T>::node_base>& val) const override;
-    std::shared_ptr<typename expression<T>::node_base> clone() const override;
+    op_code kind() const override;
 };
 
 // Узел унарной операции
 template<typename T>
 struct unary_op_node : public expression<T>::node_base {
-    std::string op;
-    std::shared_ptr<typename expression<T>::node_base> child;
+    const std::string op;
+    const op_code code;
+    const std::shared_ptr<typename expression<T>::node_base> child;
     unary_op_node(const std::string &o, std::shared_ptr<typename expression<T>::node_base> c);
+    ~unary_op_node() override;
     T evaluate(const std::map<std::string, T>& vars) const override;
     std::string to_string() const override;
     std::shared_ptr<typename expression<T>::node_base> differentiate(const std::string &var) const override;
     std::shared_ptr<typename expression<T>::node_base> substitute(const std::string &var, const std::shared_ptr<typename expression<T>::node_base>& val) const override;
-    std::shared_ptr<typename expression<T>::node_base> clone() const override;
+    op_code kind() const override;
 };
 
 // ============================================================================
 // Объявление шаблонного класса парсера выражений
 // ============================================================================
 
+// Разбор за линейное время без рекурсии. Парсер не копирует строку:
+// она должна жить, пока выполняется parse(), поэтому временный
+// std::string не принимается.
 template<typename T>
 class ExpressionParserT {
 public:
+    ExpressionParserT(std::string_view s);
+    ExpressionParserT(const char *s);
     ExpressionParserT(const std::string &s);
+    ExpressionParserT(std::string &&) = delete;
     expression<T> parse();
 private:
-    std::string str;
+    std::string_view str;
     size_t pos;
     void skipWhitespace();
-    expression<T> parsePrimary();
-    expression<T> parseFactor();
-    expression<T> parseTerm();
-    expression<T> parseExpression();
+    std::string_view scan(int (*accept)(int));
+    expression<T> parseNumber(bool negative = false);
 };
 
 #endif // HEAD_HPP
@@ -0,0 +1,128 @@
+#include <algorithm>
+#include <complex>
+#include <stdexcept>
+#include <vector>
+#include "head.hpp"
+
+// Множества переменных инструкций считаются одним проходом по ленте
+// (битовые маски по слотам), затем обращаются в списки по слотам
+template<typename T>
+incremental_evaluator<T>::incremental_evaluator(const compiled_expression<T> &program)
+    : program_(program), slots_(program.slot_count()), bound_(program.slot_count(), false),
+      regs_(program.size()), begin_(program.slot_count() + 1, 0), pending_(program.slot_count(), false),
+      dirty_(program.size(), 0) {
+    const auto &code = program_.code();
+    const std::size_t words = (program_.slot_count() + 63) / 64;
+    std::vector<std::uint64_t> deps(code.size() * words, 0);
+    for (std::size_t i = 0; i < code.size(); ++i) {
+        const auto &c = code[i];
+        std::uint64_t *mask = deps.data() + i * words;
+        auto merge = [&](std::uint32_t reg) {
+            const std::uint64_t *operand = deps.data() + reg * words;
+            for (std::size_t w = 0; w < words; ++w) mask[w] |= operand[w];
+        };
+        if (c.op == op_code::constant) continue;
+        if (c.op == op_code::variable) {
+            mask[c.a / 64] |= std::uint64_t(1) << (c.a % 64);
+            continue;
+        }
+        merge(c.a);
+        if (is_binary(c.op) || c.op == op_code::fma) merge(c.b);
+        if (c.op == op_code::fma) merge(c.c);
+    }
+    auto depends = [&](std::size_t i, std::size_t s) { return (deps[i * words + s / 64] >> (s % 64)) & 1; };
+    for (std::size_t s = 0; s < program_.slot_count(); ++s) {
+        begin_[s] = dependents_.size();
+        for (std::size_t i = 0; i < code.size(); ++i)
+            if (depends(i, s)) dependents_.push_back(static_cast<std::uint32_t>(i));
+    }
+    begin_[program_.slot_count()] = dependents_.size();
+}
+
+template<typename T>
+incremental_evaluator<T>::incremental_evaluator(const expression<T> &expr, const std::map<std::string, T> &bindings)
+    : incremental_evaluator(expr.compile()) {
+    for (const auto &[name, value] : bindings) set(name, value);
+}
+
+template<typename T>
+void incremental_evaluator<T>::set(const std::string &var, T value) {
+    const auto &names = program_.variables();
+    for (std::size_t i = 0; i < names.size(); ++i)
+        if (names[i] == var) set_slot(program_.slots()[i], value);
+}
+
+template<typename T>
+void incremental_evaluator<T>::set_slot(std::uint32_t slot, T value) {
+    if (slot >= slots_.size()) throw std::out_of_range("Slot " + std::to_string(slot) + " out of range");
+    // Сравнение по значению: NaN всегда считается изменением
+    if (bound_[slot] && slots_[slot] == value) return;
+    slots_[slot] = value;
+    bound_[slot] = true;
+    if (computed_ && !pending_[slot]) {
+        pending_[slot] = true;
+        changed_.push_back(slot);
+    }
+}
+
+// Инструкция считается общим шагом ленты (как в evaluate)
+template<typename T>
+void incremental_evaluator<T>::compute(std::size_t i) {
+    const auto &c = program_.code()[i];
+    if (c.op == op_code::constant) regs_[i] = program_.constants()[c.a];
+    else if (c.op == op_code::variable) regs_[i] = slots_[c.a];
+    else regs_[i] = tape_step(c.op, c.a, c.b, c.c, regs_.data());
+}
+
+// Одна изменённая переменная -- проход по её списку. При нескольких списки
+// пересекаются (общий путь к корню), поэтому устаревание распространяется
+// флагами за один проход по ленте от первой зависящей инструкции.
+template<typename T>
+T incremental_evaluator<T>::value() {
+    const std::size_t n = program_.size();
+    if (!computed_) {
+        for (std::size_t i = 0; i < program_.variables().size(); ++i)
+            if (!bound_[program_.slots()[i]])
+                throw std::runtime_error("Variable " + program_.variables()[i] + " not found");
+        for (std::size_t i = 0; i < n; ++i) compute(i);
+        computed_ = true;
+        recomputed_ = n;
+        return regs_[n - 1];
+    }
+    recomputed_ = 0;
+    if (changed_.size() == 1) {
+        const std::uint32_t s = changed_[0];
+        for (std::size_t k = begin_[s]; k < begin_[s + 1]; ++k) compute(dependents_[k]);
+        recomputed_ = begin_[s + 1] - begin_[s];
+    } else if (!changed_.empty()) {
+        std::size_t first = n;
+        for (std::uint32_t s : changed_)
+            if (begin_[s] != begin_[s + 1]) first = std::min<std::size_t>(first, dependents_[begin_[s]]);
+        const auto &code = program_.code();
+        try {
+            for (std::size_t i = first; i < n; ++i) {
+                const auto &c = code[i];
+                bool stale = false;
+                if (c.op == op_code::variable) stale = pending_[c.a];
+                else if (c.op != op_code::constant) {
+                    stale = dirty_[c.a] || ((is_binary(c.op) || c.op == op_code::fma) && dirty_[c.b]) ||
+                            (c.op == op_code::fma && dirty_[c.c]);
+                }
+                if (!stale) continue;
+                compute(i);
+                dirty_[i] = 1;
+                ++recomputed_;
+            }
+        } catch (...) {
+            std::fill(dirty_.begin() + first, dirty_.end(), 0);
+            throw;
+        }
+        std::fill(dirty_.begin() + first, dirty_.end(), 0);
+    }
+    for (std::uint32_t s : changed_) pending_[s] = false;
+    changed_.clear();
+    return regs_[n - 1];
+}
+
+template class incremental_evaluator<double>;
+template class incremental_evaluator<std::complex<double>>;
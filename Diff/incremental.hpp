@@ -0,0 +1,60 @@
+#ifndef INCREMENTAL_HPP
+#define INCREMENTAL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "compiled.hpp"
+
+// ============================================================================
+// Инкрементальное вычисление для циклов, где между вызовами меняются одна-две
+// переменные. Значение каждой инструкции ленты хранится между вызовами, для
+// каждой переменной заранее построен список зависящих от неё инструкций (в
+// порядке ленты). set() только запоминает новое значение; value() пересчитывает
+// инструкции из списков изменённых переменных -- путь от листьев до корня --
+// и берёт остальные значения из кэша. Памяти нужно O(инструкций x переменных)
+// в худшем случае. Выигрыш есть, пока меняется малая доля переменных: когда
+// пересчитывается большая часть ленты, compiled_expression::evaluate быстрее.
+// ============================================================================
+template<typename T>
+class incremental_evaluator {
+public:
+    explicit incremental_evaluator(const compiled_expression<T> &program);
+    // Лента строится expr.compile(), bindings -- начальные значения переменных
+    incremental_evaluator(const expression<T> &expr, const std::map<std::string, T> &bindings = {});
+
+    // Новое значение переменной; имена, от которых выражение не зависит,
+    // пропускаются. Совпадающее значение не делает инструкции устаревшими.
+    void set(const std::string &var, T value);
+    // То же по слоту ленты (program().slots())
+    void set_slot(std::uint32_t slot, T value);
+    // Значение выражения; первый вызов вычисляет всю ленту. Если какой-то
+    // переменной не задано значение -- исключение. После исключения в
+    // вычислении (деление на ноль, ln) изменения остаются ожидающими.
+    T value();
+
+    // Число инструкций, пересчитанных последним вызовом value()
+    std::size_t last_recomputed() const { return recomputed_; }
+    const compiled_expression<T>& program() const { return program_; }
+
+private:
+    void compute(std::size_t i);
+
+    compiled_expression<T> program_;
+    std::vector<T> slots_;
+    std::vector<bool> bound_;
+    std::vector<T> regs_;
+    // Инструкции, зависящие от слота s: dependents_[begin_[s]..begin_[s + 1])
+    std::vector<std::uint32_t> dependents_;
+    std::vector<std::size_t> begin_;
+    std::vector<std::uint32_t> changed_;
+    std::vector<bool> pending_;
+    std::vector<std::uint8_t> dirty_;
+    std::size_t recomputed_ = 0;
+    bool computed_ = false;
+};
+
+#endif // INCREMENTAL_HPP
@@ -0,0 +1,198 @@
+#include <chrono>
+#include <complex>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include "head.hpp"
+
+namespace {
+
+// Первое непустое значение: явный параметр, переменная окружения, умолчание
+std::string setting(const std::string &value, const char *env, const char *fallback) {
+    if (!value.empty()) return value;
+    const char *from_env = std::getenv(env);
+    return from_env && *from_env ? from_env : fallback;
+}
+
+// Код возврата сгенерированной функции -> исключение интерпретатора
+void check_status(int status) {
+    if (status == 1) {
+        std::cout << "Dilinie na nol";
+        throw std::runtime_error("Dilinie na nol");
+    }
+    if (status == 2) {
+        std::cout << "Durak, nuthno bolshe nula";
+        throw std::runtime_error("Durak, nuthno bolshe nula");
+    }
+}
+
+bool file_exists(const std::string &path) {
+    struct stat info;
+    return ::lstat(path.c_str(), &info) == 0;
+}
+
+// Каталог кэша по умолчанию -- личный для пользователя: в общем каталоге
+// другой пользователь мог бы подложить библиотеку, которую загрузит dlopen
+std::string default_cache_dir() {
+    const char *xdg = std::getenv("XDG_CACHE_HOME");
+    if (xdg && *xdg == '/') return std::string(xdg) + "/differ-jit";
+    const char *home = std::getenv("HOME");
+    if (home && *home == '/') return std::string(home) + "/.cache/differ-jit";
+    return "/tmp/differ-jit-" + std::to_string(::geteuid());
+}
+
+// Файл или каталог принадлежит текущему пользователю и недоступен другим на запись
+bool owned_private(const struct stat &info) {
+    return info.st_uid == ::geteuid() && (info.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
+
+// Каталог кэша создаётся с правами 0700; существующий проверяется
+bool prepare_cache_dir(const std::string &dir) {
+    const std::size_t slash = dir.find_last_of('/');
+    if (slash != std::string::npos && slash > 0) ::mkdir(dir.substr(0, slash).c_str(), 0700);
+    ::mkdir(dir.c_str(), 0700);
+    struct stat info;
+    return ::lstat(dir.c_str(), &info) == 0 && S_ISDIR(info.st_mode) && owned_private(info);
+}
+
+// Загружается только обычный файл текущего пользователя без записи для других
+bool trusted_library(const std::string &path) {
+    struct stat info;
+    return ::lstat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode) && owned_private(info);
+}
+
+// Строка в одинарных кавычках для командной строки оболочки
+std::string shell_quote(const std::string &text) {
+    std::string result = "'";
+    for (char c : text) {
+        if (c == '\'') result += "'\\''";
+        else result += c;
+    }
+    return result + "'";
+}
+
+// Каждое слово строки (компилятор с оболочкой вроде ccache, набор флагов) --
+// отдельный аргумент в кавычках
+std::string shell_words(const std::string &text) {
+    std::istringstream in(text);
+    std::string word, result;
+    while (in >> word) {
+        if (!result.empty()) result += ' ';
+        result += shell_quote(word);
+    }
+    return result;
+}
+
+// Процессор, под который собирает -march=native: архитектура, модель и
+// расширения первого ядра. Входит в ключ кэша, чтобы каталог, общий для
+// разных машин, не отдавал библиотеку с чужими инструкциями.
+const std::string& cpu_signature() {
+    static const std::string signature = [] {
+        std::string result;
+        struct utsname name;
+        if (::uname(&name) == 0) result = name.machine;
+        std::ifstream in("/proc/cpuinfo");
+        std::string line;
+        while (std::getline(in, line) && !line.empty()) {
+            for (const char *field : {"vendor_id", "model name", "flags", "Features", "CPU implementer", "CPU part"})
+                if (line.rfind(field, 0) == 0) result += '\n' + line;
+        }
+        return result;
+    }();
+    return signature;
+}
+
+} // namespace
+
+template<typename T>
+T jit_kernel<T>::evaluate(const T *slots) const {
+    if (!scalar_) return program_.evaluate(slots);
+    T result;
+    check_status(scalar_(slots, &result));
+    return result;
+}
+
+template<typename T>
+void jit_kernel<T>::evaluate_batch(const T *const *columns, T *out, std::size_t count) const {
+    if (!batch_) return program_.evaluate_batch(columns, out, count);
+    check_status(batch_(columns, out, count));
+}
+
+template<typename T>
+jit_kernel<T> jit_compile(const compiled_expression<T> &program, const jit_options &options) {
+    auto start = std::chrono::steady_clock::now();
+    jit_kernel<T> kernel;
+    kernel.program_ = program;
+    // Время записывается и при откате на интерпретатор
+    auto finish = [&]() {
+        kernel.compile_ms_ = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return kernel;
+    };
+
+    const std::string compiler = setting(options.compiler, "CXX", "c++");
+    const std::string cache_dir = setting(options.cache_dir, "DIFFER_JIT_CACHE", default_cache_dir().c_str());
+    // Имя функции фиксировано, чтобы одинаковые выражения давали одинаковый код
+    const std::string source = program.emit_cpp("differ_kernel");
+    std::ostringstream key;
+    key << std::hex
+        << std::hash<std::string>()(compiler + '\n' + options.flags + '\n' + cpu_signature() + '\n' + source);
+    const std::string base = cache_dir + "/k" + key.str();
+    kernel.library_ = base + ".so";
+
+    if (!prepare_cache_dir(cache_dir)) return finish();
+    kernel.cached_ = file_exists(kernel.library_);
+    if (!kernel.cached_) {
+        // Временные имена уникальны для процесса; готовая библиотека
+        // появляется атомарным rename, чтобы параллельные сборки не мешали друг другу
+        const std::string unique = base + "." + std::to_string(::getpid());
+        {
+            std::ofstream out(unique + ".cpp");
+            out << source;
+            if (!out) return finish();
+        }
+        const std::string command = shell_words(compiler) + " -std=c++17 " + shell_words(options.flags) +
+                                    " -shared -fPIC -o " + shell_quote(unique + ".so") + " " +
+                                    shell_quote(unique + ".cpp") + " > /dev/null 2>&1";
+        const int status = std::system(command.c_str());
+        std::remove((unique + ".cpp").c_str());
+        if (status != 0 || std::rename((unique + ".so").c_str(), kernel.library_.c_str()) != 0) {
+            std::remove((unique + ".so").c_str());
+            return finish();
+        }
+    }
+
+    if (!trusted_library(kernel.library_)) return finish();
+    void *handle = ::dlopen(kernel.library_.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!handle) return finish();
+    kernel.handle_ = std::shared_ptr<void>(handle, [](void *h) { ::dlclose(h); });
+    kernel.scalar_ = reinterpret_cast<typename jit_kernel<T>::scalar_fn>(::dlsym(handle, "differ_kernel"));
+    kernel.batch_ = reinterpret_cast<typename jit_kernel<T>::batch_fn>(::dlsym(handle, "differ_kernel_batch"));
+    if (!kernel.scalar_ || !kernel.batch_) {
+        kernel.scalar_ = nullptr;
+        kernel.batch_ = nullptr;
+        kernel.handle_.reset();
+    }
+    return finish();
+}
+
+template<typename T>
+jit_kernel<T> jit_compile(const expression<T> &expr, const jit_options &options) {
+    return jit_compile(expr.compile(), options);
+}
+
+// --- Явные инстанциации ---
+template class jit_kernel<double>;
+template class jit_kernel<std::complex<double>>;
+template jit_kernel<double> jit_compile(const compiled_expression<double>&, const jit_options&);
+template jit_kernel<std::complex<double>> jit_compile(const compiled_expression<std::complex<double>>&, const jit_options&);
+template jit_kernel<double> jit_compile(const expression<double>&, const jit_options&);
+template jit_kernel<std::complex<double>> jit_compile(const expression<std::complex<double>>&, const jit_options&);
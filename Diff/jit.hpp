@@ -0,0 +1,66 @@
+#ifndef JIT_HPP
+#define JIT_HPP
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+#include "compiled.hpp"
+
+// Параметры нативной компиляции. Пустые поля берутся из окружения:
+// компилятор -- $CXX или c++, каталог кэша -- $DIFFER_JIT_CACHE или личный
+// каталог пользователя ($XDG_CACHE_HOME/differ-jit, ~/.cache/differ-jit).
+// Каталог кэша и библиотеки в нём должны принадлежать текущему пользователю
+// и быть закрыты на запись для остальных, иначе ядро работает через интерпретатор.
+struct jit_options {
+    std::string compiler;
+    std::string cache_dir;
+    std::string flags = "-O2 -march=native";
+};
+
+// ============================================================================
+// Нативное ядро выражения: код из emit_cpp() собирается системным
+// компилятором в разделяемую библиотеку и загружается через dlopen.
+// Библиотеки кэшируются на диске по хешу сгенерированного кода, поэтому
+// повторная компиляция того же выражения сводится к dlopen. Если компилятор
+// недоступен, ядро прозрачно работает через интерпретатор ленты.
+// ============================================================================
+template<typename T>
+class jit_kernel {
+public:
+    // Семантика совпадает с compiled_expression (включая исключения)
+    T evaluate(const T *slots) const;
+    void evaluate_batch(const T *const *columns, T *out, std::size_t count) const;
+
+    // true -- загружен нативный код, false -- работает интерпретатор
+    bool native() const { return scalar_ != nullptr; }
+    // Библиотека взята из дискового кэша без вызова компилятора
+    bool cached() const { return cached_; }
+    // Время сборки и загрузки в миллисекундах
+    double compile_ms() const { return compile_ms_; }
+    const std::string& library() const { return library_; }
+    const compiled_expression<T>& program() const { return program_; }
+
+private:
+    template<typename U>
+    friend jit_kernel<U> jit_compile(const compiled_expression<U>&, const jit_options&);
+
+    using scalar_fn = int (*)(const T*, T*);
+    using batch_fn = int (*)(const T* const*, T*, std::size_t);
+
+    compiled_expression<T> program_;
+    std::shared_ptr<void> handle_;
+    scalar_fn scalar_ = nullptr;
+    batch_fn batch_ = nullptr;
+    bool cached_ = false;
+    double compile_ms_ = 0;
+    std::string library_;
+};
+
+// Сборка нативного ядра (только для double и complex<double>)
+template<typename T>
+jit_kernel<T> jit_compile(const compiled_expression<T> &program, const jit_options &options = jit_options());
+template<typename T>
+jit_kernel<T> jit_compile(const expression<T> &expr, const jit_options &options = jit_options());
+
+#endif // JIT_HPP
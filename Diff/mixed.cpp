@@ -0,0 +1,127 @@
+#include <cmath>
+#include <complex>
+#include <iostream>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+#include "head.hpp"
+
+namespace {
+
+using complex = std::complex<double>;
+
+// Ошибка области определения из общего шага ленты печатается в std::cout,
+// как её печатает compiled_expression::evaluate
+void report_domain_error(const std::runtime_error &error) {
+    const std::string_view what = error.what();
+    if (what == "Dilinie na nol" || what == "Durak, nuthno bolshe nula") std::cout << what;
+}
+
+} // namespace
+
+// Вывод типов -- один проход по ленте: операнды всегда стоят раньше
+mixed_program::mixed_program(const compiled_expression<complex> &program, const std::vector<bool> &real_slots)
+    : program_(program) {
+    const auto &code = program.code();
+    const auto &constants = program.constants();
+    code_.reserve(code.size());
+    auto is_real = [&](std::uint32_t reg) { return (code_[reg].flags & real_result) != 0; };
+    for (const auto &c : code) {
+        step s{c.op, 0, c.a, c.b, c.c, 0.0};
+        bool real = false;
+        switch (c.op) {
+        case op_code::constant:
+            real = constants[c.a].imag() == 0.0;
+            s.constant = constants[c.a].real();
+            break;
+        case op_code::variable:
+            real = c.a < real_slots.size() && real_slots[c.a];
+            break;
+        case op_code::add:
+        case op_code::sub:
+        case op_code::mul:
+        case op_code::div:
+            real = is_real(c.a) && is_real(c.b);
+            break;
+        case op_code::pow: {
+            // Вещественная степень вещественного основания может выйти на
+            // комплексную ось, поэтому показатель должен быть целой константой,
+            // а основание иначе -- положительной константой
+            if (!is_real(c.a) || !is_real(c.b)) break;
+            const step &base = code_[c.a], &power = code_[c.b];
+            real = (power.op == op_code::constant && power.constant == std::trunc(power.constant)) ||
+                   (base.op == op_code::constant && base.constant > 0.0);
+            break;
+        }
+        case op_code::sin:
+        case op_code::cos:
+        case op_code::exp:
+        case op_code::powi:
+            real = is_real(c.a);
+            break;
+        case op_code::fma:
+            real = is_real(c.a) && is_real(c.b) && is_real(c.c);
+            break;
+        default:
+            break;
+        }
+        if (real) {
+            s.flags |= real_result;
+            ++real_count_;
+        }
+        if (c.op != op_code::constant && c.op != op_code::variable) {
+            if (is_real(c.a)) s.flags |= real_a;
+            if ((is_binary(c.op) || c.op == op_code::fma) && is_real(c.b)) s.flags |= real_b;
+            if (c.op == op_code::fma && is_real(c.c)) s.flags |= real_c;
+        }
+        code_.push_back(s);
+    }
+}
+
+// Вещественные и комплексные регистры лежат в двух массивах, индекс --
+// номер инструкции. Вещественный операнд комплексной инструкции
+// переводится в complex<double> при чтении; сама инструкция -- общий шаг
+// ленты, как у compiled_expression::evaluate; ошибки тоже печатаются так же.
+complex mixed_program::evaluate(const complex *slots) const {
+    try {
+        return run(slots);
+    } catch (const std::runtime_error &error) {
+        report_domain_error(error);
+        throw;
+    }
+}
+
+complex mixed_program::run(const complex *slots) const {
+    const std::size_t n = code_.size();
+    thread_local std::vector<double> real_regs;
+    thread_local std::vector<complex> complex_regs;
+    if (real_regs.size() < n) real_regs.resize(n);
+    if (complex_regs.size() < n) complex_regs.resize(n);
+    double *rr = real_regs.data();
+    complex *cr = complex_regs.data();
+    const complex *pool = program_.constants().data();
+
+    for (std::size_t i = 0; i < n; ++i) {
+        const step &s = code_[i];
+        if (s.op == op_code::constant) {
+            if (s.flags & real_result) rr[i] = s.constant;
+            else cr[i] = pool[s.a];
+            continue;
+        }
+        if (s.op == op_code::variable) {
+            if (s.flags & real_result) rr[i] = slots[s.a].real();
+            else cr[i] = slots[s.a];
+            continue;
+        }
+        if (s.flags & real_result) {
+            rr[i] = tape_step(s.op, s.a, s.b, s.c, rr);
+            continue;
+        }
+        const complex a = s.flags & real_a ? complex(rr[s.a]) : cr[s.a];
+        complex b, c;
+        if (is_binary(s.op) || s.op == op_code::fma) b = s.flags & real_b ? complex(rr[s.b]) : cr[s.b];
+        if (s.op == op_code::fma) c = s.flags & real_c ? complex(rr[s.c]) : cr[s.c];
+        cr[i] = tape_apply(s.op, a, b, c, static_cast<std::int32_t>(s.b));
+    }
+    return code_[n - 1].flags & real_result ? complex(rr[n - 1]) : cr[n - 1];
+}
@@ -0,0 +1,61 @@
+#ifndef MIXED_HPP
+#define MIXED_HPP
+
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "compiled.hpp"
+
+// ============================================================================
+// Смешанное вычисление комплексного выражения. Вывод типов по ленте помечает
+// каждую инструкцию как вещественную или комплексную: вещественные
+// подвыражения считаются в double и переводятся в complex<double> только
+// там, где встречаются с комплексными значениями. Результат совпадает с
+// compiled_expression<complex<double>> с точностью до округления, ошибки
+// области определения -- и по исключению, и по печати в std::cout.
+//
+// Инструкция вещественна, если вещественны её операнды и результат не может
+// выйти за ось: константы с нулевой мнимой частью, переменные вещественных
+// слотов, + - * /, sin, cos, exp, целая степень (и степень положительной
+// константы). ln и дробная степень переменного основания -- всегда комплексные.
+// ============================================================================
+class mixed_program {
+public:
+    // real_slots[s] -- переменная слота s принимает только вещественные значения
+    // (мнимая часть её значения при вычислении не читается)
+    mixed_program(const compiled_expression<std::complex<double>> &program, const std::vector<bool> &real_slots);
+
+    std::complex<double> evaluate(const std::complex<double> *slots) const;
+
+    std::size_t real_instructions() const { return real_count_; }
+    std::size_t size() const { return code_.size(); }
+    const compiled_expression<std::complex<double>>& program() const { return program_; }
+
+private:
+    // Флаги: результат и операнды a, b, c вещественные
+    enum : std::uint8_t {
+        real_result = 1,
+        real_a = 2,
+        real_b = 4,
+        real_c = 8
+    };
+
+    struct step {
+        op_code op;
+        std::uint8_t flags;
+        std::uint32_t a;
+        std::uint32_t b;
+        std::uint32_t c;
+        double constant;
+    };
+
+    std::complex<double> run(const std::complex<double> *slots) const;
+
+    compiled_expression<std::complex<double>> program_;
+    std::vector<step> code_;
+    std::size_t real_count_ = 0;
+};
+
+#endif // MIXED_HPP
@@ -0,0 +1,148 @@
+#include <algorithm>
+#include <complex>
+#include "head.hpp"
+
+thread_pool::thread_pool(std::size_t threads) {
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    for (std::size_t i = 0; i < threads; ++i) queues_.push_back(std::make_unique<queue>());
+    for (std::size_t i = 1; i < threads; ++i) threads_.emplace_back(&thread_pool::loop, this, i);
+}
+
+thread_pool::~thread_pool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto &thread : threads_) thread.join();
+}
+
+thread_pool& thread_pool::shared() {
+    static thread_pool pool;
+    return pool;
+}
+
+void thread_pool::run(std::size_t tasks, const job &task) {
+    if (tasks == 0) return;
+    std::lock_guard<std::mutex> serial(run_mutex_);
+    // Задача публикуется до раздачи индексов: поток, забравший индекс,
+    // всегда видит задачу текущего запуска
+    error_ = nullptr;
+    remaining_.store(tasks);
+    job_.store(&task);
+    const std::size_t n = queues_.size();
+    for (std::size_t w = 0; w < n; ++w) {
+        std::lock_guard<std::mutex> lock(queues_[w]->mutex);
+        // Соседние порции -- одному потоку, чтобы он шёл по памяти подряд
+        for (std::size_t i = tasks * w / n; i < tasks * (w + 1) / n; ++i)
+            queues_[w]->tasks.push_back(i);
+    }
+    if (n > 1) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++generation_;
+        }
+        wake_.notify_all();
+    }
+    drain(0);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [&]() { return remaining_.load() == 0; });
+    job_.store(nullptr);
+    if (error_) std::rethrow_exception(error_);
+}
+
+bool thread_pool::pop(std::size_t worker, std::size_t &task) {
+    {
+        queue &own = *queues_[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = own.tasks.front();
+            own.tasks.pop_front();
+            return true;
+        }
+    }
+    const std::size_t n = queues_.size();
+    for (std::size_t k = 1; k < n; ++k) {
+        queue &victim = *queues_[(worker + k) % n];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = victim.tasks.back();
+            victim.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+void thread_pool::drain(std::size_t worker) {
+    std::size_t task;
+    while (pop(worker, task)) {
+        try {
+            (*job_.load())(task, worker);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!error_) error_ = std::current_exception();
+        }
+        if (remaining_.fetch_sub(1) == 1) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            done_.notify_all();
+        }
+    }
+}
+
+void thread_pool::loop(std::size_t worker) {
+    std::size_t seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [&]() { return stop_ || generation_ != seen; });
+            if (stop_) return;
+            seen = generation_;
+        }
+        drain(worker);
+    }
+}
+
+template<typename T>
+void parallel_evaluate(const compiled_expression<T> &program, const T *const *columns, T *out,
+                       std::size_t count, thread_pool &pool) {
+    // Порция кратна внутренней порции evaluate_batch; на поток приходится
+    // несколько порций, чтобы было что перехватывать при неравной нагрузке
+    const std::size_t unit = 256;
+    const std::size_t target = count / (pool.size() * 8) + 1;
+    const std::size_t chunk = std::max<std::size_t>(16 * unit, (target + unit - 1) / unit * unit);
+    const std::size_t tasks = (count + chunk - 1) / chunk;
+    const std::size_t slots = program.slot_count();
+    pool.run(tasks, [&](std::size_t task, std::size_t) {
+        const std::size_t start = task * chunk;
+        const std::size_t len = std::min(chunk, count - start);
+        // Указатели на порции столбцов -- на стеке потока
+        std::vector<const T*> shifted(slots);
+        for (std::size_t s = 0; s < slots; ++s) shifted[s] = columns[s] ? columns[s] + start : nullptr;
+        program.evaluate_batch(shifted.data(), out + start, len);
+    });
+}
+
+template<typename T>
+void parallel_evaluate(const expression<T> &expr, const T *const *columns, T *out,
+                       std::size_t count, std::size_t threads) {
+    auto program = expr.compile();
+    if (threads == 0) {
+        parallel_evaluate(program, columns, out, count, thread_pool::shared());
+    } else {
+        thread_pool pool(threads);
+        parallel_evaluate(program, columns, out, count, pool);
+    }
+}
+
+// --- Явные инстанциации ---
+template void parallel_evaluate(const compiled_expression<double>&, const double *const*, double*,
+                                std::size_t, thread_pool&);
+template void parallel_evaluate(const compiled_expression<std::complex<double>>&,
+                                const std::complex<double> *const*, std::complex<double>*,
+                                std::size_t, thread_pool&);
+template void parallel_evaluate(const expression<double>&, const double *const*, double*,
+                                std::size_t, std::size_t);
+template void parallel_evaluate(const expression<std::complex<double>>&, const std::complex<double> *const*,
+                                std::complex<double>*, std::size_t, std::size_t);
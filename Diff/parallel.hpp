@@ -0,0 +1,80 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "compiled.hpp"
+
+// ============================================================================
+// Пул потоков с перехватом работы (work stealing). У каждого потока своя
+// очередь подряд идущих задач: владелец берёт их с начала, освободившиеся
+// потоки крадут с конца чужих очередей. Вызывающий поток участвует в работе как поток 0,
+// поэтому пул из одного потока выполняет всё на месте без синхронизации.
+// ============================================================================
+class thread_pool {
+public:
+    // threads == 0 -- по числу ядер
+    explicit thread_pool(std::size_t threads = 0);
+    ~thread_pool();
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    std::size_t size() const { return queues_.size(); }
+
+    // Выполняет task(index, worker) для index из [0, tasks) и ждёт завершения.
+    // worker -- номер потока (< size()) для доступа к его личным данным.
+    // Первое исключение задачи пробрасывается вызывающему после завершения остальных.
+    void run(std::size_t tasks, const std::function<void(std::size_t, std::size_t)> &task);
+
+    // Общий пул по числу ядер
+    static thread_pool& shared();
+
+private:
+    using job = std::function<void(std::size_t, std::size_t)>;
+
+    struct queue {
+        std::mutex mutex;
+        std::deque<std::size_t> tasks;
+    };
+
+    bool pop(std::size_t worker, std::size_t &task);
+    void drain(std::size_t worker);
+    void loop(std::size_t worker);
+
+    std::vector<std::unique_ptr<queue>> queues_;
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::mutex run_mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    std::atomic<const job*> job_{nullptr};
+    std::atomic<std::size_t> remaining_{0};
+    std::size_t generation_ = 0;
+    bool stop_ = false;
+    std::exception_ptr error_;
+};
+
+// Пакетное вычисление, разделённое по строкам между потоками пула. Каждая
+// порция строк считается compiled_expression::evaluate_batch с личными
+// регистрами потока; общие данные только читаются.
+template<typename T>
+void parallel_evaluate(const compiled_expression<T> &program, const T *const *columns, T *out,
+                       std::size_t count, thread_pool &pool = thread_pool::shared());
+
+// То же для дерева: выражение компилируется один раз, столбцы передаются
+// по слотам expr.compile() (в порядке первого появления переменных).
+// threads == 0 -- общий пул по числу ядер
+template<typename T>
+void parallel_evaluate(const expression<T> &expr, const T *const *columns, T *out,
+                       std::size_t count, std::size_t threads = 0);
+
+#endif // PARALLEL_HPP
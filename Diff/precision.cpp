@@ -0,0 +1,118 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+#include "head.hpp"
+
+mixed_precision_program::mixed_precision_program(const compiled_expression<double> &program, float cancellation)
+    : program_(program), cancellation_(cancellation) {
+    code_.reserve(program.size());
+    for (const auto &c : program.code()) {
+        const float constant = c.op == op_code::constant ? static_cast<float>(program.constants()[c.a]) : 0.0f;
+        code_.push_back({c.op, c.a, c.b, c.c, constant});
+    }
+}
+
+// Порция всегда имеет полную длину chunk: циклы с постоянным числом
+// итераций векторизуются компилятором. Строки за концом входа заполняются
+// единицами, их флаги и результаты не читаются. Инструкции считаются общим
+// шагом ленты без проверок области определения (их делает пересчёт в
+// double), после него отмечаются строки с большим числом обусловленности.
+std::size_t mixed_precision_program::evaluate_batch(const double *const *columns, double *out,
+                                                    std::size_t count) const {
+    DIFFER_TIMER(evaluate);
+    const std::size_t n = code_.size();
+    thread_local std::vector<float> regs;
+    thread_local std::vector<const float*> lanes;
+    thread_local std::vector<double> slots;
+    if (regs.size() < n * chunk) regs.resize(n * chunk);
+    lanes.resize(n);
+    slots.resize(program_.slot_count());
+    std::uint8_t suspect[chunk];
+    const float ratio = cancellation_;
+
+    for (std::size_t i = 0; i < n; ++i) {
+        lanes[i] = regs.data() + i * chunk;
+        if (code_[i].op == op_code::constant) std::fill_n(regs.data() + i * chunk, chunk, code_[i].constant);
+    }
+
+    std::size_t rechecked = 0;
+    for (std::size_t start = 0; start < count; start += chunk) {
+        const std::size_t len = std::min(chunk, count - start);
+        std::fill_n(suspect, chunk, 0);
+        for (std::size_t i = 0; i < n; ++i) {
+            const step &s = code_[i];
+            if (s.op == op_code::constant) continue;
+            float *r = regs.data() + i * chunk;
+            if (s.op == op_code::variable) {
+                const double *column = columns[s.a] + start;
+                for (std::size_t k = 0; k < len; ++k) r[k] = static_cast<float>(column[k]);
+                std::fill(r + len, r + chunk, 1.0f);
+                continue;
+            }
+            tape_step_lanes(s.op, s.a, s.b, s.c, lanes.data(), r, chunk, false);
+            // У powi поле b -- показатель, а не регистр
+            const float *x = lanes[s.a];
+            const float *y = lanes[is_binary(s.op) || s.op == op_code::fma ? s.b : s.a];
+            // Число обусловленности больше 1 / ratio: относительная ошибка
+            // операндов (порядка точности float) усиливается больше допустимого
+            switch (s.op) {
+            case op_code::add:
+            case op_code::sub:
+                for (std::size_t k = 0; k < chunk; ++k)
+                    suspect[k] |= std::fabs(r[k]) < ratio * std::max(std::fabs(x[k]), std::fabs(y[k]));
+                break;
+            case op_code::fma: {
+                const float *z = lanes[s.c];
+                for (std::size_t k = 0; k < chunk; ++k)
+                    suspect[k] |= std::fabs(r[k]) < ratio * std::max(std::fabs(x[k] * y[k]), std::fabs(z[k]));
+                break;
+            }
+            case op_code::div:
+                for (std::size_t k = 0; k < chunk; ++k) suspect[k] |= std::fabs(y[k]) < FLT_MIN;
+                break;
+            case op_code::sin:
+            case op_code::cos:
+                // Ошибка аргумента |x| * eps переходит в результат без
+                // ослабления: при |x| > 1 / ratio -- всегда, у корней -- тоже
+                for (std::size_t k = 0; k < chunk; ++k) suspect[k] |= std::fabs(r[k]) < ratio * std::fabs(x[k]);
+                break;
+            case op_code::exp:
+                for (std::size_t k = 0; k < chunk; ++k) suspect[k] |= ratio * std::fabs(x[k]) > 1.0f;
+                break;
+            case op_code::ln:
+                for (std::size_t k = 0; k < chunk; ++k)
+                    suspect[k] |= !(x[k] >= FLT_MIN) || std::fabs(r[k]) < ratio;
+                break;
+            case op_code::pow:
+                // x^y = exp(y ln x): числа обусловленности |y| и |y ln x| = |ln |x^y||
+                for (std::size_t k = 0; k < chunk; ++k)
+                    suspect[k] |= ratio * std::max(std::fabs(y[k]), std::fabs(std::log(std::fabs(r[k])))) > 1.0f;
+                break;
+            case op_code::powi:
+                if (ratio * std::fabs(static_cast<float>(static_cast<std::int32_t>(s.b))) > 1.0f)
+                    std::fill_n(suspect, chunk, 1);
+                break;
+            default:
+                break;
+            }
+            // Переполнение, NaN и потеря точности в денормализованных числах
+            for (std::size_t k = 0; k < chunk; ++k) {
+                const float m = std::fabs(r[k]);
+                suspect[k] |= !(m <= FLT_MAX) || (m < FLT_MIN && m != 0.0f);
+            }
+        }
+
+        const float *result = regs.data() + (n - 1) * chunk;
+        for (std::size_t k = 0; k < len; ++k) {
+            if (!suspect[k]) {
+                out[start + k] = result[k];
+                continue;
+            }
+            for (std::uint32_t slot : program_.slots()) slots[slot] = columns[slot][start + k];
+            out[start + k] = program_.evaluate(slots.data());
+            ++rechecked;
+        }
+    }
+    return rechecked;
+}
@@ -0,0 +1,58 @@
+#ifndef PRECISION_HPP
+#define PRECISION_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "compiled.hpp"
+
+// ============================================================================
+// Пакетное вычисление со смешанной точностью: лента double считается в float
+// порциями по chunk строк (вдвое больше элементов на SIMD-регистр, вдвое
+// меньше памяти), а строки, где float мог потерять точность, пересчитываются
+// в double. Строка считается подозрительной, если у какой-то инструкции
+// число обусловленности больше 1 / cancellation, то есть относительная
+// ошибка операндов (порядка точности float) усиливается больше чем в
+// 1 / cancellation раз:
+//   + - и fma: |результат| < cancellation * max(|слагаемых|);
+//   sin, cos: |результат| < cancellation * |x| -- всегда при |x| больше
+//   1 / cancellation (16 по умолчанию) и около корней;
+//   exp: |x| > 1 / cancellation; ln: |ln x| < cancellation;
+//   x^y: |y| или |y ln x| больше 1 / cancellation, powi -- показатель;
+//   делитель или аргумент ln близок к нулю или не положителен;
+//   результат инструкции бесконечен, NaN или денормализован.
+// Тогда каждая инструкция остальных строк вносит относительную ошибку
+// порядка точности float / cancellation (около 1e-6 при cancellation = 1/16),
+// по ленте эти ошибки складываются.
+// Ошибки области определения (деление на ноль, ln) проверяются при пересчёте
+// в double и бросают исключение так же, как compiled_expression::evaluate.
+// ============================================================================
+class mixed_precision_program {
+public:
+    explicit mixed_precision_program(const compiled_expression<double> &program, float cancellation = 1.0f / 16);
+
+    // columns[slot] -- count значений переменной слота (как у evaluate_batch),
+    // возвращает число строк, пересчитанных в double
+    std::size_t evaluate_batch(const double *const *columns, double *out, std::size_t count) const;
+
+    const compiled_expression<double>& program() const { return program_; }
+    std::size_t size() const { return code_.size(); }
+
+    static constexpr std::size_t chunk = 256;
+
+private:
+    struct step {
+        op_code op;
+        std::uint32_t a;
+        std::uint32_t b;
+        std::uint32_t c;
+        float constant;
+    };
+
+    compiled_expression<double> program_;
+    std::vector<step> code_;
+    float cancellation_;
+};
+
+#endif // PRECISION_HPP
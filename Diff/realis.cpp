@@ -8,22 +8,127 @@
 #include <string>
 #include <memory>
 #include <type_traits>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <mutex>
+#include <functional>
+#include <array>
+#include <charconv>
+#include <limits>
+#include <cstdio>
+#include <string_view>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define DIFFER_X86_SIMD 1
+#endif
+
+#include "compiled.hpp"
+#include "dual.hpp"
+#include "arena.hpp"
+#include "parallel.hpp"
+#include "stats.hpp"
+
+// --- Математические функции с поиском по ADL ---
+// Вызовы через using std::... позволяют использовать пользовательские числовые
+// типы (например, dual<T>), для которых функции определены в их пространстве имён
+template<typename U> U math_sin(const U &x) { using std::sin; return sin(x); }
+template<typename U> U math_cos(const U &x) { using std::cos; return cos(x); }
+template<typename U> U math_log(const U &x) { using std::log; return log(x); }
+template<typename U> U math_exp(const U &x) { using std::exp; return exp(x); }
+template<typename U> U math_pow(const U &x, const U &y) { using std::pow; return pow(x, y); }
+
+// Целая степень возведением в квадрат и умножением; one -- единица типа U
+// (вложенный dual<dual<...>> не строится из целого числа напрямую)
+template<typename U>
+U math_powi(U x, std::int32_t n, const U &one = U(1)) {
+    std::uint32_t m = n < 0 ? 0u - static_cast<std::uint32_t>(n) : static_cast<std::uint32_t>(n);
+    U result = one;
+    for(; m; m >>= 1) {
+        if(m & 1) result *= x;
+        if(m > 1) x *= x;
+    }
+    return n < 0 ? one / result : result;
+}
+
+// a * b + c; для вещественных типов -- одной инструкцией, если она есть в процессоре
+template<typename U>
+U multiply_add(const U &a, const U &b, const U &c) {
+#ifdef FP_FAST_FMA
+    if constexpr (std::is_floating_point<U>::value) return std::fma(a, b, c);
+#endif
+    return a * b + c;
+}
+
+// Вещественный тип чисел в записи выражения: литерал разбирается в нём,
+// чтобы для float и long double не терять и не выдумывать точность
+template<typename U>
+struct literal_type {
+    using type = U;
+};
+
+template<typename U>
+struct literal_type<std::complex<U>> {
+    using type = U;
+};
+
+template<typename U>
+struct literal_type<dual<U>> {
+    using type = typename literal_type<U>::type;
+};
+
+// --- Проверки области определения ---
+// Делитель считается нулевым по значению; для dual -- по вещественной части
+template<typename U>
+bool zero_divisor(const U &value) {
+    return value == U(0);
+}
+
+template<typename U>
+bool zero_divisor(const dual<U> &value) {
+    return zero_divisor(value.value);
+}
+
+// ln определён только для положительных вещественных аргументов
+template<typename U>
+bool ln_domain_error(const U &value) {
+    if constexpr (std::is_floating_point<U>::value)
+        return value <= U(0);
+    else
+        return false;
+}
+
+template<typename U>
+bool ln_domain_error(const dual<U> &value) {
+    return ln_domain_error(value.value);
+}
 
 // --- Forward declaration шаблонного класса expression ---
 template<typename T>
 class expression;
+template<typename T>
+struct lazy_derivative_node;
 
 // --- Объявление шаблонного класса expression ---
 template<typename T>
 class expression {
 public:
-    struct node_base {
+    // Узлы неизменяемы и уникальны (hash-consing): одинаковые поддеревья
+    // представлены одним общим узлом, поэтому clone() не копирует дерево
+    struct node_base : std::enable_shared_from_this<node_base> {
         virtual T evaluate(const std::map<std::string, T>&) const = 0;
         virtual std::string to_string() const = 0;
         virtual std::shared_ptr<node_base> differentiate(const std::string&) const = 0;
         virtual std::shared_ptr<node_base> substitute(const std::string&, const std::shared_ptr<node_base>&) const = 0;
-        virtual std::shared_ptr<node_base> clone() const = 0;
-        virtual ~node_base() {}
+        virtual std::shared_ptr<node_base> clone() const;
+        virtual op_code kind() const = 0;
+        virtual ~node_base();
     };
 
     expression(T value);
@@ -34,10 +139,26 @@ public:
     expression& operator=(expression &&other) noexcept;
     ~expression();
 
-    std::string to_string() const;
+    std::string to_string(print_style style = print_style::full) const;
+    void print(std::string &buffer, print_style style = print_style::full) const;
+    void print(std::ostream &out, print_style style = print_style::full) const;
     T evaluate(const std::map<std::string, T> &variables) const;
-    expression differentiate(const std::string &var) const;
+    expression differentiate(const std::string &var, bool simplified = true) const;
+    expression differentiate_lazy(const std::string &var, bool simplified = true) const;
+    std::vector<expression> differentiate_all(const std::vector<std::string> &vars, bool simplified = true,
+                                              std::size_t threads = 0) const;
     expression substitute(const std::string &var, const expression &value) const;
+    expression simplify() const;
+
+    compiled_expression<T> compile() const;
+    compiled_expression<T> bind(symbol_table &symbols) const;
+    std::string emit_cpp(const std::string &name) const;
+    void save(const std::string &path) const;
+    static expression load(const std::string &path);
+
+    expression_metrics metrics() const;
+    static std::size_t interned_nodes();
+    std::vector<subtree_cost> cost_breakdown(std::size_t top = 10) const;
 
     expression operator+(const expression &other) const;
     expression operator-(const expression &other) const;
@@ -50,37 +171,125 @@ public:
     // Конструктор от указателя на узел
     expression(std::shared_ptr<node_base> node);
 private:
+    friend class expression_arena<T>;
+    friend struct lazy_derivative_node<T>;
+    const std::shared_ptr<node_base>& tree() const;
     std::shared_ptr<node_base> root_;
 };
 
+// --- Фабрики уникальных узлов (определены после узлов) ---
+template<typename T>
+std::shared_ptr<typename expression<T>::node_base> make_constant(T value);
+template<typename T>
+std::shared_ptr<typename expression<T>::node_base> make_variable(const std::string &name);
+template<typename T>
+std::shared_ptr<typename expression<T>::node_base> make_unary_node(const std::string &op,
+                                                                   std::shared_ptr<typename expression<T>::node_base> child);
+template<typename T>
+std::shared_ptr<typename expression<T>::node_base> make_binary_node(const std::string &op,
+                                                                    std::shared_ptr<typename expression<T>::node_base> left,
+                                                                    std::shared_ptr<typename expression<T>::node_base> right);
+
+// --- Кэш производных общих узлов ---
+// На время одного вызова expression::differentiate производная каждого
+// уникального узла строится один раз, повторные ссылки получают готовый узел.
+template<typename T>
+struct derivative_cache {
+    using node_ptr = std::shared_ptr<typename expression<T>::node_base>;
+    using map_type = std::unordered_map<const typename expression<T>::node_base*, node_ptr>;
+    static inline thread_local map_type *active = nullptr;
+};
+
+template<typename T>
+std::shared_ptr<typename expression<T>::node_base> derivative_of(const std::shared_ptr<typename expression<T>::node_base> &node,
+                                                                 const std::string &var) {
+    auto *cache = derivative_cache<T>::active;
+    if(!cache) return node->differentiate(var);
+    auto it = cache->find(node.get());
+    if(it != cache->end()) return it->second;
+    auto result = node->differentiate(var);
+    cache->emplace(node.get(), result);
+    return result;
+}
+
+// --- Освобождение узлов без рекурсии ---
+// Узел отдаёт потомков, которыми владеет единолично, в очередь потока, а
+// самый внешний деструктор node_base освобождает их в цикле. Так глубина
+// стека не зависит от глубины выражения (длинные суммы, вложенные скобки).
+template<typename T>
+struct release_queue {
+    std::vector<std::shared_ptr<typename expression<T>::node_base>> pending;
+    bool draining = false;
+
+    ~release_queue() { finished() = true; }
+    // После завершения потока узлы освобождаются обычной рекурсией
+    static bool& finished() {
+        static thread_local bool value = false;
+        return value;
+    }
+    static release_queue* instance() {
+        if(finished()) return nullptr;
+        static thread_local release_queue queue;
+        return &queue;
+    }
+};
+
+template<typename T>
+void defer_release(const std::shared_ptr<typename expression<T>::node_base> &node) {
+    if(node.use_count() != 1) return;
+    if(auto *queue = release_queue<T>::instance()) queue->pending.push_back(node);
+}
+
+// Определение одно на программу, поэтому счётчик clones видит вызовы из
+// всех единиц трансляции
+template<typename T>
+std::shared_ptr<typename expression<T>::node_base> expression<T>::node_base::clone() const {
+    DIFFER_COUNT(clones);
+    return std::const_pointer_cast<node_base>(this->shared_from_this());
+}
+
+template<typename T>
+expression<T>::node_base::~node_base() {
+    auto *queue = release_queue<T>::instance();
+    if(!queue || queue->draining) return;
+    queue->draining = true;
+    while(!queue->pending.empty()) {
+        auto node = std::move(queue->pending.back());
+        queue->pending.pop_back();
+    }
+    queue->draining = false;
+}
+
 // --- Реализация узла constant_node ---
 template<typename T>
 struct constant_node : public expression<T>::node_base {
-    T value;
+    const T value;
     constant_node(T val) : value(val) {}
-    T evaluate(const std::map<std::string, T>&) const override { return value; }
+    T evaluate(const std::map<std::string, T>&) const override {
+        DIFFER_VISIT(op_code::constant, 1);
+        return value;
+    }
     std::string to_string() const override {
         std::ostringstream oss;
         oss << value;
         return oss.str();
     }
     std::shared_ptr<typename expression<T>::node_base> differentiate(const std::string &) const override {
-        return std::make_shared<constant_node<T>>(T(0));
+        return make_constant<T>(T(0));
     }
     std::shared_ptr<typename expression<T>::node_base> substitute(const std::string &, const std::shared_ptr<typename expression<T>::node_base>&) const override {
-        return clone();
-    }
-    std::shared_ptr<typename expression<T>::node_base> clone() const override {
-        return std::make_shared<constant_node<T>>(value);
+        return this->clone();
     }
+    op_code kind() const override { return op_code::constant; }
 };
 
 // --- Реализация узла variable_node ---
 template<typename T>
 struct variable_node : public expression<T>::node_base {
-    std::string name;
+    const std::string name;
     variable_node(const std::string &n) : name(n) {}
     T evaluate(const std::map<std::string, T>& vars) const override {
+        DIFFER_VISIT(op_code::variable, 1);
         auto it = vars.find(name);
         if(it == vars.end()) throw std::runtime_error("Variable " + name + " not found");
         return it->second;
@@ -89,15 +298,13 @@ struct variable_node : public expression<T>::node_base {
         return name;
     }
     std::shared_ptr<typename expression<T>::node_base> differentiate(const std::string &var) const override {
-        return std::make_shared<constant_node<T>>(name == var ? T(1) : T(0));
+        return make_constant<T>(name == var ? T(1) : T(0));
     }
     std::shared_ptr<typename expression<T>::node_base> substitute(const std::string &var, const std::shared_ptr<typename expression<T>::node_base>& val) const override {
-        if(name == var) return val->clone();
-        return clone();
-    }
-    std::shared_ptr<typename expression<T>::node_base> clone() const override {
-        return std::make_shared<variable_node<T>>(name);
+        if(name == var) return val;
+        return this->clone();
     }
+    op_code kind() const override { return op_code::variable; }
 };
 
 // --- Предварительное объявление binary_op_node ---
@@ -107,118 +314,150 @@ struct binary_op_node;
 // --- Реализация узла unary_op_node ---
 template<typename T>
 struct unary_op_node : public expression<T>::node_base {
-    std::string op;
-    std::shared_ptr<typename expression<T>::node_base> child;
+    const std::string op;
+    const op_code code;
+    const std::shared_ptr<typename expression<T>::node_base> child;
     unary_op_node(const std::string &o, std::shared_ptr<typename expression<T>::node_base> c)
-        : op(o), child(c) {}
+        : op(o), code(unary_op_code(o)), child(c) {}
+    ~unary_op_node() override { defer_release<T>(child); }
     T evaluate(const std::map<std::string, T>& vars) const override {
         T val = child->evaluate(vars);
-        if(op == "sin") return std::sin(val);
-        if(op == "cos") return std::cos(val);
+        DIFFER_VISIT(code, 1);
+        if(op == "sin") return math_sin(val);
+        if(op == "cos") return math_cos(val);
         if(op == "ln") {
             // Для вещественных типов проверяем, что аргумент больше нуля.
-            if constexpr (std::is_floating_point<T>::value) {
-                if(val <= T(0)) {
-                    std::cout << "Durak, nuthno bolshe nula";
-                    throw std::runtime_error("Durak, nuthno bolshe nula");
-                }
+            if(ln_domain_error(val)) {
+                std::cout << "Durak, nuthno bolshe nula";
+                throw std::runtime_error("Durak, nuthno bolshe nula");
             }
-            return std::log(val);
+            return math_log(val);
         }
-        if(op == "exp") return std::exp(val);
+        if(op == "exp") return math_exp(val);
         throw std::runtime_error("Unknown function " + op);
     }
     std::string to_string() const override {
-        return op + "(" + child->to_string() + ")";
+        return expression<T>(this->clone()).to_string();
     }
     std::shared_ptr<typename expression<T>::node_base> differentiate(const std::string &var) const override {
         if(op == "sin") {
-            auto deriv = child->differentiate(var);
-            return std::make_shared<binary_op_node<T>>("*", std::make_shared<unary_op_node<T>>("cos", child->clone()), deriv);
+            auto deriv = derivative_of<T>(child, var);
+            return make_binary_node<T>("*", make_unary_node<T>("cos", child), deriv);
         }
         if(op == "cos") {
-            auto deriv = child->differentiate(var);
-            auto sin_node = std::make_shared<unary_op_node<T>>("sin", child->clone());
-            auto neg_sin = std::make_shared<binary_op_node<T>>("*", std::make_shared<constant_node<T>>(T(-1)), sin_node);
-            return std::make_shared<binary_op_node<T>>("*", neg_sin, deriv);
+            auto deriv = derivative_of<T>(child, var);
+            auto sin_node = make_unary_node<T>("sin", child);
+            auto neg_sin = make_binary_node<T>("*", make_constant<T>(T(-1)), sin_node);
+            return make_binary_node<T>("*", neg_sin, deriv);
         }
         if(op == "ln") {
-            auto deriv = child->differentiate(var);
-            return std::make_shared<binary_op_node<T>>("/", deriv, child->clone());
+            auto deriv = derivative_of<T>(child, var);
+            return make_binary_node<T>("/", deriv, child);
         }
         if(op == "exp") {
-            auto deriv = child->differentiate(var);
-            return std::make_shared<binary_op_node<T>>("*", clone(), deriv);
+            auto deriv = derivative_of<T>(child, var);
+            return make_binary_node<T>("*", this->clone(), deriv);
         }
         throw std::runtime_error("Differentiation not implemented for function " + op);
     }
     std::shared_ptr<typename expression<T>::node_base> substitute(const std::string &var,
                                         const std::shared_ptr<typename expression<T>::node_base>& val) const override {
         auto new_child = child->substitute(var, val);
-        return std::make_shared<unary_op_node<T>>(op, new_child);
-    }
-    std::shared_ptr<typename expression<T>::node_base> clone() const override {
-        return std::make_shared<unary_op_node<T>>(op, child->clone());
+        if(new_child == child) return this->clone();
+        return make_unary_node<T>(op, new_child);
     }
+    op_code kind() const override { return code; }
 };
 
 // --- Реализация узла binary_op_node ---
 template<typename T>
 struct binary_op_node : public expression<T>::node_base {
-    std::string op;
-    std::shared_ptr<typename expression<T>::node_base> left;
-    std::shared_ptr<typename expression<T>::node_base> right;
+    const std::string op;
+    const op_code code;
+    const std::shared_ptr<typename expression<T>::node_base> left;
+    const std::shared_ptr<typename expression<T>::node_base> right;
     binary_op_node(const std::string &o,
                    std::shared_ptr<typename expression<T>::node_base> l,
                    std::shared_ptr<typename expression<T>::node_base> r)
-        : op(o), left(l), right(r) {}
+        : op(o), code(binary_op_code(o)), left(l), right(r) {}
+    ~binary_op_node() override {
+        defer_release<T>(left);
+        defer_release<T>(right);
+    }
     T evaluate(const std::map<std::string, T>& vars) const override {
         T l_val = left->evaluate(vars);
         T r_val = right->evaluate(vars);
+        DIFFER_VISIT(code, 1);
         if(op == "+") return l_val + r_val;
         if(op == "-") return l_val - r_val;
         if(op == "*") return l_val * r_val;
         if(op == "/") {
-            if(r_val == T(0)) {
+            if(zero_divisor(r_val)) {
                 std::cout << "Dilinie na nol";
                 throw std::runtime_error("Dilinie na nol");
             }
             return l_val / r_val;
         }
-        if(op == "^") return std::pow(l_val, r_val);
+        if(op == "^") return math_pow(l_val, r_val);
         throw std::runtime_error("Unknown operator " + op);
     }
     std::string to_string() const override {
-        return "(" + left->to_string() + " " + op + " " + right->to_string() + ")";
+        return expression<T>(this->clone()).to_string();
     }
     std::shared_ptr<typename expression<T>::node_base> differentiate(const std::string &var) const override {
         if(op == "+")
-            return std::make_shared<binary_op_node<T>>("+", left->differentiate(var), right->differentiate(var));
+            return make_binary_node<T>("+", derivative_of<T>(left, var), derivative_of<T>(right, var));
         if(op == "-")
-            return std::make_shared<binary_op_node<T>>("-", left->differentiate(var), right->differentiate(var));
+            return make_binary_node<T>("-", derivative_of<T>(left, var), derivative_of<T>(right, var));
+        // Член с производной независимого операнда (тождественный ноль) не
+        // строится: иначе 0 * ln(u) оставался бы в производной как ошибка
+        auto is_zero = [](const std::shared_ptr<typename expression<T>::node_base> &node) {
+            return node->kind() == op_code::constant &&
+                   static_cast<const constant_node<T>*>(node.get())->value == T(0);
+        };
         if(op == "*") {
-            auto left_diff = std::make_shared<binary_op_node<T>>("*", left->differentiate(var), right->clone());
-            auto right_diff = std::make_shared<binary_op_node<T>>("*", left->clone(), right->differentiate(var));
-            return std::make_shared<binary_op_node<T>>("+", left_diff, right_diff);
+            auto left_deriv = derivative_of<T>(left, var);
+            auto right_deriv = derivative_of<T>(right, var);
+            auto left_diff = make_binary_node<T>("*", left_deriv, right);
+            auto right_diff = make_binary_node<T>("*", left, right_deriv);
+            if(is_zero(right_deriv)) return left_diff;
+            if(is_zero(left_deriv)) return right_diff;
+            return make_binary_node<T>("+", left_diff, right_diff);
         }
         if(op == "/") {
-            auto num_left = std::make_shared<binary_op_node<T>>("*", left->differentiate(var), right->clone());
-            auto num_right = std::make_shared<binary_op_node<T>>("*", left->clone(), right->differentiate(var));
-            auto numerator = std::make_shared<binary_op_node<T>>("-", num_left, num_right);
-            auto denominator = std::make_shared<binary_op_node<T>>("^", right->clone(), std::make_shared<constant_node<T>>(T(2)));
-            return std::make_shared<binary_op_node<T>>("/", numerator, denominator);
+            auto left_deriv = derivative_of<T>(left, var);
+            auto right_deriv = derivative_of<T>(right, var);
+            if(is_zero(right_deriv)) return make_binary_node<T>("/", left_deriv, right);
+            auto num_left = make_binary_node<T>("*", left_deriv, right);
+            auto num_right = make_binary_node<T>("*", left, right_deriv);
+            auto numerator = is_zero(left_deriv) ? make_binary_node<T>("*", make_constant<T>(T(-1)), num_right)
+                                                 : make_binary_node<T>("-", num_left, num_right);
+            auto denominator = make_binary_node<T>("^", right, make_constant<T>(T(2)));
+            return make_binary_node<T>("/", numerator, denominator);
         }
         if(op == "^") {
             auto u = left;
             auto v = right;
-            auto u_diff = left->differentiate(var);
-            auto v_diff = right->differentiate(var);
-            auto ln_u = std::make_shared<unary_op_node<T>>("ln", u->clone());
-            auto term1 = std::make_shared<binary_op_node<T>>("*", v_diff, ln_u);
-            auto term2 = std::make_shared<binary_op_node<T>>("/", std::make_shared<binary_op_node<T>>("*", v->clone(), u_diff), u->clone());
-            auto sum_terms = std::make_shared<binary_op_node<T>>("+", term1, term2);
-            auto u_pow_v = clone();
-            return std::make_shared<binary_op_node<T>>("*", u_pow_v, sum_terms);
+            if(v->kind() == op_code::constant) {
+                // Степенная функция: (u^c)' = c * u^(c-1) * u'
+                T c = static_cast<const constant_node<T>*>(v.get())->value;
+                auto u_pow = make_binary_node<T>("^", u, make_constant<T>(c - T(1)));
+                return make_binary_node<T>("*", make_binary_node<T>("*", v, u_pow), derivative_of<T>(u, var));
+            }
+            auto u_diff = derivative_of<T>(left, var);
+            auto v_diff = derivative_of<T>(right, var);
+            auto u_pow_v = this->clone();
+            if(is_zero(v_diff)) {
+                // Показатель не зависит от var: (u^v)' = v * u^(v-1) * u', без ln(u)
+                auto u_pow = make_binary_node<T>("^", u, make_binary_node<T>("-", v, make_constant<T>(T(1))));
+                return make_binary_node<T>("*", make_binary_node<T>("*", v, u_pow), u_diff);
+            }
+            auto ln_u = make_unary_node<T>("ln", u);
+            auto term1 = make_binary_node<T>("*", v_diff, ln_u);
+            if(is_zero(u_diff)) return make_binary_node<T>("*", u_pow_v, term1);
+            auto term2 = make_binary_node<T>("/", make_binary_node<T>("*", v, u_diff), u);
+            auto sum_terms = make_binary_node<T>("+", term1, term2);
+            return make_binary_node<T>("*", u_pow_v, sum_terms);
         }
         throw std::runtime_error("Differentiation not implemented for operator " + op);
     }
@@ -226,25 +465,284 @@ struct binary_op_node : public expression<T>::node_base {
                                         const std::shared_ptr<typename expression<T>::node_base>& val) const override {
         auto new_left = left->substitute(var, val);
         auto new_right = right->substitute(var, val);
-        return std::make_shared<binary_op_node<T>>(op, new_left, new_right);
+        if(new_left == left && new_right == right) return this->clone();
+        return make_binary_node<T>(op, new_left, new_right);
+    }
+    op_code kind() const override { return code; }
+};
+
+// --- Таблица уникальных узлов (hash-consing) ---
+// Сравнение констант различает +0 и -0, иначе pow(-0, -1) и pow(0, -1) совпали бы
+template<typename U>
+bool same_value(const U &a, const U &b) {
+    return a == b && std::signbit(a) == std::signbit(b);
+}
+
+template<typename U>
+bool same_value(const std::complex<U> &a, const std::complex<U> &b) {
+    return same_value(a.real(), b.real()) && same_value(a.imag(), b.imag());
+}
+
+template<typename U>
+bool same_value(const dual<U> &a, const dual<U> &b) {
+    return same_value(a.value, b.value) && same_value(a.derivative, b.derivative);
+}
+
+template<typename U>
+std::size_t value_hash(const U &a) {
+    return std::hash<U>()(a);
+}
+
+template<typename U>
+std::size_t value_hash(const std::complex<U> &a) {
+    return value_hash(a.real()) * 31 + value_hash(a.imag());
+}
+
+template<typename U>
+std::size_t value_hash(const dual<U> &a) {
+    return value_hash(a.value) * 31 + value_hash(a.derivative);
+}
+
+// Ключ узла: код операции, имя (операции или переменной), значение константы
+// и адреса уже уникальных потомков
+template<typename T>
+struct node_key {
+    op_code op;
+    std::string text;
+    T value;
+    const void *left;
+    const void *right;
+
+    bool operator==(const node_key &other) const {
+        return op == other.op && left == other.left && right == other.right &&
+               text == other.text && same_value(value, other.value);
+    }
+};
+
+template<typename T>
+struct node_key_hash {
+    std::size_t operator()(const node_key<T> &key) const {
+        std::size_t h = static_cast<std::size_t>(key.op);
+        h = h * 31 + std::hash<std::string>()(key.text);
+        h = h * 31 + value_hash(key.value);
+        h = h * 31 + std::hash<const void*>()(key.left);
+        h = h * 31 + std::hash<const void*>()(key.right);
+        return h;
+    }
+};
+
+// Таблица хранит слабые ссылки: узел живёт, пока на него ссылается хотя бы
+// одно выражение. Устаревшие записи вычищаются, когда таблица вырастает вдвое.
+template<typename T>
+class node_table {
+public:
+    using node_ptr = std::shared_ptr<typename expression<T>::node_base>;
+
+    static node_table& instance() {
+        // Таблица не разрушается при выходе, чтобы глобальные выражения
+        // могли пережить её
+        static node_table *table = new node_table;
+        return *table;
+    }
+
+    template<typename Make>
+    node_ptr intern(node_key<T> key, Make make) {
+        shard &part = shard_of(key);
+        std::lock_guard<std::mutex> lock(part.mutex);
+        auto it = part.nodes.find(key);
+        if(it != part.nodes.end()) {
+            if(node_ptr node = it->second.lock()) {
+                DIFFER_COUNT(node_reuses);
+                return node;
+            }
+        }
+        DIFFER_COUNT(node_allocations);
+        node_ptr node = make();
+        part.nodes[std::move(key)] = node;
+        if(part.nodes.size() > part.sweep_at) part.sweep();
+        return node;
+    }
+
+    std::size_t live() {
+        std::size_t total = 0;
+        for(shard &part : shards_) {
+            std::lock_guard<std::mutex> lock(part.mutex);
+            part.sweep();
+            total += part.nodes.size();
+        }
+        return total;
+    }
+
+private:
+    // Таблица разбита на независимые части со своими блокировками, чтобы
+    // потоки, строящие узлы одновременно, реже ждали друг друга
+    struct shard {
+        std::mutex mutex;
+        std::unordered_map<node_key<T>, std::weak_ptr<typename expression<T>::node_base>, node_key_hash<T>> nodes;
+        std::size_t sweep_at = 1024;
+
+        void sweep() {
+            for(auto it = nodes.begin(); it != nodes.end();) {
+                if(it->second.expired()) it = nodes.erase(it);
+                else ++it;
+            }
+            sweep_at = std::max<std::size_t>(1024, nodes.size() * 2);
+        }
+    };
+
+    static constexpr std::size_t shard_count = 16;
+
+    shard& shard_of(const node_key<T> &key) {
+        // Старшие биты перемешанного хеша не совпадают с номером корзины внутри части
+        const std::uint64_t h = node_key_hash<T>()(key) * 0x9E3779B97F4A7C15ull;
+        return shards_[h >> 60];
+    }
+
+    std::array<shard, shard_count> shards_;
+};
+
+template<typename T>
+std::shared_ptr<typename expression<T>::node_base> make_constant(T value) {
+    return node_table<T>::instance().intern({op_code::constant, std::string(), value, nullptr, nullptr}, [&]() {
+        return std::make_shared<constant_node<T>>(value);
+    });
+}
+
+template<typename T>
+std::shared_ptr<typename expression<T>::node_base> make_variable(const std::string &name) {
+    return node_table<T>::instance().intern({op_code::variable, name, T(), nullptr, nullptr}, [&]() {
+        return std::make_shared<variable_node<T>>(name);
+    });
+}
+
+template<typename T>
+std::shared_ptr<typename expression<T>::node_base> make_unary_node(const std::string &op,
+                                                                   std::shared_ptr<typename expression<T>::node_base> child) {
+    return node_table<T>::instance().intern({unary_op_code(op), op, T(), child.get(), nullptr}, [&]() {
+        return std::make_shared<unary_op_node<T>>(op, child);
+    });
+}
+
+template<typename T>
+std::shared_ptr<typename expression<T>::node_base> make_binary_node(const std::string &op,
+                                                                    std::shared_ptr<typename expression<T>::node_base> left,
+                                                                    std::shared_ptr<typename expression<T>::node_base> right) {
+    return node_table<T>::instance().intern({binary_op_code(op), op, T(), left.get(), right.get()}, [&]() {
+        return std::make_shared<binary_op_node<T>>(op, left, right);
+    });
+}
+
+// --- Ленивая производная ---
+template<typename T>
+void seed_independent(const typename expression<T>::node_base *root, const std::string &var,
+                      typename derivative_cache<T>::map_type &cache);
+
+// Узел -- производная исходного узла source по var. Правило source
+// применяется один раз, при первом вычислении; производные зависящих от var
+// потомков в нём -- снова ленивые узлы, независимым (как в differentiate)
+// заранее сопоставлен ноль. Поэтому вычисление проходит те же узлы, что и
+// differentiate(var, false): нужны те же переменные, бросают те же
+// операции. Ленивые узлы одной производной общие для общих исходных узлов.
+// Корень выражения разворачивается expression::tree() перед любым обходом,
+// кроме вычисления, во внутренние узлы обход не попадает.
+template<typename T>
+struct lazy_derivative_node : public expression<T>::node_base {
+    using node_ptr = std::shared_ptr<typename expression<T>::node_base>;
+    const node_ptr source;
+    const std::string var;
+    const bool simplified;
+
+    lazy_derivative_node(node_ptr s, const std::string &v, bool simp)
+        : source(std::move(s)), var(v), simplified(simp), owner_(std::make_shared<context>()), context_(owner_.get()) {}
+    ~lazy_derivative_node() override { defer_release<T>(rule_); }
+
+    T evaluate(const std::map<std::string, T>& vars) const override { return rule()->evaluate(vars); }
+    std::string to_string() const override { return expanded()->to_string(); }
+    node_ptr differentiate(const std::string &v) const override { return expanded()->differentiate(v); }
+    node_ptr substitute(const std::string &v, const node_ptr &val) const override {
+        return expanded()->substitute(v, val);
+    }
+    // Правила видят в узле ненулевую производную и не разворачивают его
+    op_code kind() const override { return op_code::unknown; }
+
+    const node_ptr& expanded() const {
+        std::call_once(tree_once_, [&]() {
+            tree_ = expression<T>(source).differentiate(var, simplified).tree();
+        });
+        return tree_;
     }
-    std::shared_ptr<typename expression<T>::node_base> clone() const override {
-        return std::make_shared<binary_op_node<T>>(op, left->clone(), right->clone());
+
+private:
+    // Производные исходных узлов: ноль для независимых, ленивые узлы
+    // для остальных (по мере разворачивания)
+    struct context {
+        std::mutex mutex;
+        bool seeded = false;
+        typename derivative_cache<T>::map_type derivatives;
+    };
+
+    lazy_derivative_node(node_ptr s, const std::string &v, context *c)
+        : source(std::move(s)), var(v), simplified(false), context_(c) {}
+
+    // Правило source, в котором производные потомков берутся из context
+    const node_ptr& rule() const {
+        std::call_once(rule_once_, [&]() {
+            std::lock_guard<std::mutex> lock(context_->mutex);
+            auto &derivatives = context_->derivatives;
+            if(!context_->seeded) {
+                seed_independent<T>(source.get(), var, derivatives);
+                context_->seeded = true;
+            }
+            auto it = derivatives.find(source.get());
+            if(it != derivatives.end() && it->second.get() != this) {
+                rule_ = it->second;
+                return;
+            }
+            auto lazy = [&](const node_ptr &child) {
+                if(derivatives.count(child.get())) return;
+                if(child->kind() == op_code::variable) derivatives.emplace(child.get(), child->differentiate(var));
+                else derivatives.emplace(child.get(), node_ptr(new lazy_derivative_node(child, var, context_)));
+            };
+            if(auto bin = dynamic_cast<const binary_op_node<T>*>(source.get())) {
+                lazy(bin->left);
+                lazy(bin->right);
+            } else if(auto un = dynamic_cast<const unary_op_node<T>*>(source.get())) {
+                lazy(un->child);
+            }
+            auto *saved = derivative_cache<T>::active;
+            derivative_cache<T>::active = &derivatives;
+            try {
+                rule_ = source->differentiate(var);
+            } catch(...) {
+                derivative_cache<T>::active = saved;
+                throw;
+            }
+            derivative_cache<T>::active = saved;
+        });
+        return rule_;
     }
+
+    // Только у корня: внутренние узлы живут, пока жив корень
+    std::shared_ptr<context> owner_;
+    context *const context_;
+    mutable std::once_flag rule_once_;
+    mutable node_ptr rule_;
+    mutable std::once_flag tree_once_;
+    mutable node_ptr tree_;
 };
 
 // --- Реализация методов класса expression ---
 template<typename T>
 expression<T>::expression(T value)
-    : root_(std::make_shared<constant_node<T>>(value)) {}
+    : root_(make_constant<T>(value)) {}
 
 template<typename T>
 expression<T>::expression(const std::string &var_name)
-    : root_(std::make_shared<variable_node<T>>(var_name)) {}
+    : root_(make_variable<T>(var_name)) {}
 
 template<typename T>
 expression<T>::expression(const expression &other)
-    : root_(other.root_->clone()) {}
+    : root_(other.root_) {}
 
 template<typename T>
 expression<T>::expression(expression &&other) noexcept
@@ -253,7 +751,7 @@ expression<T>::expression(expression &&other) noexcept
 template<typename T>
 expression<T>& expression<T>::operator=(const expression &other) {
     if(this != &other) {
-        root_ = other.root_->clone();
+        root_ = other.root_;
     }
     return *this;
 }
@@ -270,48 +768,225 @@ template<typename T>
 expression<T>::~expression() {}
 
 template<typename T>
-std::string expression<T>::to_string() const {
-    return root_->to_string();
+T expression<T>::evaluate(const std::map<std::string, T> &variables) const {
+    DIFFER_TIMER(evaluate);
+    return root_->evaluate(variables);
+}
+
+// Узлам, не зависящим от var, в кэш заранее кладётся нулевая производная:
+// правила не строят для них 0 / u или 0 * ln(u), которые simplify() уже не
+// может свернуть, не потеряв ошибку вычисления
+template<typename T>
+void seed_independent(const typename expression<T>::node_base *root, const std::string &var,
+                      typename derivative_cache<T>::map_type &cache) {
+    using node_base = typename expression<T>::node_base;
+    std::unordered_map<const node_base*, bool> depends;
+    std::vector<std::pair<const node_base*, bool>> stack{{root, false}};
+    while(!stack.empty()) {
+        auto [node, expanded] = stack.back();
+        stack.pop_back();
+        if(depends.count(node)) continue;
+        const node_base *kids[2];
+        int count = 0;
+        if(auto bin = dynamic_cast<const binary_op_node<T>*>(node)) {
+            kids[count++] = bin->left.get();
+            kids[count++] = bin->right.get();
+        } else if(auto un = dynamic_cast<const unary_op_node<T>*>(node)) {
+            kids[count++] = un->child.get();
+        }
+        if(!expanded && count) {
+            stack.push_back({node, true});
+            for(int k = count; k-- > 0;) stack.push_back({kids[k], false});
+            continue;
+        }
+        bool result = node->kind() == op_code::variable && static_cast<const variable_node<T>*>(node)->name == var;
+        for(int k = 0; k < count; ++k) result = result || depends[kids[k]];
+        depends.emplace(node, result);
+    }
+    const auto zero = make_constant<T>(T(0));
+    for(const auto &[node, result] : depends)
+        if(!result) cache.emplace(node, zero);
 }
 
 template<typename T>
-T expression<T>::evaluate(const std::map<std::string, T> &variables) const {
-    return root_->evaluate(variables);
+expression<T> expression<T>::differentiate(const std::string &var, bool simplified) const {
+    DIFFER_TIMER(differentiate);
+    typename derivative_cache<T>::map_type cache;
+    seed_independent<T>(tree().get(), var, cache);
+    auto *saved = derivative_cache<T>::active;
+    derivative_cache<T>::active = &cache;
+    try {
+        auto result = derivative_of<T>(tree(), var);
+        derivative_cache<T>::active = saved;
+        if(simplified) return expression(result).simplify();
+        return expression(result);
+    } catch(...) {
+        derivative_cache<T>::active = saved;
+        throw;
+    }
+}
+
+template<typename T>
+expression<T> expression<T>::differentiate_lazy(const std::string &var, bool simplified) const {
+    return expression(std::make_shared<lazy_derivative_node<T>>(tree(), var, simplified));
+}
+
+template<typename T>
+const std::shared_ptr<typename expression<T>::node_base>& expression<T>::tree() const {
+    if(auto lazy = dynamic_cast<const lazy_derivative_node<T>*>(root_.get())) return lazy->expanded();
+    return root_;
 }
 
+// Один обход уникальных узлов снизу вверх: для каждого узла строятся
+// производные только по тем переменным, от которых он зависит, по правилам
+// самих узлов. Кэш derivative_cache на каждую переменную уже содержит
+// производные потомков, поэтому каждое правило выполняется за O(1), а для
+// независимых потомков в кэш заранее кладётся ноль.
 template<typename T>
-expression<T> expression<T>::differentiate(const std::string &var) const {
-    return expression(root_->differentiate(var));
+std::vector<expression<T>> expression<T>::differentiate_all(const std::vector<std::string> &vars, bool simplified,
+                                                            std::size_t threads) const {
+    DIFFER_TIMER(differentiate);
+    using node_ptr = std::shared_ptr<node_base>;
+    auto children = [](const node_base *node, const node_base *out[2]) -> int {
+        if(auto bin = dynamic_cast<const binary_op_node<T>*>(node)) {
+            out[0] = bin->left.get();
+            out[1] = bin->right.get();
+            return 2;
+        }
+        if(auto un = dynamic_cast<const unary_op_node<T>*>(node)) {
+            out[0] = un->child.get();
+            return 1;
+        }
+        return 0;
+    };
+
+    // Номера переменных (повторяющиеся имена считаются один раз)
+    std::unordered_map<std::string, std::size_t> var_index;
+    std::vector<std::size_t> first_of(vars.size());
+    std::vector<std::size_t> distinct;
+    for(std::size_t i = 0; i < vars.size(); ++i) {
+        auto [it, inserted] = var_index.emplace(vars[i], i);
+        first_of[i] = it->second;
+        if(inserted) distinct.push_back(i);
+    }
+
+    // Уникальные узлы в порядке post-order и множества зависимостей (битовые маски)
+    const std::size_t words = (vars.size() + 63) / 64;
+    std::unordered_map<const node_base*, std::size_t> position;
+    std::vector<const node_base*> order;
+    std::vector<std::uint64_t> deps;
+    // Позиции потомков узла n: kid_positions[kid_begin[n]..kid_begin[n + 1])
+    std::vector<std::size_t> kid_positions, kid_begin{0};
+    std::vector<std::pair<const node_base*, bool>> stack{{tree().get(), false}};
+    while(!stack.empty()) {
+        auto [node, expanded] = stack.back();
+        stack.pop_back();
+        if(position.count(node)) continue;
+        const node_base *kids[2];
+        const int count = children(node, kids);
+        if(!expanded && count) {
+            stack.push_back({node, true});
+            for(int k = count; k-- > 0;) stack.push_back({kids[k], false});
+            continue;
+        }
+        position.emplace(node, order.size());
+        order.push_back(node);
+        for(int k = 0; k < count; ++k) kid_positions.push_back(position[kids[k]]);
+        kid_begin.push_back(kid_positions.size());
+        deps.resize(order.size() * words, 0);
+        std::uint64_t *mask = deps.data() + (order.size() - 1) * words;
+        if(node->kind() == op_code::variable) {
+            auto it = var_index.find(static_cast<const variable_node<T>*>(node)->name);
+            if(it != var_index.end()) mask[it->second / 64] |= std::uint64_t(1) << (it->second % 64);
+        }
+        for(std::size_t k = kid_begin[order.size() - 1]; k < kid_begin[order.size()]; ++k) {
+            const std::uint64_t *child = deps.data() + kid_positions[k] * words;
+            for(std::size_t w = 0; w < words; ++w) mask[w] |= child[w];
+        }
+    }
+    auto depends = [&](std::size_t node, std::size_t var) {
+        return (deps[node * words + var / 64] >> (var % 64)) & 1;
+    };
+
+    const node_ptr zero = make_constant<T>(T(0));
+    std::vector<expression> results(vars.size(), expression(zero));
+    // Задача -- группа переменных; узлы обходятся один раз на группу
+    auto run_group = [&](const std::vector<std::size_t> &group) {
+        std::vector<typename derivative_cache<T>::map_type> caches(group.size());
+        auto *saved = derivative_cache<T>::active;
+        try {
+            for(std::size_t n = 0; n < order.size(); ++n) {
+                for(std::size_t g = 0; g < group.size(); ++g) {
+                    const std::size_t v = group[g];
+                    if(!depends(n, v)) continue;
+                    for(std::size_t k = kid_begin[n]; k < kid_begin[n + 1]; ++k)
+                        if(!depends(kid_positions[k], v)) caches[g].emplace(order[kid_positions[k]], zero);
+                    derivative_cache<T>::active = &caches[g];
+                    caches[g].emplace(order[n], order[n]->differentiate(vars[v]));
+                }
+            }
+            derivative_cache<T>::active = saved;
+        } catch(...) {
+            derivative_cache<T>::active = saved;
+            throw;
+        }
+        const std::size_t root = order.size() - 1;
+        for(std::size_t g = 0; g < group.size(); ++g) {
+            if(!depends(root, group[g])) continue;
+            expression result(caches[g][tree().get()]);
+            results[group[g]] = simplified ? result.simplify() : result;
+        }
+    };
+
+    // Небольшие выражения считаются в текущем потоке одной группой
+    const std::size_t work = order.size() * distinct.size();
+    std::unique_ptr<thread_pool> own;
+    thread_pool *pool = nullptr;
+    if(work >= 20000 && threads != 1 && distinct.size() > 1) {
+        if(threads) own = std::make_unique<thread_pool>(threads);
+        pool = own ? own.get() : &thread_pool::shared();
+    }
+    if(!pool || pool->size() == 1) {
+        run_group(distinct);
+    } else {
+        // Несколько групп на поток, чтобы свободные потоки могли перехватывать работу
+        const std::size_t groups = std::min(distinct.size(), pool->size() * 4);
+        std::vector<std::vector<std::size_t>> split(groups);
+        for(std::size_t i = 0; i < distinct.size(); ++i) split[i % groups].push_back(distinct[i]);
+        pool->run(groups, [&](std::size_t task, std::size_t) { run_group(split[task]); });
+    }
+    for(std::size_t i = 0; i < vars.size(); ++i) results[i] = results[first_of[i]];
+    return results;
 }
 
 template<typename T>
 expression<T> expression<T>::substitute(const std::string &var, const expression &value) const {
-    return expression(root_->substitute(var, value.root_));
+    return expression(tree()->substitute(var, value.tree()));
 }
 
 template<typename T>
 expression<T> expression<T>::operator+(const expression &other) const {
-    return expression(std::make_shared<binary_op_node<T>>("+", root_->clone(), other.root_->clone()));
+    return expression(make_binary_node<T>("+", tree(), other.tree()));
 }
 
 template<typename T>
 expression<T> expression<T>::operator-(const expression &other) const {
-    return expression(std::make_shared<binary_op_node<T>>("-", root_->clone(), other.root_->clone()));
+    return expression(make_binary_node<T>("-", tree(), other.tree()));
 }
 
 template<typename T>
 expression<T> expression<T>::operator*(const expression &other) const {
-    return expression(std::make_shared<binary_op_node<T>>("*", root_->clone(), other.root_->clone()));
+    return expression(make_binary_node<T>("*", tree(), other.tree()));
 }
 
 template<typename T>
 expression<T> expression<T>::operator/(const expression &other) const {
-    return expression(std::make_shared<binary_op_node<T>>("/", root_->clone(), other.root_->clone()));
+    return expression(make_binary_node<T>("/", tree(), other.tree()));
 }
 
 template<typename T>
 expression<T> expression<T>::operator^(const expression &other) const {
-    return expression(std::make_shared<binary_op_node<T>>("^", root_->clone(), other.root_->clone()));
+    return expression(make_binary_node<T>("^", tree(), other.tree()));
 }
 
 template<typename T>
@@ -320,152 +995,2684 @@ expression<T>::expression(std::shared_ptr<node_base> node)
 
 template<typename T>
 expression<T> expression<T>::make_unary(const std::string &op, const expression &operand) {
-    return expression(std::make_shared<unary_op_node<T>>(op, operand.root_->clone()));
+    return expression(make_unary_node<T>(op, operand.tree()));
 }
 
-// --- Определение вспомогательных функций для комплексной единицы ---
+// --- Метрики размера выражения ---
+// Размер узла оценивается как sizeof узла плюс блок управления make_shared
+// (два счётчика и указатель на таблицу виртуальных функций) плюс память
+// длинных строк, не помещающихся во встроенный буфер std::string.
+template<typename Node>
+std::size_t shared_node_bytes(const std::string &text) {
+    const std::size_t control_block = 2 * sizeof(long) + sizeof(void*);
+    const std::size_t string_bytes = text.capacity() > 15 ? text.capacity() + 1 : 0;
+    return sizeof(Node) + control_block + string_bytes;
+}
+
+template<typename T>
+expression_metrics expression<T>::metrics() const {
+    expression_metrics result{0, 0, 0, 0};
+    const std::string no_text;
+    // Размер и глубина поддерева в виде дерева для каждого уникального узла
+    struct extent {
+        std::size_t size;
+        std::size_t depth;
+    };
+    std::unordered_map<const node_base*, extent> tree_size;
+    std::vector<std::pair<const node_base*, bool>> stack{{tree().get(), false}};
+    while(!stack.empty()) {
+        auto [node, expanded] = stack.back();
+        stack.pop_back();
+        if(!expanded && tree_size.count(node)) continue;
+        op_code op = node->kind();
+        if(op == op_code::constant) {
+            tree_size[node] = {1, 1};
+            result.bytes += shared_node_bytes<constant_node<T>>(no_text);
+        } else if(op == op_code::variable) {
+            tree_size[node] = {1, 1};
+            result.bytes += shared_node_bytes<variable_node<T>>(static_cast<const variable_node<T>*>(node)->name);
+        } else if(auto bin = dynamic_cast<const binary_op_node<T>*>(node)) {
+            if(!expanded) {
+                stack.push_back({node, true});
+                stack.push_back({bin->right.get(), false});
+                stack.push_back({bin->left.get(), false});
+                continue;
+            }
+            if(tree_size.count(node)) continue;
+            const extent &l = tree_size[bin->left.get()], &r = tree_size[bin->right.get()];
+            tree_size[node] = {1 + l.size + r.size, 1 + std::max(l.depth, r.depth)};
+            result.bytes += shared_node_bytes<binary_op_node<T>>(bin->op);
+        } else {
+            auto un = static_cast<const unary_op_node<T>*>(node);
+            if(!expanded) {
+                stack.push_back({node, true});
+                stack.push_back({un->child.get(), false});
+                continue;
+            }
+            if(tree_size.count(node)) continue;
+            const extent &c = tree_size[un->child.get()];
+            tree_size[node] = {1 + c.size, 1 + c.depth};
+            result.bytes += shared_node_bytes<unary_op_node<T>>(un->op);
+        }
+    }
+    result.unique_nodes = tree_size.size();
+    result.tree_nodes = tree_size[tree().get()].size;
+    result.depth = tree_size[tree().get()].depth;
+    return result;
+}
+
+template<typename T>
+std::size_t expression<T>::interned_nodes() {
+    return node_table<T>::instance().live();
+}
+
+// --- Упрощение выражений ---
+// Переписывание снизу вверх с запоминанием результата для общих узлов:
+// свёртка констант, удаление нейтральных и поглощающих элементов, сбор
+// подобных слагаемых (c1*t + c2*t) и множителей (t^a * t^b). Благодаря
+// hash-consing одинаковые поддеревья -- это один и тот же узел, поэтому
+// подобные члены сравниваются по адресу. Поглощающие правила (0 * u, 0 / u,
+// u - u, u ^ 0, 1 ^ u) не отбрасывают поддерево, вычисление которого может
+// завершиться ошибкой (деление, ln, неизвестная операция): 0 * ln(-1) и
+// 0 / (x - x) упрощёнными остаются ошибкой, как и до упрощения.
 template<typename U>
-typename std::enable_if<std::is_same<U, std::complex<double>>::value, expression<U>>::type
-make_complex_unit_helper() {
-    return expression<U>(std::complex<double>(0, 1));
+bool is_negative(const U &value) {
+    return value < U(0);
 }
 
 template<typename U>
-typename std::enable_if<!std::is_same<U, std::complex<double>>::value, expression<U>>::type
-make_complex_unit_helper() {
-    throw std::runtime_error("Complex unit 'i' encountered for non-complex type");
+bool is_negative(const std::complex<U> &value) {
+    return value.imag() == U(0) && value.real() < U(0);
 }
 
-// --- Реализация парсера выражений ---
-template<typename T>
-class ExpressionParserT {
-    std::string str;
-    size_t pos;
-public:
-    ExpressionParserT(const std::string &s) : str(s), pos(0) {}
-    void skipWhitespace() {
-        while (pos < str.size() && isspace(str[pos])) ++pos;
-    }
-    expression<T> parseExpression();
-    expression<T> parseTerm();
-    expression<T> parseFactor();
-    expression<T> parsePrimary();
-    expression<T> parse();
-};
+template<typename U>
+bool is_negative(const dual<U> &value) {
+    return is_negative(value.value);
+}
 
 template<typename T>
-expression<T> ExpressionParserT<T>::parsePrimary() {
-    skipWhitespace();
-    if (pos >= str.size())
-        throw std::runtime_error("Unexpected end of input");
+class simplifier {
+public:
+    using node_base = typename expression<T>::node_base;
+    using node_ptr = std::shared_ptr<node_base>;
 
-    if (str[pos] == 'i') {
-        ++pos;
-        return make_complex_unit_helper<T>();
+    node_ptr run(const node_ptr &node) {
+        auto it = memo_.find(node.get());
+        if(it != memo_.end()) return it->second;
+        node_ptr result;
+        switch(node->kind()) {
+        case op_code::constant:
+        case op_code::variable:
+        case op_code::unknown:
+            result = node;
+            break;
+        case op_code::add:
+        case op_code::sub:
+            result = simplify_sum(node);
+            break;
+        case op_code::mul:
+            result = simplify_product(node);
+            break;
+        case op_code::div:
+            result = simplify_div(static_cast<const binary_op_node<T>*>(node.get()));
+            break;
+        case op_code::pow:
+            result = simplify_pow(static_cast<const binary_op_node<T>*>(node.get()));
+            break;
+        default:
+            result = simplify_unary(static_cast<const unary_op_node<T>*>(node.get()));
+            break;
+        }
+        memo_.emplace(node.get(), result);
+        return result;
     }
 
-    if (str[pos] == '(') {
-        ++pos;
-        auto expr = parseExpression();
-        skipWhitespace();
-        if (pos >= str.size() || str[pos] != ')')
-            throw std::runtime_error("Missing closing parenthesis");
-        ++pos;
-        return expr;
+private:
+    static bool is_constant(const node_ptr &node) {
+        return node->kind() == op_code::constant;
     }
 
-    if (isalpha(str[pos])) {
-        std::string id;
-        while (pos < str.size() && isalpha(str[pos])) {
-            id.push_back(str[pos]);
-            ++pos;
+    // Может ли вычисление поддерева бросить исключение области определения
+    bool may_fail(const node_ptr &node) {
+        auto it = fallible_.find(node.get());
+        if(it != fallible_.end()) return it->second;
+        bool result = false;
+        switch(node->kind()) {
+        case op_code::constant:
+        case op_code::variable:
+            break;
+        case op_code::add: case op_code::sub: case op_code::mul: case op_code::pow: {
+            auto bin = static_cast<const binary_op_node<T>*>(node.get());
+            result = may_fail(bin->left) || may_fail(bin->right);
+            break;
         }
-        skipWhitespace();
-        if (pos < str.size() && str[pos] == '(') {
-            ++pos;
-            auto arg = parseExpression();
-            skipWhitespace();
-            if (pos >= str.size() || str[pos] != ')')
-                throw std::runtime_error("Missing closing parenthesis for function");
-            ++pos;
-            return expression<T>::make_unary(id, arg);
-        } else {
-            return expression<T>(id);
+        case op_code::div: {
+            auto bin = static_cast<const binary_op_node<T>*>(node.get());
+            result = !(is_constant(bin->right) && !zero_divisor(value_of(bin->right))) ||
+                     may_fail(bin->left) || may_fail(bin->right);
+            break;
+        }
+        case op_code::ln: {
+            auto un = static_cast<const unary_op_node<T>*>(node.get());
+            // Для комплексных ln определён везде, кроме нуля (как при вычислении)
+            result = is_constant(un->child) ? ln_domain_error(value_of(un->child))
+                                            : ln_domain_error(T(-1)) || may_fail(un->child);
+            break;
         }
+        case op_code::sin: case op_code::cos: case op_code::exp:
+            result = may_fail(static_cast<const unary_op_node<T>*>(node.get())->child);
+            break;
+        default:
+            result = true;
+            break;
+        }
+        fallible_.emplace(node.get(), result);
+        return result;
+    }
+    static T value_of(const node_ptr &node) {
+        return static_cast<const constant_node<T>*>(node.get())->value;
+    }
+    static bool is_value(const node_ptr &node, const T &value) {
+        return is_constant(node) && value_of(node) == value;
     }
 
-    if (isdigit(str[pos]) || str[pos] == '.') {
-        std::string numStr;
-        while (pos < str.size() && (isdigit(str[pos]) || str[pos] == '.')) {
-            numStr.push_back(str[pos]);
-            ++pos;
+    node_ptr simplify_unary(const unary_op_node<T> *node) {
+        node_ptr child = run(node->child);
+        if(is_constant(child) && node->code != op_code::unknown) {
+            T value = value_of(child);
+            bool foldable = true;
+            // ln от неположительного числа оставляем до вычисления (там ошибка)
+            if(node->code == op_code::ln && ln_domain_error(value)) foldable = false;
+            if(foldable) {
+                switch(node->code) {
+                case op_code::sin: return make_constant<T>(math_sin(value));
+                case op_code::cos: return make_constant<T>(math_cos(value));
+                case op_code::ln: return make_constant<T>(math_log(value));
+                default: return make_constant<T>(math_exp(value));
+                }
+            }
         }
-        double value = std::stod(numStr);
-        return expression<T>(T(value));
+        if(child == node->child) return node->clone();
+        return make_unary_node<T>(node->op, child);
     }
 
-    throw std::runtime_error("Unexpected character: " + std::string(1, str[pos]));
-}
+    // Слагаемые цепочки + и - собираются в список (коэффициент, член);
+    // член равен nullptr для свободной константы
+    node_ptr simplify_sum(const node_ptr &node) {
+        std::vector<std::pair<T, node_ptr>> terms;
+        std::unordered_map<const node_base*, std::size_t> index;
+        T free_term = T(0);
 
-template<typename T>
-expression<T> ExpressionParserT<T>::parseFactor() {
-    auto left = parsePrimary();
-    skipWhitespace();
-    while (pos < str.size() && str[pos] == '^') {
-        ++pos;
-        auto right = parsePrimary();
-        left = left ^ right;
-        skipWhitespace();
-    }
-    return left;
-}
+        auto add_term = [&](T coef, const node_ptr &term) {
+            if(is_constant(term)) {
+                free_term += coef * value_of(term);
+                return;
+            }
+            node_ptr rest = term;
+            if(term->kind() == op_code::mul) {
+                auto bin = static_cast<const binary_op_node<T>*>(term.get());
+                if(is_constant(bin->left)) {
+                    coef *= value_of(bin->left);
+                    rest = bin->right;
+                }
+            }
+            auto it = index.find(rest.get());
+            if(it == index.end()) {
+                index.emplace(rest.get(), terms.size());
+                terms.emplace_back(coef, rest);
+            } else {
+                terms[it->second].first += coef;
+            }
+        };
 
-template<typename T>
-expression<T> ExpressionParserT<T>::parseTerm() {
-    auto left = parseFactor();
-    skipWhitespace();
-    while (pos < str.size() && (str[pos] == '*' || str[pos] == '/')) {
-        char op = str[pos];
-        ++pos;
-        auto right = parseFactor();
-        if (op == '*')
-            left = left * right;
-        else
-            left = left / right;
-        skipWhitespace();
-    }
-    return left;
-}
+        // Обход цепочки сумм с явным стеком; simplified -- член уже упрощён
+        struct item {
+            node_ptr node;
+            T sign;
+            bool simplified;
+        };
+        std::vector<item> stack{{node, T(1), false}};
+        while(!stack.empty()) {
+            item top = stack.back();
+            stack.pop_back();
+            op_code op = top.node->kind();
+            if(op == op_code::add || op == op_code::sub) {
+                auto bin = static_cast<const binary_op_node<T>*>(top.node.get());
+                stack.push_back({bin->right, op == op_code::sub ? -top.sign : top.sign, top.simplified});
+                stack.push_back({bin->left, top.sign, top.simplified});
+                continue;
+            }
+            if(top.simplified) {
+                add_term(top.sign, top.node);
+                continue;
+            }
+            node_ptr term = run(top.node);
+            op_code term_op = term->kind();
+            if(term_op == op_code::add || term_op == op_code::sub)
+                stack.push_back({term, top.sign, true});
+            else
+                add_term(top.sign, term);
+        }
+
+        node_ptr result;
+        auto append = [&](T coef, const node_ptr &term) {
+            // Сократившийся член, который может бросить, остаётся как 0 * u
+            if(coef == T(0) && !(term && may_fail(term))) return;
+            if(!result) {
+                result = scaled(coef, term);
+            } else if(is_negative(coef)) {
+                result = make_binary_node<T>("-", result, scaled(-coef, term));
+            } else {
+                result = make_binary_node<T>("+", result, scaled(coef, term));
+            }
+        };
+        for(auto &term : terms)
+            append(term.first, term.second);
+        if(free_term != T(0) || !result) {
+            if(!result) return make_constant<T>(free_term);
+            append(free_term, nullptr);
+        }
+        return result;
+    }
+
+    static node_ptr scaled(const T &coef, const node_ptr &term) {
+        if(!term) return make_constant<T>(coef);
+        if(coef == T(1)) return term;
+        return make_binary_node<T>("*", make_constant<T>(coef), term);
+    }
+
+    // Множители цепочки * собираются в коэффициент и список (основание, степень)
+    node_ptr simplify_product(const node_ptr &node) {
+        T coef = T(1);
+        std::vector<std::pair<node_ptr, T>> factors;
+        std::vector<node_ptr> others;
+        std::unordered_map<const node_base*, std::size_t> index;
+
+        auto add_factor = [&](const node_ptr &factor) {
+            if(is_constant(factor)) {
+                coef *= value_of(factor);
+                return;
+            }
+            node_ptr base = factor;
+            T power = T(1);
+            if(factor->kind() == op_code::pow) {
+                auto bin = static_cast<const binary_op_node<T>*>(factor.get());
+                if(is_constant(bin->right)) {
+                    base = bin->left;
+                    power = value_of(bin->right);
+                }
+            }
+            auto it = index.find(base.get());
+            if(it == index.end()) {
+                index.emplace(base.get(), factors.size());
+                factors.emplace_back(base, power);
+            } else {
+                factors[it->second].second += power;
+            }
+        };
+
+        std::vector<std::pair<node_ptr, bool>> stack{{node, false}};
+        while(!stack.empty()) {
+            auto [current, simplified] = stack.back();
+            stack.pop_back();
+            if(current->kind() == op_code::mul) {
+                auto bin = static_cast<const binary_op_node<T>*>(current.get());
+                stack.emplace_back(bin->right, simplified);
+                stack.emplace_back(bin->left, simplified);
+                continue;
+            }
+            if(simplified) {
+                add_factor(current);
+                continue;
+            }
+            node_ptr factor = run(current);
+            if(factor->kind() == op_code::mul)
+                stack.emplace_back(factor, true);
+            else
+                add_factor(factor);
+        }
+
+        // Переменные упорядочиваются по имени, чтобы x*y и y*x совпадали
+        std::stable_sort(factors.begin(), factors.end(), [](const auto &a, const auto &b) {
+            bool a_var = a.first->kind() == op_code::variable;
+            bool b_var = b.first->kind() == op_code::variable;
+            if(a_var != b_var) return a_var;
+            if(!a_var) return false;
+            return static_cast<const variable_node<T>*>(a.first.get())->name <
+                   static_cast<const variable_node<T>*>(b.first.get())->name;
+        });
+        node_ptr result;
+        for(auto &factor : factors) {
+            if(factor.second == T(0) && !may_fail(factor.first)) continue;
+            node_ptr term = factor.second == T(1)
+                ? factor.first
+                : make_binary_node<T>("^", factor.first, make_constant<T>(factor.second));
+            result = result ? make_binary_node<T>("*", result, term) : term;
+        }
+        if(coef == T(0)) {
+            if(result && may_fail(result)) return make_binary_node<T>("*", make_constant<T>(T(0)), result);
+            return make_constant<T>(T(0));
+        }
+        if(!result) return make_constant<T>(coef);
+        return scaled(coef, result);
+    }
+
+    node_ptr simplify_div(const binary_op_node<T> *node) {
+        node_ptr left = run(node->left);
+        node_ptr right = run(node->right);
+        // Деление на константный ноль не сворачиваем: ошибка должна
+        // возникнуть при вычислении
+        if(is_value(right, T(0))) return rebuild(node, left, right);
+        if(is_constant(left) && is_constant(right))
+            return make_constant<T>(value_of(left) / value_of(right));
+        // 0 / u не сворачивается: при u == 0 деление -- ошибка
+        if(is_value(right, T(1))) return left;
+        return rebuild(node, left, right);
+    }
+
+    node_ptr simplify_pow(const binary_op_node<T> *node) {
+        node_ptr left = run(node->left);
+        node_ptr right = run(node->right);
+        if(is_constant(left) && is_constant(right)) {
+            return make_constant<T>(math_pow(value_of(left), value_of(right)));
+        }
+        if(is_value(right, T(0)) && !may_fail(left)) return make_constant<T>(T(1));
+        if(is_value(right, T(1))) return left;
+        if(is_value(left, T(1)) && !may_fail(right)) return left;
+        return rebuild(node, left, right);
+    }
+
+    static node_ptr rebuild(const binary_op_node<T> *node, const node_ptr &left, const node_ptr &right) {
+        if(left == node->left && right == node->right) return node->clone();
+        return make_binary_node<T>(node->op, left, right);
+    }
+
+    std::unordered_map<const node_base*, node_ptr> memo_;
+    std::unordered_map<const node_base*, bool> fallible_;
+};
+
+template<typename T>
+expression<T> expression<T>::simplify() const {
+    simplifier<T> pass;
+    return expression(pass.run(tree()));
+}
+
+// --- Печать выражений ---
+// Обход с явным стеком: в стек кладутся узлы и готовые фрагменты текста в
+// обратном порядке, так что глубина дерева не влияет на стек вызовов, а
+// каждый символ записывается в буфер один раз.
+template<typename T>
+class printer {
+public:
+    using node_base = typename expression<T>::node_base;
+
+    explicit printer(print_style style) : style_(style) {}
+
+    // Дописывает текст узла в buffer; если задан поток, буфер сбрасывается
+    // в него по мере заполнения
+    void print(const node_base *root, std::string &buffer, std::ostream *out = nullptr) {
+        std::vector<item> stack{{root, {}}};
+        while(!stack.empty()) {
+            item top = stack.back();
+            stack.pop_back();
+            if(out && buffer.size() >= flush_at) {
+                out->write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+                buffer.clear();
+            }
+            if(!top.node) {
+                buffer.append(top.text);
+                continue;
+            }
+            switch(top.node->kind()) {
+            case op_code::constant:
+                append_constant(static_cast<const constant_node<T>*>(top.node)->value, buffer);
+                break;
+            case op_code::variable:
+                buffer.append(static_cast<const variable_node<T>*>(top.node)->name);
+                break;
+            case op_code::add: case op_code::sub: case op_code::mul: case op_code::div: case op_code::pow:
+                push_binary(static_cast<const binary_op_node<T>*>(top.node), stack);
+                break;
+            default: {
+                // Неизвестная операция: имя функции или оператора печатается как есть
+                auto un = dynamic_cast<const unary_op_node<T>*>(top.node);
+                if(!un) {
+                    push_binary(static_cast<const binary_op_node<T>*>(top.node), stack);
+                    break;
+                }
+                stack.push_back({nullptr, ")"});
+                stack.push_back({un->child.get(), {}});
+                stack.push_back({nullptr, "("});
+                stack.push_back({nullptr, un->op});
+                break;
+            }
+            }
+        }
+        if(out) {
+            out->write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            buffer.clear();
+        }
+    }
+
+private:
+    // Узел или фрагмент текста (node == nullptr)
+    struct item {
+        const node_base *node;
+        std::string_view text;
+    };
+
+    static constexpr std::size_t flush_at = 1 << 16;
+
+    // Фрагменты бинарной операции в обратном порядке
+    void push_binary(const binary_op_node<T> *bin, std::vector<item> &stack) const {
+        const bool full = style_ == print_style::full;
+        const bool spaced = style_ != print_style::compact;
+        const bool wrap_left = full ? negative_literal(bin->left.get()) : needs_parens(bin->code, bin->left.get(), false);
+        const bool wrap_right = full ? negative_literal(bin->right.get()) : needs_parens(bin->code, bin->right.get(), true);
+        if(full) stack.push_back({nullptr, ")"});
+        if(wrap_right) stack.push_back({nullptr, ")"});
+        stack.push_back({bin->right.get(), {}});
+        if(wrap_right) stack.push_back({nullptr, "("});
+        if(spaced) stack.push_back({nullptr, " "});
+        stack.push_back({nullptr, bin->op});
+        if(spaced) stack.push_back({nullptr, " "});
+        if(wrap_left) stack.push_back({nullptr, ")"});
+        stack.push_back({bin->left.get(), {}});
+        if(wrap_left) stack.push_back({nullptr, "("});
+        if(full) stack.push_back({nullptr, "("});
+    }
+
+    static int precedence(op_code op) {
+        switch(op) {
+        case op_code::add: case op_code::sub: return 1;
+        case op_code::mul: case op_code::div: return 2;
+        case op_code::pow: return 3;
+        default: return 4;
+        }
+    }
+
+    // Все операции левоассоциативны, поэтому правый операнд того же
+    // приоритета тоже берётся в скобки: a - (b - c), a + (b + c).
+    // Отрицательная константа-операнд -- всегда: (-1) * x, x ^ (-1).
+    static bool needs_parens(op_code parent, const node_base *child, bool right) {
+        if(child->kind() == op_code::constant)
+            return is_negative(static_cast<const constant_node<T>*>(child)->value);
+        const int p = precedence(parent), c = precedence(child->kind());
+        return right ? c <= p : c < p;
+    }
+
+    // Отрицательное число печатается с минусом впереди; в full скобки
+    // остальных операндов уже есть, а число берётся в свои: (x ^ (-1))
+    static bool negative_literal(const node_base *child) {
+        if constexpr (std::is_floating_point<T>::value)
+            return child->kind() == op_code::constant &&
+                   is_negative(static_cast<const constant_node<T>*>(child)->value);
+        else
+            return false;
+    }
+
+    // full: формат operator<< (%g с точностью 6); minimal и compact: число
+    // без потери точности в записи, которую принимает парсер (1e-07, -2.5)
+    void append_constant(const T &value, std::string &buffer) {
+        if constexpr (std::is_floating_point<T>::value) {
+            if(style_ != print_style::full) {
+                char text[64];
+                auto result = std::to_chars(text, text + sizeof(text), value);
+                buffer.append(text, result.ptr);
+                return;
+            }
+        }
+        if constexpr (std::is_same<T, double>::value) {
+            char text[32];
+            int length = std::snprintf(text, sizeof(text), "%g", value);
+            buffer.append(text, static_cast<std::size_t>(length));
+        } else {
+            number_.str(std::string());
+            if(style_ != print_style::full)
+                number_.precision(std::numeric_limits<typename literal_type<T>::type>::max_digits10);
+            number_ << value;
+            buffer.append(number_.str());
+        }
+    }
+
+    print_style style_;
+    std::ostringstream number_;
+};
+
+template<typename T>
+void expression<T>::print(std::string &buffer, print_style style) const {
+    printer<T>(style).print(tree().get(), buffer);
+}
+
+template<typename T>
+void expression<T>::print(std::ostream &out, print_style style) const {
+    std::string buffer;
+    buffer.reserve(1 << 16);
+    printer<T>(style).print(tree().get(), buffer, &out);
+}
+
+template<typename T>
+std::string expression<T>::to_string(print_style style) const {
+    std::string buffer;
+    print(buffer, style);
+    return buffer;
+}
+
+// --- Разбор стоимости по поддеревьям ---
+// Вес операции при вычислении дерева: арифметика дешёвая, деление дороже,
+// степень и трансцендентные функции -- вызовы библиотеки
+inline double op_cost(op_code op) {
+    switch(op) {
+    case op_code::div: return 4;
+    case op_code::pow:
+    case op_code::sin:
+    case op_code::cos:
+    case op_code::ln:
+    case op_code::exp: return 20;
+    default: return 1;
+    }
+}
+
+template<typename T>
+std::vector<subtree_cost> expression<T>::cost_breakdown(std::size_t top) const {
+    struct info {
+        double cost = 0;
+        double occurrences = 0;
+        std::size_t size = 0;
+        std::size_t depth = 0;
+    };
+    auto children = [](const node_base *node, const node_base *out[2]) -> int {
+        if(auto bin = dynamic_cast<const binary_op_node<T>*>(node)) {
+            out[0] = bin->left.get();
+            out[1] = bin->right.get();
+            return 2;
+        }
+        if(auto un = dynamic_cast<const unary_op_node<T>*>(node)) {
+            out[0] = un->child.get();
+            return 1;
+        }
+        return 0;
+    };
+
+    // Уникальные узлы в post-order: потомки раньше родителей
+    std::unordered_map<const node_base*, info> nodes;
+    std::vector<const node_base*> order;
+    std::vector<std::pair<const node_base*, bool>> stack{{tree().get(), false}};
+    while(!stack.empty()) {
+        auto [node, expanded] = stack.back();
+        stack.pop_back();
+        const node_base *kids[2];
+        const int count = children(node, kids);
+        if(expanded) {
+            info &self = nodes[node];
+            self.cost = op_cost(node->kind());
+            self.size = 1;
+            for(int k = 0; k < count; ++k) {
+                const info &child = nodes[kids[k]];
+                self.cost += child.cost;
+                self.size += child.size;
+                self.depth = std::max(self.depth, child.depth);
+            }
+            ++self.depth;
+            order.push_back(node);
+            continue;
+        }
+        if(!nodes.emplace(node, info()).second) continue;
+        stack.push_back({node, true});
+        for(int k = count - 1; k >= 0; --k) stack.push_back({kids[k], false});
+    }
+
+    // Число вхождений растёт от корня к листьям: каждый родитель передаёт
+    // своё число вхождений каждому ребру к потомку
+    nodes[tree().get()].occurrences = 1;
+    for(auto it = order.rbegin(); it != order.rend(); ++it) {
+        const node_base *kids[2];
+        const int count = children(*it, kids);
+        for(int k = 0; k < count; ++k) nodes[kids[k]].occurrences += nodes[*it].occurrences;
+    }
+
+    const double total = nodes[tree().get()].cost;
+    auto weight = [&](const node_base *node) {
+        const info &i = nodes.at(node);
+        return i.cost * i.occurrences;
+    };
+    top = std::min(top, order.size());
+    std::partial_sort(order.begin(), order.begin() + top, order.end(),
+                      [&](const node_base *a, const node_base *b) { return weight(a) > weight(b); });
+
+    const std::size_t max_text = 80;
+    std::vector<subtree_cost> result;
+    result.reserve(top);
+    for(std::size_t i = 0; i < top; ++i) {
+        const info &node = nodes.at(order[i]);
+        std::string text = expression(order[i]->clone()).to_string(print_style::compact);
+        if(text.size() > max_text) text = text.substr(0, max_text - 3) + "...";
+        result.push_back({std::move(text), node.cost, node.occurrences, weight(order[i]) / total,
+                          node.size, node.depth});
+    }
+    return result;
+}
+
+// --- Счётчики инструментирования ---
+stats_counters& differ_stats_counters() {
+    static stats_counters counters;
+    return counters;
+}
+
+expression_stats collect_stats() {
+    stats_counters &c = differ_stats_counters();
+    expression_stats result{};
+#ifdef DIFFER_STATS
+    result.enabled = true;
+#else
+    result.enabled = false;
+#endif
+    result.node_allocations = c.node_allocations.load(std::memory_order_relaxed);
+    result.node_reuses = c.node_reuses.load(std::memory_order_relaxed);
+    result.clones = c.clones.load(std::memory_order_relaxed);
+    for(std::size_t op = 0; op < op_code_count; ++op)
+        result.visits[op] = c.visits[op].load(std::memory_order_relaxed);
+    for(std::size_t phase = 0; phase < static_cast<std::size_t>(stats_phase::count); ++phase) {
+        result.calls[phase] = c.calls[phase].load(std::memory_order_relaxed);
+        result.milliseconds[phase] = c.nanoseconds[phase].load(std::memory_order_relaxed) / 1e6;
+    }
+    return result;
+}
+
+void reset_stats() {
+    stats_counters &c = differ_stats_counters();
+    c.node_allocations.store(0, std::memory_order_relaxed);
+    c.node_reuses.store(0, std::memory_order_relaxed);
+    c.clones.store(0, std::memory_order_relaxed);
+    for(auto &visits : c.visits) visits.store(0, std::memory_order_relaxed);
+    for(auto &calls : c.calls) calls.store(0, std::memory_order_relaxed);
+    for(auto &ns : c.nanoseconds) ns.store(0, std::memory_order_relaxed);
+}
+
+const char* stats_phase_name(stats_phase phase) {
+    switch(phase) {
+    case stats_phase::parse: return "parse";
+    case stats_phase::differentiate: return "diff";
+    case stats_phase::evaluate: return "eval";
+    default: return "unknown";
+    }
+}
+
+// --- Коды операций ---
+op_code binary_op_code(const std::string &op) {
+    if(op == "+") return op_code::add;
+    if(op == "-") return op_code::sub;
+    if(op == "*") return op_code::mul;
+    if(op == "/") return op_code::div;
+    if(op == "^") return op_code::pow;
+    return op_code::unknown;
+}
+
+op_code unary_op_code(const std::string &op) {
+    if(op == "sin") return op_code::sin;
+    if(op == "cos") return op_code::cos;
+    if(op == "ln") return op_code::ln;
+    if(op == "exp") return op_code::exp;
+    return op_code::unknown;
+}
+
+const char* op_code_name(op_code op) {
+    switch(op) {
+    case op_code::add: return "+";
+    case op_code::sub: return "-";
+    case op_code::mul: return "*";
+    case op_code::div: return "/";
+    case op_code::pow: return "^";
+    case op_code::sin: return "sin";
+    case op_code::cos: return "cos";
+    case op_code::ln: return "ln";
+    case op_code::exp: return "exp";
+    case op_code::powi: return "powi";
+    case op_code::fma: return "fma";
+    case op_code::constant: return "constant";
+    case op_code::variable: return "variable";
+    default: return "unknown";
+    }
+}
+
+// --- Компиляция дерева в ленту инструкций ---
+// Обход в обратном порядке (post-order) с явным стеком: инструкция узла
+// добавляется после инструкций всех его потомков. Общий узел (после
+// hash-consing) компилируется один раз, повторные ссылки берут его регистр.
+template<typename T>
+compiled_expression<T> expression<T>::compile() const {
+    symbol_table symbols;
+    return bind(symbols);
+}
+
+template<typename T>
+compiled_expression<T> expression<T>::bind(symbol_table &symbols) const {
+    compiled_expression<T> result;
+    std::unordered_map<std::string, std::uint32_t> seen;
+
+    struct frame {
+        const node_base *node;
+        bool expanded;
+    };
+    std::vector<frame> stack{{tree().get(), false}};
+    std::vector<std::uint32_t> operands;
+    std::unordered_map<const node_base*, std::uint32_t> emitted;
+
+    while(!stack.empty()) {
+        frame top = stack.back();
+        stack.pop_back();
+        const node_base *node = top.node;
+        if(!top.expanded) {
+            auto done = emitted.find(node);
+            if(done != emitted.end()) {
+                operands.push_back(done->second);
+                continue;
+            }
+        }
+        op_code op = node->kind();
+        typename compiled_expression<T>::instruction ins{op, 0, 0, 0};
+
+        if(op == op_code::constant) {
+            ins.a = static_cast<std::uint32_t>(result.constants_.size());
+            result.constants_.push_back(static_cast<const constant_node<T>*>(node)->value);
+        } else if(op == op_code::variable) {
+            const std::string &name = static_cast<const variable_node<T>*>(node)->name;
+            auto it = seen.find(name);
+            if(it == seen.end()) {
+                it = seen.emplace(name, symbols.intern(name)).first;
+                result.names_.push_back(name);
+                result.slots_.push_back(it->second);
+            }
+            ins.a = it->second;
+        } else if(op == op_code::unknown) {
+            if(auto bin = dynamic_cast<const binary_op_node<T>*>(node))
+                throw std::runtime_error("Unknown operator " + bin->op);
+            throw std::runtime_error("Unknown function " + static_cast<const unary_op_node<T>*>(node)->op);
+        } else if(is_binary(op)) {
+            auto bin = static_cast<const binary_op_node<T>*>(node);
+            if(!top.expanded) {
+                stack.push_back({node, true});
+                stack.push_back({bin->right.get(), false});
+                stack.push_back({bin->left.get(), false});
+                continue;
+            }
+            ins.b = operands.back();
+            operands.pop_back();
+            ins.a = operands.back();
+            operands.pop_back();
+        } else {
+            auto un = static_cast<const unary_op_node<T>*>(node);
+            if(!top.expanded) {
+                stack.push_back({node, true});
+                stack.push_back({un->child.get(), false});
+                continue;
+            }
+            ins.a = operands.back();
+            operands.pop_back();
+        }
+        const std::uint32_t reg = static_cast<std::uint32_t>(result.code_.size());
+        emitted.emplace(node, reg);
+        operands.push_back(reg);
+        result.code_.push_back(ins);
+    }
+    result.slot_count_ = symbols.size();
+    return result;
+}
+
+// Посещения инструкций ленты за rows вычислений: гистограмма по кодам
+// собирается локально и добавляется к общим счётчикам одним проходом
+template<typename Instruction>
+void record_tape_visits(const std::vector<Instruction> &code, std::size_t rows) {
+#ifdef DIFFER_STATS
+    std::uint64_t local[op_code_count] = {};
+    for(const Instruction &c : code) ++local[static_cast<std::size_t>(c.op)];
+    for(std::size_t op = 0; op < op_code_count; ++op)
+        if(local[op]) DIFFER_VISIT(op, local[op] * rows);
+#else
+    (void)code;
+    (void)rows;
+#endif
+}
+
+// --- Интерпретатор скомпилированного выражения ---
+template<typename T>
+T compiled_expression<T>::evaluate(const T *slots, T *regs) const {
+    DIFFER_TIMER(evaluate);
+    return execute(slots, regs);
+}
+
+// Цикл по ленте в арифметике типа V (T или dual<T>); константы приводятся к V
+template<typename T>
+template<typename V>
+V compiled_expression<T>::execute(const V *slots, V *regs) const {
+    record_tape_visits(code_, 1);
+    const instruction *ins = code_.data();
+    const T *pool = constants_.data();
+    const std::size_t n = code_.size();
+    for(std::size_t i = 0; i < n; ++i) {
+        const instruction &c = ins[i];
+        switch(c.op) {
+        case op_code::constant: regs[i] = V(pool[c.a]); break;
+        case op_code::variable: regs[i] = slots[c.a]; break;
+        case op_code::add: regs[i] = regs[c.a] + regs[c.b]; break;
+        case op_code::sub: regs[i] = regs[c.a] - regs[c.b]; break;
+        case op_code::mul: regs[i] = regs[c.a] * regs[c.b]; break;
+        case op_code::div:
+            if(zero_divisor(regs[c.b])) {
+                std::cout << "Dilinie na nol";
+                throw std::runtime_error("Dilinie na nol");
+            }
+            regs[i] = regs[c.a] / regs[c.b];
+            break;
+        case op_code::pow: regs[i] = math_pow(regs[c.a], regs[c.b]); break;
+        case op_code::sin: regs[i] = math_sin(regs[c.a]); break;
+        case op_code::cos: regs[i] = math_cos(regs[c.a]); break;
+        case op_code::ln:
+            if(ln_domain_error(regs[c.a])) {
+                std::cout << "Durak, nuthno bolshe nula";
+                throw std::runtime_error("Durak, nuthno bolshe nula");
+            }
+            regs[i] = math_log(regs[c.a]);
+            break;
+        case op_code::exp: regs[i] = math_exp(regs[c.a]); break;
+        case op_code::powi: regs[i] = math_powi(regs[c.a], static_cast<std::int32_t>(c.b), V(T(1))); break;
+        case op_code::fma: regs[i] = multiply_add(regs[c.a], regs[c.b], regs[c.c]); break;
+        default:
+            throw std::runtime_error("Unknown instruction");
+        }
+    }
+    return regs[n - 1];
+}
+
+template<typename T>
+T compiled_expression<T>::evaluate(const T *slots) const {
+    // Рабочие регистры живут в потоке и переиспользуются между вызовами
+    thread_local std::vector<T> regs;
+    if(regs.size() < code_.size()) regs.resize(code_.size());
+    return evaluate(slots, regs.data());
+}
+
+template<typename T>
+dual<T> compiled_expression<T>::evaluate_dual(const T *slots, const T *direction) const {
+    thread_local std::vector<dual<T>> values;
+    thread_local std::vector<dual<T>> regs;
+    values.resize(slot_count_);
+    if(regs.size() < code_.size()) regs.resize(code_.size());
+    for(std::size_t i = 0; i < slot_count_; ++i)
+        values[i] = dual<T>(slots[i], direction[i]);
+    return execute(values.data(), regs.data());
+}
+
+template<typename T>
+T compiled_expression<T>::evaluate(const std::map<std::string, T> &variables) const {
+    std::vector<T> values(slot_count_);
+    for(std::size_t i = 0; i < names_.size(); ++i) {
+        auto it = variables.find(names_[i]);
+        if(it == variables.end()) throw std::runtime_error("Variable " + names_[i] + " not found");
+        values[slots_[i]] = it->second;
+    }
+    return evaluate(values.data());
+}
+
+// --- Понижение стоимости операций ---
+// Постоянный показатель -- небольшое целое число (для dual не применяется)
+template<typename U>
+bool small_integer(const U &value, std::int32_t &n) {
+    if constexpr (std::is_floating_point<U>::value) {
+        if(!(std::fabs(value) <= 64) || value != std::trunc(value)) return false;
+        n = static_cast<std::int32_t>(value);
+        return true;
+    } else {
+        (void)value;
+        (void)n;
+        return false;
+    }
+}
+
+template<typename U>
+bool small_integer(const std::complex<U> &value, std::int32_t &n) {
+    return value.imag() == U(0) && small_integer(value.real(), n);
+}
+
+// Регистр переменной многочлена-константы
+constexpr std::uint32_t no_var = UINT32_MAX;
+
+// Сначала для каждой инструкции строится многочлен от одной переменной
+// (если её значение -- сумма одночленов в исходной записи), затем обратный проход от результата
+// решает, какие регистры нужны и чем их вычислять: схемой Горнера, powi
+// или исходной инструкцией. Нужные инструкции переносятся в новую ленту.
+template<typename T>
+compiled_expression<T> compiled_expression<T>::reduce_strength() const {
+    constexpr std::size_t max_degree = 32;
+    const std::size_t n = code_.size();
+
+    // Коэффициенты по возрастанию степени переменной из регистра var
+    struct polynomial {
+        bool valid = false;
+        std::uint32_t var = no_var;
+        std::vector<T> coef;
+    };
+    auto same_var = [](const polynomial &x, const polynomial &y, std::uint32_t &var) {
+        if(x.var != no_var && y.var != no_var && x.var != y.var) return false;
+        var = x.var != no_var ? x.var : y.var;
+        return true;
+    };
+    auto multiply = [](const std::vector<T> &x, const std::vector<T> &y) {
+        std::vector<T> out(x.size() + y.size() - 1, T(0));
+        for(std::size_t i = 0; i < x.size(); ++i)
+            for(std::size_t j = 0; j < y.size(); ++j) out[i + j] += x[i] * y[j];
+        return out;
+    };
+    // Одночлен c * x^k (или константа): раскрытие с ним не вычитает близкие числа
+    auto monomial = [](const polynomial &x) {
+        std::size_t terms = 0;
+        for(const T &k : x.coef) terms += !(k == T(0));
+        return terms <= 1;
+    };
+    auto exponent = [&](const instruction &c, std::int32_t &e) {
+        return c.op == op_code::pow && code_[c.b].op == op_code::constant &&
+               small_integer(constants_[code_[c.b].a], e);
+    };
+
+    std::vector<polynomial> poly(n);
+    for(std::size_t i = 0; i < n; ++i) {
+        const instruction &c = code_[i];
+        polynomial &p = poly[i];
+        std::int32_t e = 0;
+        switch(c.op) {
+        case op_code::constant:
+            p = {true, no_var, {constants_[c.a]}};
+            break;
+        case op_code::variable:
+            p = {true, static_cast<std::uint32_t>(i), {T(0), T(1)}};
+            break;
+        case op_code::add:
+        case op_code::sub:
+        case op_code::mul: {
+            const polynomial &x = poly[c.a], &y = poly[c.b];
+            if(!x.valid || !y.valid || !same_var(x, y, p.var)) break;
+            if(c.op == op_code::mul) {
+                // Произведение сумм не раскрывается: у (x - a)^n в одночленах
+                // корень теряется при сокращении больших коэффициентов
+                if(!monomial(x) && !monomial(y)) break;
+                if(x.coef.size() + y.coef.size() - 2 > max_degree) break;
+                p.coef = multiply(x.coef, y.coef);
+            } else {
+                p.coef.assign(std::max(x.coef.size(), y.coef.size()), T(0));
+                for(std::size_t k = 0; k < x.coef.size(); ++k) p.coef[k] += x.coef[k];
+                for(std::size_t k = 0; k < y.coef.size(); ++k)
+                    p.coef[k] = c.op == op_code::add ? p.coef[k] + y.coef[k] : p.coef[k] - y.coef[k];
+            }
+            p.valid = true;
+            break;
+        }
+        case op_code::pow: {
+            const polynomial &x = poly[c.a];
+            if(!x.valid || !monomial(x) || !exponent(c, e) || e < 0 || (x.coef.size() - 1) * e > max_degree) break;
+            p = {true, x.var, {T(1)}};
+            for(std::int32_t k = 0; k < e; ++k) p.coef = multiply(p.coef, x.coef);
+            break;
+        }
+        default:
+            break;
+        }
+        while(p.valid && p.coef.size() > 1 && p.coef.back() == T(0)) p.coef.pop_back();
+    }
+
+    // Горнер выгоден для плотных многочленов; у разреженных (x^10 + 1)
+    // дешевле возвести в степень через powi
+    auto horner = [&](std::size_t i) {
+        const polynomial &p = poly[i];
+        if(!p.valid || p.var == no_var || p.coef.size() < 3) return false;
+        std::size_t terms = 0;
+        for(const T &k : p.coef) terms += !(k == T(0));
+        return terms >= 2 && terms * 2 >= p.coef.size();
+    };
+
+    std::vector<bool> needed(n, false);
+    needed[n - 1] = true;
+    for(std::size_t i = n; i-- > 0;) {
+        if(!needed[i]) continue;
+        const instruction &c = code_[i];
+        std::int32_t e = 0;
+        if(horner(i)) {
+            needed[poly[i].var] = true;
+        } else if(c.op == op_code::constant || c.op == op_code::variable) {
+        } else if(exponent(c, e) || c.op == op_code::powi) {
+            needed[c.a] = true;
+        } else {
+            needed[c.a] = true;
+            if(is_binary(c.op) || c.op == op_code::fma) needed[c.b] = true;
+            if(c.op == op_code::fma) needed[c.c] = true;
+        }
+    }
+
+    compiled_expression result;
+    result.constants_ = constants_;
+    result.names_ = names_;
+    result.slots_ = slots_;
+    result.slot_count_ = slot_count_;
+    auto emit = [&](instruction ins) {
+        result.code_.push_back(ins);
+        return static_cast<std::uint32_t>(result.code_.size() - 1);
+    };
+    auto constant = [&](const T &value) {
+        result.constants_.push_back(value);
+        return emit({op_code::constant, static_cast<std::uint32_t>(result.constants_.size() - 1), 0, 0});
+    };
+
+    std::vector<std::uint32_t> reg(n);
+    for(std::size_t i = 0; i < n; ++i) {
+        if(!needed[i]) continue;
+        instruction c = code_[i];
+        std::int32_t e = 0;
+        if(horner(i)) {
+            const std::vector<T> &coef = poly[i].coef;
+            const std::uint32_t x = reg[poly[i].var];
+            std::uint32_t acc = constant(coef.back());
+            for(std::size_t k = coef.size() - 1; k-- > 0;) {
+                if(coef[k] == T(0)) acc = emit({op_code::mul, acc, x, 0});
+                else acc = emit({op_code::fma, acc, x, constant(coef[k])});
+            }
+            reg[i] = acc;
+            continue;
+        }
+        if(exponent(c, e)) {
+            reg[i] = emit({op_code::powi, reg[c.a], static_cast<std::uint32_t>(e), 0});
+            continue;
+        }
+        if(c.op != op_code::constant && c.op != op_code::variable) {
+            c.a = reg[c.a];
+            if(is_binary(c.op) || c.op == op_code::fma) c.b = reg[c.b];
+            if(c.op == op_code::fma) c.c = reg[c.c];
+        }
+        reg[i] = emit(c);
+    }
+    return result;
+}
+
+// --- Арена выражений ---
+template<typename T>
+typename expression_arena<T>::handle expression_arena<T>::push(node n) {
+    auto key = std::make_pair((static_cast<std::uint64_t>(n.op) << 32) | n.a, n.b);
+    auto it = index_.find(key);
+    if(it != index_.end()) return it->second;
+    handle h = static_cast<handle>(nodes_.size());
+    // Может ли узел бросить при вычислении (потомки уже в массиве)
+    bool fails = false;
+    if(n.op == op_code::div) {
+        fails = !(nodes_[n.b].op == op_code::constant && !zero_divisor(constants_[nodes_[n.b].a])) ||
+                fallible_[n.a] || fallible_[n.b];
+    } else if(n.op == op_code::ln) {
+        fails = nodes_[n.a].op == op_code::constant ? ln_domain_error(constants_[nodes_[n.a].a])
+                                                    : ln_domain_error(T(-1)) || fallible_[n.a];
+    } else if(is_binary(n.op)) {
+        fails = fallible_[n.a] || fallible_[n.b];
+    } else if(n.op != op_code::constant && n.op != op_code::variable) {
+        fails = fallible_[n.a];
+    }
+    nodes_.push_back(n);
+    fallible_.push_back(fails);
+    index_.emplace(key, h);
+    return h;
+}
+
+template<typename T>
+std::uint32_t expression_arena<T>::name_id(const std::string &name) {
+    auto it = name_ids_.find(name);
+    if(it != name_ids_.end()) return it->second;
+    std::uint32_t id = static_cast<std::uint32_t>(names_.size());
+    names_.push_back(name);
+    name_ids_.emplace(name, id);
+    return id;
+}
+
+template<typename T>
+typename expression_arena<T>::handle expression_arena<T>::constant(T value) {
+    const std::size_t h = value_hash(value);
+    auto range = constant_ids_.equal_range(h);
+    for(auto it = range.first; it != range.second; ++it)
+        if(same_value(constants_[it->second], value)) return push({op_code::constant, it->second, 0});
+    std::uint32_t id = static_cast<std::uint32_t>(constants_.size());
+    constants_.push_back(value);
+    constant_ids_.emplace(h, id);
+    return push({op_code::constant, id, 0});
+}
+
+template<typename T>
+typename expression_arena<T>::handle expression_arena<T>::variable(const std::string &name) {
+    return push({op_code::variable, name_id(name), 0});
+}
+
+template<typename T>
+typename expression_arena<T>::handle expression_arena<T>::unary(op_code op, handle child) {
+    return push({op, child, 0});
+}
+
+template<typename T>
+typename expression_arena<T>::handle expression_arena<T>::binary(op_code op, handle left, handle right) {
+    return push({op, left, right});
+}
+
+// Бинарная операция со свёрткой констант и нейтральных элементов; как и в
+// simplify(), поглощающие правила не отбрасывают операнд, который может бросить
+template<typename T>
+typename expression_arena<T>::handle expression_arena<T>::combine(op_code op, handle left, handle right) {
+    auto is_const = [&](handle h) { return nodes_[h].op == op_code::constant; };
+    auto value = [&](handle h) { return constants_[nodes_[h].a]; };
+    auto is_value = [&](handle h, const T &v) { return is_const(h) && value(h) == v; };
+    const bool foldable = is_const(left) && is_const(right);
+    switch(op) {
+    case op_code::add:
+        if(foldable) return constant(value(left) + value(right));
+        if(is_value(left, T(0))) return right;
+        if(is_value(right, T(0))) return left;
+        break;
+    case op_code::sub:
+        if(foldable) return constant(value(left) - value(right));
+        if(is_value(right, T(0))) return left;
+        if(left == right && !fallible_[left]) return constant(T(0));
+        break;
+    case op_code::mul:
+        if(foldable) return constant(value(left) * value(right));
+        if((is_value(left, T(0)) && !fallible_[right]) || (is_value(right, T(0)) && !fallible_[left]))
+            return constant(T(0));
+        if(is_value(left, T(1))) return right;
+        if(is_value(right, T(1))) return left;
+        break;
+    case op_code::div:
+        if(is_value(right, T(0))) break;
+        if(foldable) return constant(value(left) / value(right));
+        if(is_value(right, T(1))) return left;
+        break;
+    case op_code::pow:
+        if(foldable) return constant(math_pow(value(left), value(right)));
+        if(is_value(right, T(0)) && !fallible_[left]) return constant(T(1));
+        if(is_value(right, T(1))) return left;
+        break;
+    default:
+        break;
+    }
+    return binary(op, left, right);
+}
+
+template<typename T>
+typename expression_arena<T>::handle expression_arena<T>::add(const expression<T> &expr) {
+    using node_base = typename expression<T>::node_base;
+    std::unordered_map<const node_base*, handle> done;
+    std::vector<std::pair<const node_base*, bool>> stack{{expr.tree().get(), false}};
+    std::vector<handle> operands;
+    while(!stack.empty()) {
+        auto [current, expanded] = stack.back();
+        stack.pop_back();
+        if(!expanded) {
+            auto it = done.find(current);
+            if(it != done.end()) {
+                operands.push_back(it->second);
+                continue;
+            }
+        }
+        op_code op = current->kind();
+        handle h;
+        if(op == op_code::constant) {
+            h = constant(static_cast<const constant_node<T>*>(current)->value);
+        } else if(op == op_code::variable) {
+            h = variable(static_cast<const variable_node<T>*>(current)->name);
+        } else if(op == op_code::unknown) {
+            if(auto bin = dynamic_cast<const binary_op_node<T>*>(current))
+                throw std::runtime_error("Unknown operator " + bin->op);
+            throw std::runtime_error("Unknown function " + static_cast<const unary_op_node<T>*>(current)->op);
+        } else if(is_binary(op)) {
+            auto bin = static_cast<const binary_op_node<T>*>(current);
+            if(!expanded) {
+                stack.push_back({current, true});
+                stack.push_back({bin->right.get(), false});
+                stack.push_back({bin->left.get(), false});
+                continue;
+            }
+            handle right = operands.back();
+            operands.pop_back();
+            handle left = operands.back();
+            operands.pop_back();
+            h = binary(op, left, right);
+        } else {
+            auto un = static_cast<const unary_op_node<T>*>(current);
+            if(!expanded) {
+                stack.push_back({current, true});
+                stack.push_back({un->child.get(), false});
+                continue;
+            }
+            handle child = operands.back();
+            operands.pop_back();
+            h = unary(op, child);
+        }
+        done.emplace(current, h);
+        operands.push_back(h);
+    }
+    return operands.back();
+}
+
+template<typename T>
+const std::vector<typename expression_arena<T>::handle>& expression_arena<T>::schedule(handle root) const {
+    std::lock_guard<std::mutex> lock(schedule_mutex_);
+    auto it = schedules_.find(root);
+    if(it != schedules_.end()) return it->second;
+    std::vector<bool> reachable(root + 1, false);
+    std::vector<handle> stack{root};
+    reachable[root] = true;
+    while(!stack.empty()) {
+        handle h = stack.back();
+        stack.pop_back();
+        const node &n = nodes_[h];
+        if(n.op == op_code::constant || n.op == op_code::variable) continue;
+        if(!reachable[n.a]) {
+            reachable[n.a] = true;
+            stack.push_back(n.a);
+        }
+        if(is_binary(n.op) && !reachable[n.b]) {
+            reachable[n.b] = true;
+            stack.push_back(n.b);
+        }
+    }
+    std::vector<handle> order;
+    for(handle h = 0; h <= root; ++h)
+        if(reachable[h]) order.push_back(h);
+    return schedules_.emplace(root, std::move(order)).first->second;
+}
+
+// Узлы обходятся по возрастанию индекса: производные потомков уже готовы
+template<typename T>
+typename expression_arena<T>::handle expression_arena<T>::differentiate(handle root, const std::string &var) {
+    const std::vector<handle> order = schedule(root);
+    const handle zero = constant(T(0));
+    const handle one = constant(T(1));
+    auto var_it = name_ids_.find(var);
+    if(var_it == name_ids_.end()) return zero;
+    const std::uint32_t id = var_it->second;
+
+    std::vector<handle> d(root + 1, zero);
+    for(handle h : order) {
+        const node n = nodes_[h];
+        // Узел, не зависящий от var: производная -- ноль без построения
+        // 0 * u и 0 / u, которые combine() не сворачивает для бросающих u
+        if(n.op != op_code::constant && n.op != op_code::variable && d[n.a] == zero &&
+           (!is_binary(n.op) || d[n.b] == zero))
+            continue;
+        switch(n.op) {
+        case op_code::constant:
+            break;
+        case op_code::variable:
+            d[h] = n.a == id ? one : zero;
+            break;
+        case op_code::add:
+        case op_code::sub:
+            d[h] = combine(n.op, d[n.a], d[n.b]);
+            break;
+        case op_code::mul: {
+            handle left = d[n.a] == zero ? zero : combine(op_code::mul, d[n.a], n.b);
+            handle right = d[n.b] == zero ? zero : combine(op_code::mul, n.a, d[n.b]);
+            d[h] = combine(op_code::add, left, right);
+            break;
+        }
+        case op_code::div: {
+            if(d[n.b] == zero) {
+                d[h] = combine(op_code::div, d[n.a], n.b);
+                break;
+            }
+            handle left = d[n.a] == zero ? zero : combine(op_code::mul, d[n.a], n.b);
+            handle numerator = combine(op_code::sub, left, combine(op_code::mul, n.a, d[n.b]));
+            d[h] = combine(op_code::div, numerator, combine(op_code::pow, n.b, constant(T(2))));
+            break;
+        }
+        case op_code::pow:
+            if(nodes_[n.b].op == op_code::constant) {
+                T c = constants_[nodes_[n.b].a];
+                handle u_pow = combine(op_code::pow, n.a, constant(c - T(1)));
+                d[h] = combine(op_code::mul, combine(op_code::mul, n.b, u_pow), d[n.a]);
+            } else if(d[n.b] == zero) {
+                // Показатель не зависит от var: без ln(u)
+                handle u_pow = combine(op_code::pow, n.a, combine(op_code::sub, n.b, one));
+                d[h] = combine(op_code::mul, combine(op_code::mul, n.b, u_pow), d[n.a]);
+            } else {
+                handle term1 = combine(op_code::mul, d[n.b], unary(op_code::ln, n.a));
+                handle term2 = d[n.a] == zero ? zero : combine(op_code::div, combine(op_code::mul, n.b, d[n.a]), n.a);
+                d[h] = combine(op_code::mul, h, combine(op_code::add, term1, term2));
+            }
+            break;
+        case op_code::sin:
+            d[h] = combine(op_code::mul, unary(op_code::cos, n.a), d[n.a]);
+            break;
+        case op_code::cos:
+            d[h] = combine(op_code::mul, combine(op_code::mul, constant(T(-1)), unary(op_code::sin, n.a)), d[n.a]);
+            break;
+        case op_code::ln:
+            d[h] = combine(op_code::div, d[n.a], n.a);
+            break;
+        case op_code::exp:
+            d[h] = combine(op_code::mul, h, d[n.a]);
+            break;
+        default:
+            throw std::runtime_error(std::string("Differentiation not implemented for ") + op_code_name(n.op));
+        }
+    }
+    return d[root];
+}
+
+template<typename T>
+T expression_arena<T>::evaluate(handle root, const T *slots) const {
+    const std::vector<handle> &order = schedule(root);
+    thread_local std::vector<T> values;
+    if(values.size() < root + 1) values.resize(root + 1);
+    T *v = values.data();
+    const node *nodes = nodes_.data();
+    for(handle h : order) {
+        const node &n = nodes[h];
+        switch(n.op) {
+        case op_code::constant: v[h] = constants_[n.a]; break;
+        case op_code::variable: v[h] = slots[n.a]; break;
+        case op_code::add: v[h] = v[n.a] + v[n.b]; break;
+        case op_code::sub: v[h] = v[n.a] - v[n.b]; break;
+        case op_code::mul: v[h] = v[n.a] * v[n.b]; break;
+        case op_code::div:
+            if(zero_divisor(v[n.b])) {
+                std::cout << "Dilinie na nol";
+                throw std::runtime_error("Dilinie na nol");
+            }
+            v[h] = v[n.a] / v[n.b];
+            break;
+        case op_code::pow: v[h] = math_pow(v[n.a], v[n.b]); break;
+        case op_code::sin: v[h] = math_sin(v[n.a]); break;
+        case op_code::cos: v[h] = math_cos(v[n.a]); break;
+        case op_code::ln:
+            if(ln_domain_error(v[n.a])) {
+                std::cout << "Durak, nuthno bolshe nula";
+                throw std::runtime_error("Durak, nuthno bolshe nula");
+            }
+            v[h] = math_log(v[n.a]);
+            break;
+        case op_code::exp: v[h] = math_exp(v[n.a]); break;
+        default:
+            throw std::runtime_error("Unknown instruction");
+        }
+    }
+    return v[root];
+}
+
+template<typename T>
+T expression_arena<T>::evaluate(handle root, const std::map<std::string, T> &variables) const {
+    std::vector<T> slots(names_.size());
+    std::vector<bool> used(names_.size(), false);
+    for(handle h : schedule(root))
+        if(nodes_[h].op == op_code::variable) used[nodes_[h].a] = true;
+    for(std::size_t i = 0; i < names_.size(); ++i) {
+        if(!used[i]) continue;
+        auto it = variables.find(names_[i]);
+        if(it == variables.end()) throw std::runtime_error("Variable " + names_[i] + " not found");
+        slots[i] = it->second;
+    }
+    return evaluate(root, slots.data());
+}
+
+template<typename T>
+expression<T> expression_arena<T>::to_expression(handle root) const {
+    std::unordered_map<handle, std::shared_ptr<typename expression<T>::node_base>> built;
+    for(handle h : schedule(root)) {
+        const node &n = nodes_[h];
+        if(n.op == op_code::constant)
+            built[h] = make_constant<T>(constants_[n.a]);
+        else if(n.op == op_code::variable)
+            built[h] = make_variable<T>(names_[n.a]);
+        else if(is_binary(n.op))
+            built[h] = make_binary_node<T>(op_code_name(n.op), built[n.a], built[n.b]);
+        else
+            built[h] = make_unary_node<T>(op_code_name(n.op), built[n.a]);
+    }
+    return expression<T>(built[root]);
+}
+
+template<typename T>
+void expression_arena<T>::clear() {
+    std::lock_guard<std::mutex> lock(schedule_mutex_);
+    std::vector<node>().swap(nodes_);
+    std::vector<std::uint8_t>().swap(fallible_);
+    std::vector<T>().swap(constants_);
+    std::vector<std::string>().swap(names_);
+    name_ids_.clear();
+    constant_ids_.clear();
+    index_.clear();
+    schedules_.clear();
+}
 
+// Память арены: массив узлов, пул констант и имена; для сравнения -- те же
+// узлы в представлении shared_ptr (по той же оценке, что и metrics())
 template<typename T>
-expression<T> ExpressionParserT<T>::parseExpression() {
-    auto left = parseTerm();
-    skipWhitespace();
-    while (pos < str.size() && (str[pos] == '+' || str[pos] == '-')) {
-        char op = str[pos];
-        ++pos;
-        auto right = parseTerm();
-        if (op == '+')
-            left = left + right;
+arena_memory_report expression_arena<T>::memory_report() const {
+    arena_memory_report report{nodes_.size(), 0, 0, 0, 0};
+    report.arena_bytes = nodes_.size() * (sizeof(node) + sizeof(std::uint8_t)) + constants_.size() * sizeof(T);
+    for(const std::string &name : names_)
+        report.arena_bytes += sizeof(std::string) + (name.capacity() > 15 ? name.capacity() + 1 : 0);
+    for(const node &n : nodes_) {
+        if(n.op == op_code::constant)
+            report.shared_bytes += shared_node_bytes<constant_node<T>>(std::string());
+        else if(n.op == op_code::variable)
+            report.shared_bytes += shared_node_bytes<variable_node<T>>(names_[n.a]);
+        else if(is_binary(n.op))
+            report.shared_bytes += shared_node_bytes<binary_op_node<T>>(op_code_name(n.op));
         else
-            left = left - right;
-        skipWhitespace();
+            report.shared_bytes += shared_node_bytes<unary_op_node<T>>(op_code_name(n.op));
+    }
+    if(report.nodes) {
+        report.arena_bytes_per_node = static_cast<double>(report.arena_bytes) / report.nodes;
+        report.shared_bytes_per_node = static_cast<double>(report.shared_bytes) / report.nodes;
+    }
+    return report;
+}
+
+// --- Генерация C++ кода ---
+template<typename T>
+std::string compiled_expression<T>::emit_cpp(const std::string &name) const {
+    constexpr bool is_real = std::is_same<T, double>::value;
+    constexpr bool is_complex = std::is_same<T, std::complex<double>>::value;
+    if constexpr (!is_real && !is_complex) {
+        (void)name;
+        throw std::runtime_error("emit_cpp is supported only for double and complex<double>");
+    } else {
+        const char *type = is_real ? "double" : "std::complex<double>";
+        // Бесконечности и NaN -- через numeric_limits: "inf" и "nan" не литералы C++
+        auto real_literal = [](double value) {
+            if(std::isnan(value)) return std::string("std::numeric_limits<double>::quiet_NaN()");
+            if(std::isinf(value))
+                return std::string(value < 0 ? "-" : "") + "std::numeric_limits<double>::infinity()";
+            std::ostringstream oss;
+            oss << std::hexfloat << value;
+            return oss.str();
+        };
+        auto literal = [&](const T &value) {
+            if constexpr (is_real)
+                return real_literal(value);
+            else
+                return "std::complex<double>(" + real_literal(value.real()) + ", " + real_literal(value.imag()) + ")";
+        };
+        // Тело цикла: по одной константе на инструкцию; load -- чтение переменной
+        auto body = [&](std::ostringstream &out, const std::string &indent, const std::string &fail,
+                        auto load) {
+            for(std::size_t i = 0; i < code_.size(); ++i) {
+                const instruction &c = code_[i];
+                const std::string a = "r" + std::to_string(c.a), b = "r" + std::to_string(c.b);
+                if(c.op == op_code::div)
+                    out << indent << "if (" << b << " == " << type << "(0)) " << fail << "1;\n";
+                if constexpr (is_real) {
+                    if(c.op == op_code::ln)
+                        out << indent << "if (" << a << " <= 0.0) " << fail << "2;\n";
+                }
+                out << indent << "const " << type << " r" << i << " = ";
+                switch(c.op) {
+                case op_code::constant: out << literal(constants_[c.a]); break;
+                case op_code::variable: out << load(c.a); break;
+                case op_code::add: out << a << " + " << b; break;
+                case op_code::sub: out << a << " - " << b; break;
+                case op_code::mul: out << a << " * " << b; break;
+                case op_code::div: out << a << " / " << b; break;
+                case op_code::pow: out << "std::pow(" << a << ", " << b << ")"; break;
+                case op_code::sin: out << "std::sin(" << a << ")"; break;
+                case op_code::cos: out << "std::cos(" << a << ")"; break;
+                case op_code::ln: out << "std::log(" << a << ")"; break;
+                case op_code::exp: out << "std::exp(" << a << ")"; break;
+                case op_code::powi:
+                    out << "differ_powi(" << a << ", " << static_cast<std::int32_t>(c.b) << ")";
+                    break;
+                case op_code::fma: out << "differ_fma(" << a << ", " << b << ", r" << c.c << ")"; break;
+                default: throw std::runtime_error("Unknown instruction");
+                }
+                out << ";\n";
+            }
+        };
+        const std::string result = "r" + std::to_string(code_.size() - 1);
+        std::ostringstream out;
+        out << "// generated by Differ\n"
+            << "#include <cmath>\n#include <complex>\n#include <cstddef>\n#include <limits>\n\n"
+            << "template<typename T>\n"
+            << "static inline T differ_powi(T x, int n) {\n"
+            << "    unsigned m = n < 0 ? 0u - unsigned(n) : unsigned(n);\n"
+            << "    T r = T(1);\n"
+            << "    for (; m; m >>= 1) {\n"
+            << "        if (m & 1) r *= x;\n"
+            << "        if (m > 1) x *= x;\n"
+            << "    }\n"
+            << "    return n < 0 ? T(1) / r : r;\n"
+            << "}\n"
+            << "static inline double differ_fma(double a, double b, double c) {\n"
+            << "#ifdef FP_FAST_FMA\n    return std::fma(a, b, c);\n#else\n    return a * b + c;\n#endif\n"
+            << "}\n"
+            << "static inline std::complex<double> differ_fma(std::complex<double> a, std::complex<double> b,\n"
+            << "                                              std::complex<double> c) {\n"
+            << "    return a * b + c;\n"
+            << "}\n\n";
+        for(std::size_t i = 0; i < names_.size(); ++i)
+            out << "// slot " << slots_[i] << ": " << names_[i] << "\n";
+        out << "extern \"C\" const std::size_t " << name << "_slot_count = " << slot_count_ << ";\n\n";
+
+        out << "extern \"C\" int " << name << "(const " << type << " *slots, " << type << " *out) {\n";
+        body(out, "    ", "return ", [](std::uint32_t slot) { return "slots[" + std::to_string(slot) + "]"; });
+        out << "    *out = " << result << ";\n    return 0;\n}\n\n";
+
+        out << "extern \"C\" int " << name << "_batch(const " << type << " *const *columns, " << type
+            << " *out, std::size_t count) {\n"
+            << "    for (std::size_t i = 0; i < count; ++i) {\n";
+        body(out, "        ", "return ", [](std::uint32_t slot) {
+            return "columns[" + std::to_string(slot) + "][i]";
+        });
+        out << "        out[i] = " << result << ";\n    }\n    return 0;\n}\n";
+        return out.str();
+    }
+}
+
+template<typename T>
+std::string expression<T>::emit_cpp(const std::string &name) const {
+    return compile().emit_cpp(name);
+}
+
+// --- Обратный режим автоматического дифференцирования ---
+template<typename T>
+T compiled_expression<T>::gradient(const T *slots, T *grad) const {
+    const std::size_t n = code_.size();
+    thread_local std::vector<T> regs;
+    thread_local std::vector<T> adjoint;
+    thread_local std::vector<std::uint8_t> varies;
+    if(regs.size() < n) regs.resize(n);
+    adjoint.assign(n, T(0));
+    T *r = regs.data();
+    T *adj = adjoint.data();
+    const T value = evaluate(slots, r);
+
+    // Зависит ли регистр от переменных: показатель вида 1 + 1 постоянен,
+    // хотя и не является инструкцией constant
+    varies.assign(n, 0);
+    for(std::size_t i = 0; i < n; ++i) {
+        const instruction &c = code_[i];
+        if(c.op == op_code::constant) continue;
+        if(c.op == op_code::variable) {
+            varies[i] = 1;
+            continue;
+        }
+        varies[i] = varies[c.a];
+        if(is_binary(c.op) || c.op == op_code::fma) varies[i] |= varies[c.b];
+        if(c.op == op_code::fma) varies[i] |= varies[c.c];
+    }
+
+    std::fill_n(grad, slot_count_, T(0));
+    adj[n - 1] = T(1);
+    for(std::size_t i = n; i-- > 0;) {
+        const instruction &c = code_[i];
+        const T g = adj[i];
+        switch(c.op) {
+        case op_code::constant:
+            break;
+        case op_code::variable:
+            grad[c.a] += g;
+            break;
+        case op_code::add:
+            adj[c.a] += g;
+            adj[c.b] += g;
+            break;
+        case op_code::sub:
+            adj[c.a] += g;
+            adj[c.b] -= g;
+            break;
+        case op_code::mul:
+            adj[c.a] += g * r[c.b];
+            adj[c.b] += g * r[c.a];
+            break;
+        case op_code::div:
+            adj[c.a] += g / r[c.b];
+            adj[c.b] -= g * r[i] / r[c.b];
+            break;
+        case op_code::pow:
+            adj[c.a] += g * r[c.b] * math_pow(r[c.a], r[c.b] - T(1));
+            // Производная по показателю нужна, только если он зависит от переменных
+            if(varies[c.b]) {
+                if(ln_domain_error(r[c.a])) {
+                    std::cout << "Durak, nuthno bolshe nula";
+                    throw std::runtime_error("Durak, nuthno bolshe nula");
+                }
+                adj[c.b] += g * r[i] * math_log(r[c.a]);
+            }
+            break;
+        case op_code::sin:
+            adj[c.a] += g * math_cos(r[c.a]);
+            break;
+        case op_code::cos:
+            adj[c.a] -= g * math_sin(r[c.a]);
+            break;
+        case op_code::ln:
+            adj[c.a] += g / r[c.a];
+            break;
+        case op_code::exp:
+            adj[c.a] += g * r[i];
+            break;
+        case op_code::powi: {
+            const std::int32_t e = static_cast<std::int32_t>(c.b);
+            adj[c.a] += g * T(e) * math_powi(r[c.a], e - 1);
+            break;
+        }
+        case op_code::fma:
+            adj[c.a] += g * r[c.b];
+            adj[c.b] += g * r[c.a];
+            adj[c.c] += g;
+            break;
+        default:
+            throw std::runtime_error("Unknown instruction");
+        }
+    }
+    return value;
+}
+
+template<typename T>
+std::map<std::string, T> gradient(const expression<T> &expr, const std::map<std::string, T> &bindings) {
+    auto program = expr.compile();
+    std::vector<T> values(program.slot_count());
+    for(std::size_t i = 0; i < program.variables().size(); ++i) {
+        auto it = bindings.find(program.variables()[i]);
+        if(it == bindings.end()) throw std::runtime_error("Variable " + program.variables()[i] + " not found");
+        values[program.slots()[i]] = it->second;
+    }
+    std::vector<T> grad(program.slot_count());
+    program.gradient(values.data(), grad.data());
+    std::map<std::string, T> result;
+    for(std::size_t i = 0; i < program.variables().size(); ++i)
+        result[program.variables()[i]] = grad[program.slots()[i]];
+    return result;
+}
+
+// --- SIMD-ядра пакетного вычисления для double и float ---
+namespace {
+
+// Размер порции строк, которая обрабатывается за один проход по ленте
+constexpr std::size_t batch_chunk = 256;
+
+template<typename U>
+struct simd_kernels {
+    using binary_kernel = void (*)(const U*, const U*, U*, std::size_t);
+    using zero_check = bool (*)(const U*, std::size_t);
+    binary_kernel add;
+    binary_kernel sub;
+    binary_kernel mul;
+    binary_kernel div;
+    zero_check has_zero;
+};
+
+#define DIFFER_SCALAR_KERNEL(name, expr)                                             \
+    template<typename U>                                                             \
+    void name(const U *a, const U *b, U *out, std::size_t n) {                       \
+        for(std::size_t i = 0; i < n; ++i) out[i] = expr;                            \
+    }
+
+DIFFER_SCALAR_KERNEL(add_scalar, a[i] + b[i])
+DIFFER_SCALAR_KERNEL(sub_scalar, a[i] - b[i])
+DIFFER_SCALAR_KERNEL(mul_scalar, a[i] * b[i])
+DIFFER_SCALAR_KERNEL(div_scalar, a[i] / b[i])
+
+template<typename U>
+bool has_zero_scalar(const U *a, std::size_t n) {
+    for(std::size_t i = 0; i < n; ++i)
+        if(a[i] == U(0)) return true;
+    return false;
+}
+
+#ifdef DIFFER_X86_SIMD
+
+// Ядро бинарной операции: основной цикл по векторам ширины width, хвост -- скалярно
+#define DIFFER_SIMD_KERNEL(name, isa, type, vec, width, load, store, vop, sop)       \
+    __attribute__((target(isa)))                                                     \
+    void name(const type *a, const type *b, type *out, std::size_t n) {              \
+        std::size_t i = 0;                                                           \
+        for(; i + width <= n; i += width) {                                          \
+            vec x = load(a + i);                                                     \
+            vec y = load(b + i);                                                     \
+            store(out + i, vop(x, y));                                               \
+        }                                                                            \
+        for(; i < n; ++i) out[i] = a[i] sop b[i];                                    \
+    }
+
+DIFFER_SIMD_KERNEL(add_sse2, "sse2", double, __m128d, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_add_pd, +)
+DIFFER_SIMD_KERNEL(sub_sse2, "sse2", double, __m128d, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_sub_pd, -)
+DIFFER_SIMD_KERNEL(mul_sse2, "sse2", double, __m128d, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_mul_pd, *)
+DIFFER_SIMD_KERNEL(div_sse2, "sse2", double, __m128d, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_div_pd, /)
+
+DIFFER_SIMD_KERNEL(add_avx2, "avx2", double, __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_add_pd, +)
+DIFFER_SIMD_KERNEL(sub_avx2, "avx2", double, __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_sub_pd, -)
+DIFFER_SIMD_KERNEL(mul_avx2, "avx2", double, __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_mul_pd, *)
+DIFFER_SIMD_KERNEL(div_avx2, "avx2", double, __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_div_pd, /)
+
+DIFFER_SIMD_KERNEL(add_avx512, "avx512f", double, __m512d, 8, _mm512_loadu_pd, _mm512_storeu_pd, _mm512_add_pd, +)
+DIFFER_SIMD_KERNEL(sub_avx512, "avx512f", double, __m512d, 8, _mm512_loadu_pd, _mm512_storeu_pd, _mm512_sub_pd, -)
+DIFFER_SIMD_KERNEL(mul_avx512, "avx512f", double, __m512d, 8, _mm512_loadu_pd, _mm512_storeu_pd, _mm512_mul_pd, *)
+DIFFER_SIMD_KERNEL(div_avx512, "avx512f", double, __m512d, 8, _mm512_loadu_pd, _mm512_storeu_pd, _mm512_div_pd, /)
+
+// float: вдвое больше элементов в том же регистре
+DIFFER_SIMD_KERNEL(add_sse2_f, "sse2", float, __m128, 4, _mm_loadu_ps, _mm_storeu_ps, _mm_add_ps, +)
+DIFFER_SIMD_KERNEL(sub_sse2_f, "sse2", float, __m128, 4, _mm_loadu_ps, _mm_storeu_ps, _mm_sub_ps, -)
+DIFFER_SIMD_KERNEL(mul_sse2_f, "sse2", float, __m128, 4, _mm_loadu_ps, _mm_storeu_ps, _mm_mul_ps, *)
+DIFFER_SIMD_KERNEL(div_sse2_f, "sse2", float, __m128, 4, _mm_loadu_ps, _mm_storeu_ps, _mm_div_ps, /)
+
+DIFFER_SIMD_KERNEL(add_avx2_f, "avx2", float, __m256, 8, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_add_ps, +)
+DIFFER_SIMD_KERNEL(sub_avx2_f, "avx2", float, __m256, 8, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_sub_ps, -)
+DIFFER_SIMD_KERNEL(mul_avx2_f, "avx2", float, __m256, 8, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_mul_ps, *)
+DIFFER_SIMD_KERNEL(div_avx2_f, "avx2", float, __m256, 8, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_div_ps, /)
+
+DIFFER_SIMD_KERNEL(add_avx512_f, "avx512f", float, __m512, 16, _mm512_loadu_ps, _mm512_storeu_ps, _mm512_add_ps, +)
+DIFFER_SIMD_KERNEL(sub_avx512_f, "avx512f", float, __m512, 16, _mm512_loadu_ps, _mm512_storeu_ps, _mm512_sub_ps, -)
+DIFFER_SIMD_KERNEL(mul_avx512_f, "avx512f", float, __m512, 16, _mm512_loadu_ps, _mm512_storeu_ps, _mm512_mul_ps, *)
+DIFFER_SIMD_KERNEL(div_avx512_f, "avx512f", float, __m512, 16, _mm512_loadu_ps, _mm512_storeu_ps, _mm512_div_ps, /)
+
+#undef DIFFER_SIMD_KERNEL
+
+__attribute__((target("sse2")))
+bool has_zero_sse2(const double *a, std::size_t n) {
+    std::size_t i = 0;
+    const __m128d zero = _mm_setzero_pd();
+    for(; i + 2 <= n; i += 2)
+        if(_mm_movemask_pd(_mm_cmpeq_pd(_mm_loadu_pd(a + i), zero))) return true;
+    return has_zero_scalar(a + i, n - i);
+}
+
+__attribute__((target("avx2")))
+bool has_zero_avx2(const double *a, std::size_t n) {
+    std::size_t i = 0;
+    const __m256d zero = _mm256_setzero_pd();
+    for(; i + 4 <= n; i += 4)
+        if(_mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(a + i), zero, _CMP_EQ_OQ))) return true;
+    return has_zero_scalar(a + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+bool has_zero_avx512(const double *a, std::size_t n) {
+    std::size_t i = 0;
+    const __m512d zero = _mm512_setzero_pd();
+    for(; i + 8 <= n; i += 8)
+        if(_mm512_cmp_pd_mask(_mm512_loadu_pd(a + i), zero, _CMP_EQ_OQ)) return true;
+    return has_zero_scalar(a + i, n - i);
+}
+
+__attribute__((target("sse2")))
+bool has_zero_sse2_f(const float *a, std::size_t n) {
+    std::size_t i = 0;
+    const __m128 zero = _mm_setzero_ps();
+    for(; i + 4 <= n; i += 4)
+        if(_mm_movemask_ps(_mm_cmpeq_ps(_mm_loadu_ps(a + i), zero))) return true;
+    return has_zero_scalar(a + i, n - i);
+}
+
+__attribute__((target("avx2")))
+bool has_zero_avx2_f(const float *a, std::size_t n) {
+    std::size_t i = 0;
+    const __m256 zero = _mm256_setzero_ps();
+    for(; i + 8 <= n; i += 8)
+        if(_mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(a + i), zero, _CMP_EQ_OQ))) return true;
+    return has_zero_scalar(a + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+bool has_zero_avx512_f(const float *a, std::size_t n) {
+    std::size_t i = 0;
+    const __m512 zero = _mm512_setzero_ps();
+    for(; i + 16 <= n; i += 16)
+        if(_mm512_cmp_ps_mask(_mm512_loadu_ps(a + i), zero, _CMP_EQ_OQ)) return true;
+    return has_zero_scalar(a + i, n - i);
+}
+
+#endif // DIFFER_X86_SIMD
+
+#undef DIFFER_SCALAR_KERNEL
+
+// Ядра уровня level (не выше доступного) для double и float
+template<typename U>
+const simd_kernels<U>& kernels_for(simd_level level) {
+    static const simd_kernels<U> scalar{add_scalar<U>, sub_scalar<U>, mul_scalar<U>, div_scalar<U>,
+                                        has_zero_scalar<U>};
+#ifdef DIFFER_X86_SIMD
+    static const simd_level best = detect_simd_level();
+    if(level > best) level = best;
+    if constexpr (std::is_same<U, double>::value) {
+        static const simd_kernels<U> sse2{add_sse2, sub_sse2, mul_sse2, div_sse2, has_zero_sse2};
+        static const simd_kernels<U> avx2{add_avx2, sub_avx2, mul_avx2, div_avx2, has_zero_avx2};
+        static const simd_kernels<U> avx512{add_avx512, sub_avx512, mul_avx512, div_avx512, has_zero_avx512};
+        switch(level) {
+        case simd_level::avx512: return avx512;
+        case simd_level::avx2: return avx2;
+        case simd_level::sse2: return sse2;
+        default: break;
+        }
+    } else {
+        static const simd_kernels<U> sse2{add_sse2_f, sub_sse2_f, mul_sse2_f, div_sse2_f, has_zero_sse2_f};
+        static const simd_kernels<U> avx2{add_avx2_f, sub_avx2_f, mul_avx2_f, div_avx2_f, has_zero_avx2_f};
+        static const simd_kernels<U> avx512{add_avx512_f, sub_avx512_f, mul_avx512_f, div_avx512_f,
+                                            has_zero_avx512_f};
+        switch(level) {
+        case simd_level::avx512: return avx512;
+        case simd_level::avx2: return avx2;
+        case simd_level::sse2: return sse2;
+        default: break;
+        }
+    }
+#else
+    (void)level;
+#endif
+    return scalar;
+}
+
+// Поэлементные операции над порцией строк
+template<typename T>
+void batch_binary(op_code op, const T *a, const T *b, T *out, std::size_t n, simd_level level) {
+    if constexpr (std::is_same<T, double>::value || std::is_same<T, float>::value) {
+        const simd_kernels<T> &k = kernels_for<T>(level);
+        switch(op) {
+        case op_code::add: k.add(a, b, out, n); return;
+        case op_code::sub: k.sub(a, b, out, n); return;
+        case op_code::mul: k.mul(a, b, out, n); return;
+        case op_code::div:
+            if(k.has_zero(b, n)) {
+                std::cout << "Dilinie na nol";
+                throw std::runtime_error("Dilinie na nol");
+            }
+            k.div(a, b, out, n);
+            return;
+        default: break;
+        }
+    } else {
+        (void)level;
+        switch(op) {
+        case op_code::add: for(std::size_t i = 0; i < n; ++i) out[i] = a[i] + b[i]; return;
+        case op_code::sub: for(std::size_t i = 0; i < n; ++i) out[i] = a[i] - b[i]; return;
+        case op_code::mul: for(std::size_t i = 0; i < n; ++i) out[i] = a[i] * b[i]; return;
+        case op_code::div:
+            for(std::size_t i = 0; i < n; ++i) {
+                if(zero_divisor(b[i])) {
+                    std::cout << "Dilinie na nol";
+                    throw std::runtime_error("Dilinie na nol");
+                }
+            }
+            for(std::size_t i = 0; i < n; ++i) out[i] = a[i] / b[i];
+            return;
+        default: break;
+        }
+    }
+    // Возведение в степень: векторного pow в стандартной библиотеке нет,
+    // поэтому вызываем std::pow по элементам -- результат совпадает со скалярным
+    for(std::size_t i = 0; i < n; ++i) out[i] = math_pow(a[i], b[i]);
+}
+
+template<typename T>
+void batch_unary(op_code op, const T *a, T *out, std::size_t n) {
+    switch(op) {
+    case op_code::sin: for(std::size_t i = 0; i < n; ++i) out[i] = math_sin(a[i]); return;
+    case op_code::cos: for(std::size_t i = 0; i < n; ++i) out[i] = math_cos(a[i]); return;
+    case op_code::ln:
+        for(std::size_t i = 0; i < n; ++i) {
+            if(ln_domain_error(a[i])) {
+                std::cout << "Durak, nuthno bolshe nula";
+                throw std::runtime_error("Durak, nuthno bolshe nula");
+            }
+        }
+        for(std::size_t i = 0; i < n; ++i) out[i] = math_log(a[i]);
+        return;
+    default:
+        for(std::size_t i = 0; i < n; ++i) out[i] = math_exp(a[i]);
+        return;
+    }
+}
+
+// Степень по битам показателя; внутренние циклы по строкам векторизуются
+template<typename T>
+void batch_powi(const T *a, std::int32_t e, T *out, std::size_t n) {
+    T square[batch_chunk];
+    std::copy_n(a, n, square);
+    std::fill_n(out, n, T(1));
+    std::uint32_t m = e < 0 ? 0u - static_cast<std::uint32_t>(e) : static_cast<std::uint32_t>(e);
+    for(; m; m >>= 1) {
+        if(m & 1)
+            for(std::size_t i = 0; i < n; ++i) out[i] *= square[i];
+        if(m > 1)
+            for(std::size_t i = 0; i < n; ++i) square[i] *= square[i];
+    }
+    if(e < 0)
+        for(std::size_t i = 0; i < n; ++i) out[i] = T(1) / out[i];
+}
+
+template<typename T>
+void batch_fma(const T *a, const T *b, const T *c, T *out, std::size_t n) {
+    for(std::size_t i = 0; i < n; ++i) out[i] = multiply_add(a[i], b[i], c[i]);
+}
+
+} // namespace
+
+// --- Общий шаг ленты для других вычислителей ---
+template<typename T>
+T tape_apply(op_code op, const T &x, const T &y, const T &z, std::int32_t exponent) {
+    switch(op) {
+    case op_code::add: return x + y;
+    case op_code::sub: return x - y;
+    case op_code::mul: return x * y;
+    case op_code::div:
+        if(zero_divisor(y)) throw std::runtime_error("Dilinie na nol");
+        return x / y;
+    case op_code::pow: return math_pow(x, y);
+    case op_code::sin: return math_sin(x);
+    case op_code::cos: return math_cos(x);
+    case op_code::ln:
+        if(ln_domain_error(x)) throw std::runtime_error("Durak, nuthno bolshe nula");
+        return math_log(x);
+    case op_code::exp: return math_exp(x);
+    case op_code::powi: return math_powi(x, exponent);
+    case op_code::fma: return multiply_add(x, y, z);
+    default: throw std::runtime_error("Unknown instruction");
+    }
+}
+
+template<typename T>
+T tape_step(op_code op, std::uint32_t a, std::uint32_t b, std::uint32_t c, const T *regs) {
+    const T &x = regs[a];
+    if(op == op_code::powi) return math_powi(x, static_cast<std::int32_t>(b));
+    if(is_binary(op)) return tape_apply(op, x, regs[b], x, 0);
+    if(op == op_code::fma) return tape_apply(op, x, regs[b], regs[c], 0);
+    return tape_apply(op, x, x, x, 0);
+}
+
+// Порциями по batch_chunk через те же ядра, что у evaluate_batch
+template<typename T>
+void tape_step_lanes(op_code op, std::uint32_t a, std::uint32_t b, std::uint32_t c, const T *const *lanes, T *out,
+                     std::size_t len, bool check_domain) {
+    static const simd_level best = detect_simd_level();
+    for(std::size_t start = 0; start < len; start += batch_chunk) {
+        const std::size_t n = std::min(batch_chunk, len - start);
+        const T *x = lanes[a] + start;
+        T *r = out + start;
+        switch(op) {
+        case op_code::add: case op_code::sub: case op_code::mul: case op_code::pow:
+            batch_binary(op, x, lanes[b] + start, r, n, best);
+            break;
+        case op_code::div: {
+            const T *y = lanes[b] + start;
+            if(check_domain)
+                for(std::size_t i = 0; i < n; ++i)
+                    if(zero_divisor(y[i])) throw std::runtime_error("Dilinie na nol");
+            if constexpr (std::is_same<T, double>::value || std::is_same<T, float>::value)
+                kernels_for<T>(best).div(x, y, r, n);
+            else
+                for(std::size_t i = 0; i < n; ++i) r[i] = x[i] / y[i];
+            break;
+        }
+        case op_code::ln:
+            if(check_domain)
+                for(std::size_t i = 0; i < n; ++i)
+                    if(ln_domain_error(x[i])) throw std::runtime_error("Durak, nuthno bolshe nula");
+            for(std::size_t i = 0; i < n; ++i) r[i] = math_log(x[i]);
+            break;
+        case op_code::sin: case op_code::cos: case op_code::exp:
+            batch_unary(op, x, r, n);
+            break;
+        case op_code::powi:
+            batch_powi(x, static_cast<std::int32_t>(b), r, n);
+            break;
+        case op_code::fma:
+            batch_fma(x, lanes[b] + start, lanes[c] + start, r, n);
+            break;
+        default:
+            throw std::runtime_error("Unknown instruction");
+        }
+    }
+}
+
+simd_level detect_simd_level() {
+#ifdef DIFFER_X86_SIMD
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f")) return simd_level::avx512;
+    if(__builtin_cpu_supports("avx2")) return simd_level::avx2;
+    if(__builtin_cpu_supports("sse2")) return simd_level::sse2;
+#endif
+    return simd_level::scalar;
+}
+
+const char* simd_level_name(simd_level level) {
+    switch(level) {
+    case simd_level::sse2: return "sse2";
+    case simd_level::avx2: return "avx2";
+    case simd_level::avx512: return "avx512";
+    default: return "scalar";
+    }
+}
+
+template<typename T>
+void compiled_expression<T>::evaluate_batch(const T *const *columns, T *out, std::size_t count) const {
+    static const simd_level best = detect_simd_level();
+    evaluate_batch(columns, out, count, best);
+}
+
+// Лента проходится по порциям из batch_chunk строк: регистр каждой
+// инструкции -- массив на всю порцию. Константы заполняются один раз,
+// переменные читаются прямо из входных столбцов без копирования.
+template<typename T>
+void compiled_expression<T>::evaluate_batch(const T *const *columns, T *out, std::size_t count,
+                                            simd_level level) const {
+    DIFFER_TIMER(evaluate);
+    record_tape_visits(code_, count);
+    const std::size_t n = code_.size();
+    thread_local std::vector<T> regs;
+    thread_local std::vector<const T*> lanes;
+    if(regs.size() < n * batch_chunk) regs.resize(n * batch_chunk);
+    if(lanes.size() < n) lanes.resize(n);
+
+    for(std::size_t i = 0; i < n; ++i) {
+        if(code_[i].op == op_code::constant)
+            std::fill_n(regs.data() + i * batch_chunk, batch_chunk, constants_[code_[i].a]);
+        lanes[i] = regs.data() + i * batch_chunk;
+    }
+
+    for(std::size_t start = 0; start < count; start += batch_chunk) {
+        const std::size_t len = std::min(batch_chunk, count - start);
+        for(std::size_t i = 0; i < n; ++i) {
+            const instruction &c = code_[i];
+            T *r = regs.data() + i * batch_chunk;
+            if(c.op == op_code::constant) continue;
+            if(c.op == op_code::variable) {
+                lanes[i] = columns[c.a] + start;
+                continue;
+            }
+            if(is_binary(c.op))
+                batch_binary(c.op, lanes[c.a], lanes[c.b], r, len, level);
+            else if(c.op == op_code::powi)
+                batch_powi(lanes[c.a], static_cast<std::int32_t>(c.b), r, len);
+            else if(c.op == op_code::fma)
+                batch_fma(lanes[c.a], lanes[c.b], lanes[c.c], r, len);
+            else
+                batch_unary(c.op, lanes[c.a], r, len);
+        }
+        std::copy_n(lanes[n - 1], len, out + start);
     }
-    return left;
+}
+
+// --- Двоичный формат ---
+// Код типа значения в заголовке: файл одного типа не читается как другой
+template<typename U> constexpr std::uint32_t scalar_code() { return 0; }
+template<> constexpr std::uint32_t scalar_code<double>() { return 1; }
+template<> constexpr std::uint32_t scalar_code<std::complex<double>>() { return 2; }
+template<> constexpr std::uint32_t scalar_code<dual<double>>() { return 3; }
+template<> constexpr std::uint32_t scalar_code<dual<std::complex<double>>>() { return 4; }
+template<> constexpr std::uint32_t scalar_code<float>() { return 5; }
+template<> constexpr std::uint32_t scalar_code<long double>() { return 6; }
+template<> constexpr std::uint32_t scalar_code<std::complex<float>>() { return 7; }
+
+constexpr std::size_t binary_align(std::size_t size) {
+    return (size + 7) & ~std::size_t(7);
+}
+
+// Размещение разделов файла по заголовку. Каждый раздел сравнивается с
+// остатком до limit (размера файла), поэтому подобранные счётчики в
+// заголовке не переполняют сумму смещений; fits == false -- не помещаются.
+struct binary_layout {
+    std::size_t constants = 0;
+    std::size_t nodes = 0;
+    std::size_t offsets = 0;
+    std::size_t slots = 0;
+    std::size_t names = 0;
+    std::size_t end = sizeof(binary_header);
+    bool fits = true;
+
+    binary_layout(const binary_header &h, std::size_t limit = std::numeric_limits<std::size_t>::max()) {
+        const std::uint64_t slot_count = h.kind == binary_kind::program ? h.name_count : 0;
+        place(constants, h.constant_count, h.scalar_size, limit);
+        place(nodes, h.node_count, sizeof(binary_record), limit);
+        place(offsets, std::uint64_t(h.name_count) + 1, sizeof(std::uint32_t), limit);
+        place(slots, slot_count, sizeof(std::uint32_t), limit);
+        place(names, h.names_bytes, 1, limit);
+    }
+
+private:
+    // Раздел из count элементов по item байт с начала, выровненного на 8
+    void place(std::size_t &start, std::uint64_t count, std::size_t item, std::size_t limit) {
+        if(!fits) return;
+        const std::size_t pad = (8 - end % 8) % 8;
+        if(end > limit || pad > limit - end) {
+            fits = false;
+            return;
+        }
+        start = end + pad;
+        if(item != 0 && count > (limit - start) / item) {
+            fits = false;
+            return;
+        }
+        end = start + static_cast<std::size_t>(count) * item;
+    }
+};
+
+[[noreturn]] void binary_error(const std::string &path, const std::string &what) {
+    throw std::runtime_error("Invalid binary file " + path + ": " + what);
+}
+
+// Сборка файла в памяти и запись одним вызовом
+template<typename T>
+void write_binary(const std::string &path, binary_kind kind, const std::vector<T> &constants,
+                  const std::vector<binary_record> &nodes, const std::vector<std::string> &names,
+                  const std::vector<std::uint32_t> &slots, std::size_t slot_count) {
+    if constexpr (!std::is_trivially_copyable<T>::value || scalar_code<T>() == 0) {
+        (void)constants;
+        (void)nodes;
+        (void)names;
+        (void)slots;
+        (void)slot_count;
+        binary_error(path, "unsupported value type");
+    } else {
+        binary_header h{};
+        std::memcpy(h.magic, "DIFFBIN", 8);
+        h.version = binary_version;
+        h.kind = kind;
+        h.scalar = scalar_code<T>();
+        h.scalar_size = sizeof(T);
+        h.node_count = static_cast<std::uint32_t>(nodes.size());
+        h.constant_count = static_cast<std::uint32_t>(constants.size());
+        h.name_count = static_cast<std::uint32_t>(names.size());
+        h.slot_count = static_cast<std::uint32_t>(slot_count);
+        std::vector<std::uint32_t> offsets{0};
+        for(const std::string &name : names) {
+            h.names_bytes += name.size();
+            offsets.push_back(static_cast<std::uint32_t>(h.names_bytes));
+        }
+        const binary_layout layout(h);
+        std::string buffer(layout.end, '\0');
+        std::memcpy(&buffer[0], &h, sizeof(h));
+        if(!constants.empty()) std::memcpy(&buffer[layout.constants], constants.data(), constants.size() * sizeof(T));
+        if(!nodes.empty()) std::memcpy(&buffer[layout.nodes], nodes.data(), nodes.size() * sizeof(binary_record));
+        std::memcpy(&buffer[layout.offsets], offsets.data(), offsets.size() * sizeof(std::uint32_t));
+        if(kind == binary_kind::program && !slots.empty())
+            std::memcpy(&buffer[layout.slots], slots.data(), slots.size() * sizeof(std::uint32_t));
+        for(std::size_t i = 0; i < names.size(); ++i)
+            std::memcpy(&buffer[layout.names + offsets[i]], names[i].data(), names[i].size());
+
+        std::unique_ptr<std::FILE, int (*)(std::FILE*)> file(std::fopen(path.c_str(), "wb"), std::fclose);
+        if(!file || std::fwrite(buffer.data(), 1, buffer.size(), file.get()) != buffer.size())
+            throw std::runtime_error("Cannot write " + path);
+    }
+}
+
+// Файл, отображённый в память только для чтения; заголовок и границы
+// разделов проверяются при открытии
+class binary_file {
+public:
+    binary_file(const std::string &path, binary_kind kind, std::uint32_t scalar, std::uint32_t scalar_size)
+        : path_(path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0) throw std::runtime_error("Cannot open " + path);
+        struct stat info;
+        if(::fstat(fd, &info) != 0) {
+            ::close(fd);
+            throw std::runtime_error("Cannot open " + path);
+        }
+        size_ = static_cast<std::size_t>(info.st_size);
+        if(size_ >= sizeof(binary_header)) {
+            data_ = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(data_ == MAP_FAILED) data_ = nullptr;
+        }
+        ::close(fd);
+        if(!data_) binary_error(path, "too short");
+
+        std::memcpy(&header_, data_, sizeof(header_));
+        if(std::memcmp(header_.magic, "DIFFBIN", 8) != 0) fail("bad magic");
+        if(header_.version != binary_version) fail("unsupported version " + std::to_string(header_.version));
+        if(header_.kind != kind) fail("wrong kind");
+        if(header_.scalar != scalar || header_.scalar_size != scalar_size) fail("wrong value type");
+        if(header_.node_count == 0) fail("empty node table");
+        layout_ = binary_layout(header_, size_);
+        if(!layout_.fits) fail("truncated");
+        const std::uint32_t *offsets = section<std::uint32_t>(layout_.offsets);
+        for(std::uint32_t i = 0; i < header_.name_count; ++i)
+            if(offsets[i] > offsets[i + 1]) fail("bad name table");
+        if(offsets[0] != 0 || offsets[header_.name_count] != header_.names_bytes) fail("bad name table");
+    }
+    ~binary_file() {
+        if(data_) ::munmap(data_, size_);
+    }
+    binary_file(const binary_file&) = delete;
+    binary_file& operator=(const binary_file&) = delete;
+
+    const binary_header& header() const { return header_; }
+    const binary_record* nodes() const { return section<binary_record>(layout_.nodes); }
+    const std::uint32_t* slots() const { return section<std::uint32_t>(layout_.slots); }
+
+    template<typename T>
+    std::vector<T> constants() const {
+        std::vector<T> result(header_.constant_count);
+        if(!result.empty()) std::memcpy(static_cast<void*>(result.data()), bytes() + layout_.constants,
+                                        result.size() * sizeof(T));
+        return result;
+    }
+
+    std::string name(std::uint32_t i) const {
+        const std::uint32_t *offsets = section<std::uint32_t>(layout_.offsets);
+        return std::string(bytes() + layout_.names + offsets[i], offsets[i + 1] - offsets[i]);
+    }
+
+    [[noreturn]] void fail(const std::string &what) const { binary_error(path_, what); }
+
+private:
+    const char* bytes() const { return static_cast<const char*>(data_); }
+    template<typename U>
+    const U* section(std::size_t offset) const { return reinterpret_cast<const U*>(bytes() + offset); }
+
+    std::string path_;
+    void *data_ = nullptr;
+    std::size_t size_ = 0;
+    binary_header header_;
+    binary_layout layout_{binary_header{}};
+};
+
+template<typename T>
+void expression<T>::save(const std::string &path) const {
+    std::vector<T> constants;
+    std::vector<binary_record> nodes;
+    std::vector<std::string> names;
+    std::unordered_map<std::string, std::uint32_t> name_index;
+    auto intern = [&](const std::string &name) {
+        auto it = name_index.emplace(name, static_cast<std::uint32_t>(names.size())).first;
+        if(it->second == names.size()) names.push_back(name);
+        return it->second;
+    };
+
+    // Post-order по общим узлам: запись узла идёт после записей потомков
+    std::unordered_map<const node_base*, std::uint32_t> index;
+    std::vector<std::pair<const node_base*, bool>> stack{{tree().get(), false}};
+    while(!stack.empty()) {
+        auto [node, expanded] = stack.back();
+        stack.pop_back();
+        if(index.count(node)) continue;
+        const op_code op = node->kind();
+        binary_record record{static_cast<std::uint32_t>(op), 0, 0, 0};
+        if(op == op_code::constant) {
+            record.a = static_cast<std::uint32_t>(constants.size());
+            constants.push_back(static_cast<const constant_node<T>*>(node)->value);
+        } else if(op == op_code::variable) {
+            record.a = intern(static_cast<const variable_node<T>*>(node)->name);
+        } else if(auto bin = dynamic_cast<const binary_op_node<T>*>(node)) {
+            if(!expanded) {
+                stack.push_back({node, true});
+                stack.push_back({bin->right.get(), false});
+                stack.push_back({bin->left.get(), false});
+                continue;
+            }
+            record.a = index.at(bin->left.get());
+            record.b = index.at(bin->right.get());
+            if(op == op_code::unknown) record.c = intern(bin->op);
+        } else {
+            auto un = static_cast<const unary_op_node<T>*>(node);
+            if(!expanded) {
+                stack.push_back({node, true});
+                stack.push_back({un->child.get(), false});
+                continue;
+            }
+            record.a = index.at(un->child.get());
+            if(op == op_code::unknown) {
+                record.b = binary_unary;
+                record.c = intern(un->op);
+            }
+        }
+        index.emplace(node, static_cast<std::uint32_t>(nodes.size()));
+        nodes.push_back(record);
+    }
+    write_binary(path, binary_kind::expression, constants, nodes, names, {}, 0);
+}
+
+template<typename T>
+expression<T> expression<T>::load(const std::string &path) {
+    const binary_file file(path, binary_kind::expression, scalar_code<T>(), sizeof(T));
+    const binary_header &h = file.header();
+    const std::vector<T> constants = file.constants<T>();
+    std::vector<std::string> names(h.name_count);
+    for(std::uint32_t i = 0; i < h.name_count; ++i) names[i] = file.name(i);
+
+    const binary_record *records = file.nodes();
+    std::vector<std::shared_ptr<node_base>> built(h.node_count);
+    for(std::uint32_t i = 0; i < h.node_count; ++i) {
+        const binary_record &r = records[i];
+        // Код операции проверяется до приведения к op_code: в выражении
+        // допустимы constant..exp и unknown (именованная операция)
+        if(r.op > static_cast<std::uint32_t>(op_code::unknown) ||
+           (r.op > static_cast<std::uint32_t>(op_code::exp) && r.op != static_cast<std::uint32_t>(op_code::unknown)))
+            file.fail("bad operation " + std::to_string(r.op));
+        const op_code op = static_cast<op_code>(r.op);
+        const bool unknown_unary = op == op_code::unknown && r.b == binary_unary;
+        if(op == op_code::constant) {
+            if(r.a >= constants.size()) file.fail("bad constant index");
+            built[i] = make_constant<T>(constants[r.a]);
+        } else if(op == op_code::variable) {
+            if(r.a >= names.size()) file.fail("bad name index");
+            built[i] = make_variable<T>(names[r.a]);
+        } else if(r.a >= i || (op == op_code::unknown && r.c >= names.size())) {
+            file.fail("bad node " + std::to_string(i));
+        } else if(is_binary(op) || (op == op_code::unknown && !unknown_unary)) {
+            if(r.b >= i) file.fail("bad node " + std::to_string(i));
+            const std::string name = op == op_code::unknown ? names[r.c] : op_code_name(op);
+            built[i] = make_binary_node<T>(name, built[r.a], built[r.b]);
+        } else {
+            const std::string name = op == op_code::unknown ? names[r.c] : op_code_name(op);
+            built[i] = make_unary_node<T>(name, built[r.a]);
+        }
+    }
+    return expression(built.back());
+}
+
+template<typename T>
+void compiled_expression<T>::save(const std::string &path) const {
+    std::vector<binary_record> nodes;
+    nodes.reserve(code_.size());
+    for(const instruction &c : code_) nodes.push_back({static_cast<std::uint32_t>(c.op), c.a, c.b, c.c});
+    write_binary(path, binary_kind::program, constants_, nodes, names_, slots_, slot_count_);
+}
+
+template<typename T>
+compiled_expression<T> compiled_expression<T>::load(const std::string &path) {
+    const binary_file file(path, binary_kind::program, scalar_code<T>(), sizeof(T));
+    const binary_header &h = file.header();
+    compiled_expression result;
+    result.constants_ = file.constants<T>();
+    result.slot_count_ = h.slot_count;
+    result.names_.resize(h.name_count);
+    result.slots_.assign(file.slots(), file.slots() + h.name_count);
+    for(std::uint32_t i = 0; i < h.name_count; ++i) {
+        result.names_[i] = file.name(i);
+        if(result.slots_[i] >= h.slot_count) file.fail("bad slot");
+    }
+
+    // Лента копируется одним проходом с проверкой операндов: интерпретатор
+    // полагается на то, что они ссылаются на уже вычисленные регистры
+    const binary_record *records = file.nodes();
+    result.code_.resize(h.node_count);
+    for(std::uint32_t i = 0; i < h.node_count; ++i) {
+        const binary_record &r = records[i];
+        if(r.op >= static_cast<std::uint32_t>(op_code::unknown)) file.fail("bad operation " + std::to_string(r.op));
+        const op_code op = static_cast<op_code>(r.op);
+        bool valid = true;
+        if(op == op_code::constant) valid = r.a < result.constants_.size();
+        else if(op == op_code::variable) valid = r.a < h.slot_count;
+        else {
+            valid = r.a < i;
+            if(is_binary(op) || op == op_code::fma) valid = valid && r.b < i;
+            if(op == op_code::fma) valid = valid && r.c < i;
+        }
+        if(!valid) file.fail("bad instruction " + std::to_string(i));
+        result.code_[i] = {op, r.a, r.b, r.c};
+    }
+    return result;
+}
+
+// --- Таблица символов ---
+std::uint32_t symbol_table::intern(const std::string &name) {
+    auto it = slots_.find(name);
+    if(it != slots_.end()) return it->second;
+    std::uint32_t slot = static_cast<std::uint32_t>(names_.size());
+    names_.push_back(name);
+    slots_.emplace(name, slot);
+    return slot;
+}
+
+std::uint32_t symbol_table::slot(const std::string &name) const {
+    auto it = slots_.find(name);
+    if(it == slots_.end()) throw std::runtime_error("Variable " + name + " not found");
+    return it->second;
+}
+
+bool symbol_table::contains(const std::string &name) const {
+    return slots_.count(name) != 0;
+}
+
+// --- Определение вспомогательных функций для комплексной единицы ---
+// Мнимая единица допустима для любого типа, который строится из std::complex<double>
+template<typename U>
+typename std::enable_if<std::is_constructible<U, std::complex<double>>::value, expression<U>>::type
+make_complex_unit_helper() {
+    return expression<U>(U(std::complex<double>(0, 1)));
+}
+
+template<typename U>
+typename std::enable_if<!std::is_constructible<U, std::complex<double>>::value, expression<U>>::type
+make_complex_unit_helper() {
+    throw std::runtime_error("Complex unit 'i' encountered for non-complex type");
+}
+
+// --- Реализация парсера выражений ---
+// Разбор идёт за один проход по std::string_view без рекурсии: операнды и
+// незакрытые операции лежат в явных стеках, поэтому глубина вложенности
+// ограничена только памятью, а каждый узел создаётся один раз.
+// Парсер хранит только view, поэтому строка должна жить, пока выполняется
+// parse(); временный std::string запрещён на этапе компиляции.
+template<typename T>
+class ExpressionParserT {
+    std::string_view str;
+    size_t pos;
+public:
+    ExpressionParserT(std::string_view s) : str(s), pos(0) {}
+    ExpressionParserT(const char *s) : str(s), pos(0) {}
+    ExpressionParserT(const std::string &s) : str(s), pos(0) {}
+    ExpressionParserT(std::string &&) = delete;
+    void skipWhitespace() {
+        while (pos < str.size() && isspace(static_cast<unsigned char>(str[pos]))) ++pos;
+    }
+    std::string_view scan(int (*accept)(int));
+    expression<T> parseNumber(bool negative = false);
+    expression<T> parse();
+};
+
+template<typename T>
+std::string_view ExpressionParserT<T>::scan(int (*accept)(int)) {
+    size_t start = pos;
+    while (pos < str.size() && accept(static_cast<unsigned char>(str[pos]))) ++pos;
+    return str.substr(start, pos - start);
+}
+
+namespace {
+int is_number_char(int c) { return std::isdigit(c) || c == '.'; }
+int is_digit(int c) { return std::isdigit(c); }
+
+// Приоритет бинарной операции; все операции левоассоциативны. Унарный
+// минус ('u' в стеке операций) связывает слабее '^': -2^2 = -(2^2)
+int precedence(char op) {
+    switch (op) {
+    case '+': case '-': return 1;
+    case '*': case '/': return 2;
+    case 'u': return 3;
+    case '^': return 4;
+    default: return 0;
+    }
+}
+}
+
+// Число: цифры с точкой и необязательный порядок (1e-07, 2.5E+3);
+// negative -- перед числом стоял унарный минус
+template<typename T>
+expression<T> ExpressionParserT<T>::parseNumber(bool negative) {
+    const size_t start = pos;
+    scan(is_number_char);
+    if (pos < str.size() && (str[pos] == 'e' || str[pos] == 'E')) {
+        size_t next = pos + 1;
+        if (next < str.size() && (str[next] == '+' || str[next] == '-')) ++next;
+        if (next < str.size() && std::isdigit(static_cast<unsigned char>(str[next]))) {
+            pos = next;
+            scan(is_digit);
+        }
+    }
+    std::string_view token = str.substr(start, pos - start);
+    typename literal_type<T>::type value = 0;
+    auto result = std::from_chars(token.data(), token.data() + token.size(), value);
+    if (result.ec != std::errc() || result.ptr != token.data() + token.size())
+        throw std::runtime_error("Invalid number: " + std::string(token));
+    return expression<T>(T(negative ? -value : value));
 }
 
 template<typename T>
 expression<T> ExpressionParserT<T>::parse() {
-    auto expr = parseExpression();
-    skipWhitespace();
+    DIFFER_TIMER(parse);
+    // Отложенная операция: бинарная ('+', ..., '^'), скобка '(' или вызов
+    // функции 'f' с именем name
+    struct pending {
+        char op;
+        std::string_view name;
+    };
+    std::vector<expression<T>> operands;
+    std::vector<pending> ops;
+
+    auto apply = [&]() {
+        if (ops.back().op == 'u') {
+            operands.back() = expression<T>(T(-1)) * operands.back();
+            ops.pop_back();
+            return;
+        }
+        expression<T> right = std::move(operands.back());
+        operands.pop_back();
+        expression<T> &left = operands.back();
+        switch (ops.back().op) {
+        case '+': left = left + right; break;
+        case '-': left = left - right; break;
+        case '*': left = left * right; break;
+        case '/': left = left / right; break;
+        default: left = left ^ right; break;
+        }
+        ops.pop_back();
+    };
+    // Свёртка всех бинарных операций до ближайшей скобки или вызова
+    auto reduce = [&]() {
+        while (!ops.empty() && precedence(ops.back().op)) apply();
+    };
+    auto missing_parenthesis = [&]() {
+        return std::runtime_error(ops.back().op == 'f' ? "Missing closing parenthesis for function"
+                                                       : "Missing closing parenthesis");
+    };
+
+    bool expect_operand = true;
+    while (true) {
+        skipWhitespace();
+        if (expect_operand) {
+            if (pos >= str.size())
+                throw std::runtime_error("Unexpected end of input");
+            char c = str[pos];
+            if (c == 'i') {
+                ++pos;
+                operands.push_back(make_complex_unit_helper<T>());
+                expect_operand = false;
+            } else if (c == '(') {
+                ++pos;
+                ops.push_back({'(', {}});
+            } else if (isalpha(static_cast<unsigned char>(c))) {
+                std::string_view id = scan(isalpha);
+                skipWhitespace();
+                if (pos < str.size() && str[pos] == '(') {
+                    ++pos;
+                    ops.push_back({'f', id});
+                } else {
+                    operands.push_back(expression<T>(std::string(id)));
+                    expect_operand = false;
+                }
+            } else if (is_number_char(static_cast<unsigned char>(c))) {
+                operands.push_back(parseNumber());
+                expect_operand = false;
+            } else if (c == '-') {
+                // Минус перед числом, за которым нет '^', -- отрицательная
+                // константа: (-1) * x и x ^ -1 разбираются в то же дерево,
+                // что печатается; иначе -- унарная операция (-1) * операнд
+                ++pos;
+                skipWhitespace();
+                if (pos < str.size() && is_number_char(static_cast<unsigned char>(str[pos]))) {
+                    // Первый разбор только находит конец числа
+                    const size_t start = pos;
+                    parseNumber();
+                    skipWhitespace();
+                    const bool power = pos < str.size() && str[pos] == '^';
+                    pos = start;
+                    if (power) ops.push_back({'u', {}});
+                    operands.push_back(parseNumber(!power));
+                    expect_operand = false;
+                } else {
+                    ops.push_back({'u', {}});
+                }
+            } else {
+                throw std::runtime_error("Unexpected character: " + std::string(1, c));
+            }
+            continue;
+        }
+
+        if (pos >= str.size()) break;
+        char c = str[pos];
+        if (int p = precedence(c)) {
+            ++pos;
+            while (!ops.empty() && precedence(ops.back().op) >= p) apply();
+            ops.push_back({c, {}});
+            expect_operand = true;
+        } else if (c == ')') {
+            reduce();
+            if (ops.empty()) break;
+            ++pos;
+            if (ops.back().op == 'f')
+                operands.back() = expression<T>::make_unary(std::string(ops.back().name), operands.back());
+            ops.pop_back();
+        } else {
+            reduce();
+            if (!ops.empty()) throw missing_parenthesis();
+            break;
+        }
+    }
+
+    reduce();
+    if (!ops.empty()) throw missing_parenthesis();
     if (pos != str.size())
         throw std::runtime_error("Unexpected characters at end of expression");
-    return expr;
+    return std::move(operands.back());
 }
 
 // Инстанцирование шаблонов для типов double и std::complex<double>
 template class expression<double>;
 template class expression<std::complex<double>>;
+template class compiled_expression<double>;
+template class compiled_expression<std::complex<double>>;
+template class expression_arena<double>;
+template class expression_arena<std::complex<double>>;
+template std::map<std::string, double> gradient(const expression<double>&, const std::map<std::string, double>&);
+template std::map<std::string, std::complex<double>> gradient(const expression<std::complex<double>>&,
+                                                              const std::map<std::string, std::complex<double>>&);
 template class ExpressionParserT<std::complex<double>>;
 template class ExpressionParserT<double>;
+template double tape_apply(op_code, const double&, const double&, const double&, std::int32_t);
+template std::complex<double> tape_apply(op_code, const std::complex<double>&, const std::complex<double>&,
+                                         const std::complex<double>&, std::int32_t);
+template double tape_step(op_code, std::uint32_t, std::uint32_t, std::uint32_t, const double*);
+template std::complex<double> tape_step(op_code, std::uint32_t, std::uint32_t, std::uint32_t,
+                                        const std::complex<double>*);
+template void tape_step_lanes(op_code, std::uint32_t, std::uint32_t, std::uint32_t, const double *const*, double*,
+                              std::size_t, bool);
+template void tape_step_lanes(op_code, std::uint32_t, std::uint32_t, std::uint32_t,
+                              const std::complex<double> *const*, std::complex<double>*, std::size_t, bool);
+
+// Одинарная и расширенная точность
+template class expression<float>;
+template class expression<long double>;
+template class expression<std::complex<float>>;
+template class compiled_expression<float>;
+template class compiled_expression<long double>;
+template class compiled_expression<std::complex<float>>;
+template std::map<std::string, float> gradient(const expression<float>&, const std::map<std::string, float>&);
+template std::map<std::string, long double> gradient(const expression<long double>&,
+                                                     const std::map<std::string, long double>&);
+template std::map<std::string, std::complex<float>> gradient(const expression<std::complex<float>>&,
+                                                             const std::map<std::string, std::complex<float>>&);
+template class ExpressionParserT<float>;
+template class ExpressionParserT<long double>;
+template class ExpressionParserT<std::complex<float>>;
+template float tape_apply(op_code, const float&, const float&, const float&, std::int32_t);
+template float tape_step(op_code, std::uint32_t, std::uint32_t, std::uint32_t, const float*);
+template void tape_step_lanes(op_code, std::uint32_t, std::uint32_t, std::uint32_t, const float *const*, float*,
+                              std::size_t, bool);
+
+// Дуальные числа: значение и производная по направлению за один проход
+template class expression<dual<double>>;
+template class expression<dual<std::complex<double>>>;
+template class compiled_expression<dual<double>>;
+template class compiled_expression<dual<std::complex<double>>>;
+template class ExpressionParserT<dual<double>>;
+template class ExpressionParserT<dual<std::complex<double>>>;
 
@@ -0,0 +1,321 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "head.hpp"
+
+namespace {
+
+const std::size_t latency_window = 1 << 16;
+
+// Пробелы убираются везде, кроме как между двумя символами имени или числа,
+// чтобы "x y" не превратилось в переменную xy
+std::string normalize(std::string_view text) {
+    std::string key;
+    bool pending_space = false;
+    auto word = [](char c) { return std::isalnum(static_cast<unsigned char>(c)) || c == '.'; };
+    for (char c : text) {
+        if (std::isspace(static_cast<unsigned char>(c))) {
+            pending_space = !key.empty();
+            continue;
+        }
+        if (pending_space && word(key.back()) && word(c)) key.push_back(' ');
+        pending_space = false;
+        key.push_back(c);
+    }
+    return key;
+}
+
+std::string_view trim(std::string_view s) {
+    while (!s.empty() && std::isspace(static_cast<unsigned char>(s.front()))) s.remove_prefix(1);
+    while (!s.empty() && std::isspace(static_cast<unsigned char>(s.back()))) s.remove_suffix(1);
+    return s;
+}
+
+std::string format(double value) {
+    char text[32];
+    int length = std::snprintf(text, sizeof(text), "%g", value);
+    return std::string(text, static_cast<std::size_t>(length));
+}
+
+// Удаляет path, только если это Unix-сокет (оставшийся от прошлого запуска);
+// false -- по path лежит файл другого типа
+bool remove_socket(const std::string &path) {
+    struct stat info;
+    if (::lstat(path.c_str(), &info) != 0) return true;
+    if (!S_ISSOCK(info.st_mode)) return false;
+    ::unlink(path.c_str());
+    return true;
+}
+
+bool send_all(int fd, const std::string &data) {
+    std::size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        sent += static_cast<std::size_t>(n);
+    }
+    return true;
+}
+
+} // namespace
+
+// Запись кэша: выражение, его лента и производные, построенные по запросу
+struct expression_server::entry {
+    expression<double> expr;
+    compiled_expression<double> program;
+    std::map<std::string, std::string> derivatives;
+    std::mutex mutex;
+
+    explicit entry(const std::string &text)
+        : expr(ExpressionParserT<double>(text).parse()), program(expr.compile()) {}
+
+    // Значения переменных по слотам ленты из привязок name=value
+    std::vector<double> bind(std::string_view bindings) const {
+        std::vector<double> slots(program.slot_count());
+        std::vector<bool> bound(program.slot_count(), false);
+        std::size_t pos = 0;
+        while (pos < bindings.size()) {
+            while (pos < bindings.size() && std::isspace(static_cast<unsigned char>(bindings[pos]))) ++pos;
+            std::size_t end = pos;
+            while (end < bindings.size() && !std::isspace(static_cast<unsigned char>(bindings[end]))) ++end;
+            if (end == pos) break;
+            std::string_view item = bindings.substr(pos, end - pos);
+            pos = end;
+            std::size_t eq = item.find('=');
+            if (eq == std::string_view::npos)
+                throw std::runtime_error("Bad binding " + std::string(item));
+            std::string_view name = item.substr(0, eq), text = item.substr(eq + 1);
+            double value = 0;
+            auto result = std::from_chars(text.data(), text.data() + text.size(), value);
+            if (result.ec != std::errc() || result.ptr != text.data() + text.size())
+                throw std::runtime_error("Bad value " + std::string(text));
+            const auto &names = program.variables();
+            for (std::size_t i = 0; i < names.size(); ++i) {
+                if (names[i] == name) {
+                    slots[program.slots()[i]] = value;
+                    bound[program.slots()[i]] = true;
+                }
+            }
+        }
+        for (std::size_t i = 0; i < program.variables().size(); ++i) {
+            if (!bound[program.slots()[i]])
+                throw std::runtime_error("Variable " + program.variables()[i] + " not found");
+        }
+        return slots;
+    }
+};
+
+expression_server::expression_server(std::size_t cache_capacity, std::size_t max_connections,
+                                     std::size_t max_request)
+    : capacity_(std::max<std::size_t>(1, cache_capacity)), samples_(latency_window),
+      max_connections_(std::max<std::size_t>(1, max_connections)), max_request_(std::max<std::size_t>(1, max_request)) {}
+
+expression_server::~expression_server() {
+    stop();
+}
+
+expression_server::entry_ptr expression_server::lookup(const std::string &text) {
+    std::string key = normalize(text);
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex_);
+        auto it = index_.find(key);
+        if (it != index_.end()) {
+            ++hits_;
+            lru_.splice(lru_.begin(), lru_, it->second);
+            return it->second->second;
+        }
+        ++misses_;
+    }
+    // Разбор и компиляция -- вне блокировки; при гонке побеждает первая вставка
+    auto created = std::make_shared<entry>(key);
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    auto it = index_.find(key);
+    if (it != index_.end()) return it->second->second;
+    lru_.emplace_front(key, created);
+    index_[key] = lru_.begin();
+    if (lru_.size() > capacity_) {
+        index_.erase(lru_.back().first);
+        lru_.pop_back();
+    }
+    return created;
+}
+
+std::string expression_server::handle(const std::string &request) {
+    auto start = std::chrono::steady_clock::now();
+    std::string response;
+    try {
+        std::string_view line = trim(request);
+        std::size_t space = line.find(' ');
+        std::string_view command = line.substr(0, space);
+        std::string_view rest = space == std::string_view::npos ? std::string_view() : line.substr(space + 1);
+        std::size_t semicolon = rest.find(';');
+        std::string text(trim(rest.substr(0, semicolon)));
+        std::string_view args = semicolon == std::string_view::npos ? std::string_view() : trim(rest.substr(semicolon + 1));
+
+        if (command == "eval") {
+            auto e = lookup(text);
+            auto slots = e->bind(args);
+            response = "ok " + format(e->program.evaluate(slots.data()));
+        } else if (command == "diff") {
+            auto e = lookup(text);
+            std::string var(args);
+            if (var.empty()) throw std::runtime_error("Variable expected after ';'");
+            std::lock_guard<std::mutex> lock(e->mutex);
+            auto it = e->derivatives.find(var);
+            if (it == e->derivatives.end())
+                it = e->derivatives.emplace(var, e->expr.differentiate(var).to_string()).first;
+            response = "ok " + it->second;
+        } else if (command == "grad") {
+            auto e = lookup(text);
+            auto slots = e->bind(args);
+            std::vector<double> grad(e->program.slot_count());
+            e->program.gradient(slots.data(), grad.data());
+            response = "ok";
+            for (std::size_t i = 0; i < e->program.variables().size(); ++i)
+                response += " " + e->program.variables()[i] + "=" + format(grad[e->program.slots()[i]]);
+        } else if (command == "stats") {
+            latency_report report = latency();
+            response = "ok requests=" + std::to_string(report.requests) + " p50_us=" + format(report.p50_us) +
+                       " p99_us=" + format(report.p99_us) + " hits=" + std::to_string(report.cache_hits) +
+                       " misses=" + std::to_string(report.cache_misses);
+        } else if (command == "shutdown") {
+            stop();
+            response = "ok";
+        } else {
+            throw std::runtime_error("Unknown command " + std::string(command));
+        }
+    } catch (const std::exception &ex) {
+        response = std::string("err ") + ex.what();
+    }
+    record(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+    return response;
+}
+
+void expression_server::record(double us) {
+    std::lock_guard<std::mutex> lock(latency_mutex_);
+    samples_[recorded_ % samples_.size()] = us;
+    ++recorded_;
+}
+
+latency_report expression_server::latency() const {
+    std::vector<double> window;
+    latency_report report{};
+    {
+        std::lock_guard<std::mutex> lock(latency_mutex_);
+        report.requests = recorded_;
+        window.assign(samples_.begin(), samples_.begin() + std::min(recorded_, samples_.size()));
+    }
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex_);
+        report.cache_hits = hits_;
+        report.cache_misses = misses_;
+    }
+    if (window.empty()) return report;
+    auto percentile = [&](double q) {
+        auto nth = window.begin() + static_cast<std::ptrdiff_t>(q * (window.size() - 1));
+        std::nth_element(window.begin(), nth, window.end());
+        return *nth;
+    };
+    report.p50_us = percentile(0.5);
+    report.p99_us = percentile(0.99);
+    return report;
+}
+
+void expression_server::connection(int fd) {
+    std::string buffer;
+    char chunk[4096];
+    while (!stopping_) {
+        ssize_t n = ::recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) break;
+        buffer.append(chunk, static_cast<std::size_t>(n));
+        std::size_t start = 0, newline;
+        std::string out;
+        while ((newline = buffer.find('\n', start)) != std::string::npos) {
+            out += handle(buffer.substr(start, newline - start));
+            out += '\n';
+            start = newline + 1;
+        }
+        buffer.erase(0, start);
+        // Незавершённая строка не растёт без предела
+        const bool too_long = buffer.size() > max_request_;
+        if (too_long) out += "err Request too long\n";
+        if (!out.empty() && !send_all(fd, out)) break;
+        if (too_long) break;
+    }
+    // Номер закрывается под блокировкой, чтобы stop() не задел новое соединение с тем же номером
+    std::lock_guard<std::mutex> lock(clients_mutex_);
+    clients_.erase(fd);
+    ::close(fd);
+    idle_.notify_all();
+}
+
+void expression_server::serve(const std::string &path) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+        throw std::runtime_error("Socket path too long: " + path);
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) throw std::runtime_error("Cannot create socket");
+    if (!remove_socket(path)) {
+        ::close(fd);
+        throw std::runtime_error("Not a socket: " + path);
+    }
+    if (::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || ::listen(fd, 64) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Cannot listen on " + path);
+    }
+    stopping_ = false;
+    listen_fd_ = fd;
+
+    while (!stopping_) {
+        int client = ::accept(fd, nullptr, nullptr);
+        if (client < 0) {
+            if (stopping_) break;
+            // Прерванный вызов и сброшенное клиентом соединение -- сразу
+            // повтор; при нехватке дескрипторов (EMFILE, ENFILE) и прочих
+            // ошибках -- короткая пауза, чтобы цикл не занимал процессор
+            if (errno != EINTR && errno != ECONNABORTED) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lock(clients_mutex_);
+            if (clients_.size() >= max_connections_) {
+                send_all(client, "err Too many connections\n");
+                ::close(client);
+                continue;
+            }
+            clients_.insert(client);
+            if (stopping_) ::shutdown(client, SHUT_RD);
+        }
+        std::thread(&expression_server::connection, this, client).detach();
+    }
+    {
+        std::unique_lock<std::mutex> lock(clients_mutex_);
+        idle_.wait(lock, [&]() { return clients_.empty(); });
+    }
+    ::close(fd);
+    remove_socket(path);
+}
+
+void expression_server::stop() {
+    stopping_ = true;
+    int fd = listen_fd_.exchange(-1);
+    if (fd >= 0) ::shutdown(fd, SHUT_RDWR);
+    // Ожидающие recv соединения просыпаются и завершаются
+    std::lock_guard<std::mutex> lock(clients_mutex_);
+    for (int client : clients_) ::shutdown(client, SHUT_RD);
+}
@@ -0,0 +1,88 @@
+#ifndef SERVER_HPP
+#define SERVER_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Распределение задержек обработанных запросов (в микросекундах)
+struct latency_report {
+    std::size_t requests;
+    double p50_us;
+    double p99_us;
+    std::size_t cache_hits;
+    std::size_t cache_misses;
+};
+
+// ============================================================================
+// Сервер выражений. Протокол строковый: один запрос -- одна строка, ответ --
+// одна строка "ok ..." или "err <сообщение>". Привязки переменных идут после
+// ';' через пробел в виде name=value.
+//   eval <выражение> ; x=1 y=2     -> ok <значение>
+//   diff <выражение> ; x           -> ok <производная>
+//   grad <выражение> ; x=1 y=2     -> ok x=<df/dx> y=<df/dy>
+//   stats                          -> ok requests=N p50_us=... p99_us=... hits=... misses=...
+//   shutdown                       -> ok (serve() завершается)
+// Разобранные и скомпилированные выражения и их производные хранятся в
+// LRU-кэше по нормализованному тексту выражения (без лишних пробелов).
+// Соединений одновременно не больше max_connections: лишнее получает
+// "err Too many connections" и закрывается. Строка запроса длиннее
+// max_request байт -- ответ "err Request too long" и закрытие соединения.
+// ============================================================================
+class expression_server {
+public:
+    explicit expression_server(std::size_t cache_capacity = 256, std::size_t max_connections = 64,
+                               std::size_t max_request = 1 << 20);
+    ~expression_server();
+
+    // Обработка одного запроса без сети; потокобезопасно
+    std::string handle(const std::string &request);
+
+    // Приём соединений на Unix-сокете path; каждое соединение обслуживается
+    // своим потоком. Возвращается после запроса shutdown или stop().
+    // Существующий сокет по path заменяется, любой другой файл -- исключение.
+    void serve(const std::string &path);
+    void stop();
+
+    latency_report latency() const;
+
+private:
+    struct entry;
+    using entry_ptr = std::shared_ptr<entry>;
+
+    entry_ptr lookup(const std::string &text);
+    void record(double us);
+    void connection(int fd);
+
+    // LRU: список от свежих к старым и индекс по ключу
+    std::size_t capacity_;
+    std::list<std::pair<std::string, entry_ptr>> lru_;
+    std::unordered_map<std::string, std::list<std::pair<std::string, entry_ptr>>::iterator> index_;
+    mutable std::mutex cache_mutex_;
+    std::size_t hits_ = 0;
+    std::size_t misses_ = 0;
+
+    // Кольцевой буфер последних задержек
+    std::vector<double> samples_;
+    std::size_t recorded_ = 0;
+    mutable std::mutex latency_mutex_;
+
+    std::size_t max_connections_;
+    std::size_t max_request_;
+    std::atomic<bool> stopping_{false};
+    std::atomic<int> listen_fd_{-1};
+    // Открытые соединения; serve() ждёт, пока их потоки завершатся
+    std::set<int> clients_;
+    std::mutex clients_mutex_;
+    std::condition_variable idle_;
+};
+
+#endif // SERVER_HPP
@@ -0,0 +1,360 @@
+#ifndef STATIC_EXPRESSION_HPP
+#define STATIC_EXPRESSION_HPP
+
+#include <cmath>
+#include <complex>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include "compiled.hpp"
+
+// ============================================================================
+// Выражения, известные при сборке: статический аналог expression<T> на
+// шаблонах. Форма формулы -- это её тип, поэтому evaluate раскрывается в
+// линейный код без виртуальных вызовов, а differentiate выполняется
+// компилятором: правила применяются к типам, и нули, единицы и целые
+// константы сворачиваются сразу (d/dx (3 * x) имеет тип constant<3>).
+// Для + - * / и целых степеней evaluate -- constexpr.
+//
+//   using namespace static_expr;
+//   constexpr var<'x'> x;
+//   constexpr var<'y'> y;
+//   auto f = pow(x, num<3>) * sin(y) + exp(x / y);
+//   double v = f.evaluate(at<'x'>(0.9), at<'y'>(1.4));
+//   auto dfdx = differentiate<'x'>(f);
+//   expression<double> g = to_expression<double>(dfdx);
+//
+// Имя переменной задаётся символами (var<'x', 'y'> -- переменная xy), так как
+// строковые литералы не могут быть параметрами шаблонов в C++17. Числа в
+// формуле -- num<N> (целое, известное компилятору) или обычное число, которое
+// хранится в выражении как value<U>.
+// ============================================================================
+namespace static_expr {
+
+// Тип результата вычисления -- общий тип значений всех привязок; целые
+// значения считаются как double, чтобы at<'x'>(3) не давал целочисленного
+// деления (double, если привязок нет)
+template<typename... B>
+struct result_of {
+    using type = double;
+};
+
+template<typename T>
+using floating_t = std::conditional_t<std::is_integral<T>::value, double, T>;
+
+template<typename E>
+struct node {
+    template<typename... B>
+    constexpr auto evaluate(const B&... bindings) const {
+        return static_cast<const E&>(*this).template eval<typename result_of<B...>::type>(bindings...);
+    }
+};
+
+template<typename E>
+constexpr bool is_node = std::is_base_of<node<E>, E>::value;
+
+// Целая константа, известная компилятору
+template<long N>
+struct constant : node<constant<N>> {
+    static constexpr long n = N;
+    template<typename T, typename... B>
+    constexpr T eval(const B&...) const { return T(N); }
+};
+
+template<long N>
+constexpr constant<N> num{};
+
+// Число, известное только при выполнении
+template<typename U>
+struct value : node<value<U>> {
+    U v;
+    constexpr explicit value(U x) : v(x) {}
+    template<typename T, typename... B>
+    constexpr T eval(const B&...) const { return T(v); }
+};
+
+// Значение переменной при вычислении: at<'x'>(0.5)
+template<typename T, char... Name>
+struct binding {
+    T value;
+};
+
+template<char... Name, typename T>
+constexpr binding<T, Name...> at(T value) { return {value}; }
+
+template<typename B>
+struct binding_value;
+template<typename T, char... Name>
+struct binding_value<binding<T, Name...>> {
+    using type = T;
+};
+
+template<typename T, char... Name, typename... Rest>
+struct result_of<binding<T, Name...>, Rest...> {
+    using type = std::common_type_t<floating_t<T>, floating_t<typename binding_value<Rest>::type>...>;
+};
+
+template<char... Name>
+struct var : node<var<Name...>> {
+    static constexpr char name[] = {Name..., '\0'};
+
+    template<typename T, typename... B>
+    constexpr T eval(const B&... bindings) const { return lookup<T>(bindings...); }
+
+private:
+    template<typename T>
+    static constexpr T lookup() {
+        static_assert(sizeof(T) == 0, "variable is not bound");
+        return T();
+    }
+    template<typename T, typename U, char... Other, typename... Rest>
+    static constexpr T lookup(const binding<U, Other...> &first, const Rest&... rest) {
+        if constexpr (sizeof...(Other) == sizeof...(Name) && ((Other == Name) && ...)) return T(first.value);
+        else return lookup<T>(rest...);
+    }
+};
+
+template<op_code Op, typename A>
+struct unary : node<unary<Op, A>> {
+    A arg;
+    constexpr explicit unary(A a) : arg(a) {}
+
+    template<typename T, typename... B>
+    constexpr T eval(const B&... bindings) const {
+        using std::cos;
+        using std::exp;
+        using std::log;
+        using std::sin;
+        const T a = arg.template eval<T>(bindings...);
+        if constexpr (Op == op_code::sin) return sin(a);
+        else if constexpr (Op == op_code::cos) return cos(a);
+        else if constexpr (Op == op_code::exp) return exp(a);
+        else {
+            static_assert(Op == op_code::ln, "unsupported function");
+            if constexpr (std::is_floating_point<T>::value) {
+                if (a <= T(0)) throw std::runtime_error("Durak, nuthno bolshe nula");
+            }
+            return log(a);
+        }
+    }
+};
+
+// Целая степень возведением в квадрат; constexpr, в отличие от std::pow
+template<typename T>
+constexpr T integer_power(T x, long n) {
+    unsigned long m = n < 0 ? 0ul - static_cast<unsigned long>(n) : static_cast<unsigned long>(n);
+    T result = T(1);
+    for (; m; m >>= 1) {
+        if (m & 1) result *= x;
+        if (m > 1) x *= x;
+    }
+    return n < 0 ? T(1) / result : result;
+}
+
+template<op_code Op, typename L, typename R>
+struct binary : node<binary<Op, L, R>> {
+    L left;
+    R right;
+    constexpr binary(L l, R r) : left(l), right(r) {}
+
+    template<typename T, typename... B>
+    constexpr T eval(const B&... bindings) const {
+        const T l = left.template eval<T>(bindings...);
+        if constexpr (Op == op_code::pow && std::is_same<R, constant<0>>::value) {
+            return T(1);
+        } else if constexpr (Op == op_code::pow) {
+            return power<T>(l, right, bindings...);
+        } else {
+            const T r = right.template eval<T>(bindings...);
+            if constexpr (Op == op_code::add) return l + r;
+            else if constexpr (Op == op_code::sub) return l - r;
+            else if constexpr (Op == op_code::mul) return l * r;
+            else {
+                static_assert(Op == op_code::div, "unsupported operator");
+                if (r == T(0)) throw std::runtime_error("Dilinie na nol");
+                return l / r;
+            }
+        }
+    }
+
+private:
+    template<typename T, long N, typename... B>
+    static constexpr T power(const T &base, const constant<N>&, const B&...) { return integer_power(base, N); }
+    template<typename T, typename E, typename... B>
+    static T power(const T &base, const E &exponent, const B&... bindings) {
+        using std::pow;
+        return pow(base, exponent.template eval<T>(bindings...));
+    }
+};
+
+// --- Построение узлов со свёрткой на уровне типов ---
+template<typename E>
+struct is_constant : std::false_type {};
+template<long N>
+struct is_constant<constant<N>> : std::true_type {};
+
+template<typename E>
+struct is_value : std::false_type {};
+template<typename U>
+struct is_value<value<U>> : std::true_type {};
+
+// Выражение без чисел времени выполнения целиком задано своим типом
+template<typename E>
+struct is_static : std::true_type {};
+template<typename U>
+struct is_static<value<U>> : std::false_type {};
+template<op_code Op, typename A>
+struct is_static<unary<Op, A>> : is_static<A> {};
+template<op_code Op, typename L, typename R>
+struct is_static<binary<Op, L, R>> : std::integral_constant<bool, is_static<L>::value && is_static<R>::value> {};
+
+template<typename E, long N>
+constexpr bool is_const = std::is_same<E, constant<N>>::value;
+
+template<typename L, typename R>
+constexpr auto make_add(L l, R r) {
+    if constexpr (is_const<L, 0>) return r;
+    else if constexpr (is_const<R, 0>) return l;
+    else if constexpr (is_constant<L>::value && is_constant<R>::value) return constant<(L::n + R::n)>{};
+    else return binary<op_code::add, L, R>(l, r);
+}
+
+template<typename L, typename R>
+constexpr auto make_sub(L l, R r) {
+    if constexpr (is_const<R, 0>) return l;
+    else if constexpr (is_constant<L>::value && is_constant<R>::value) return constant<(L::n - R::n)>{};
+    // Одинаковые типы без чисел времени выполнения -- одинаковые выражения
+    else if constexpr (std::is_same<L, R>::value && is_static<L>::value) return constant<0>{};
+    else return binary<op_code::sub, L, R>(l, r);
+}
+
+template<typename L, typename R>
+constexpr auto make_mul(L l, R r) {
+    if constexpr (is_const<L, 0> || is_const<R, 0>) return constant<0>{};
+    else if constexpr (is_const<L, 1>) return r;
+    else if constexpr (is_const<R, 1>) return l;
+    else if constexpr (is_constant<L>::value && is_constant<R>::value) return constant<(L::n * R::n)>{};
+    else return binary<op_code::mul, L, R>(l, r);
+}
+
+template<typename L, typename R>
+constexpr auto make_div(L l, R r) {
+    if constexpr (is_const<L, 0>) return constant<0>{};
+    else if constexpr (is_const<R, 1>) return l;
+    else return binary<op_code::div, L, R>(l, r);
+}
+
+template<typename L, typename R>
+constexpr auto make_pow(L l, R r) {
+    if constexpr (is_const<R, 0>) return constant<1>{};
+    else if constexpr (is_const<R, 1>) return l;
+    else return binary<op_code::pow, L, R>(l, r);
+}
+
+// Числа в формуле становятся value<U>
+template<typename E>
+constexpr auto wrap(E e) {
+    if constexpr (is_node<E>) return e;
+    else return value<E>(e);
+}
+
+template<typename E>
+struct is_number : std::is_arithmetic<E> {};
+template<typename U>
+struct is_number<std::complex<U>> : std::true_type {};
+
+template<typename L, typename R>
+constexpr bool either_node = (is_node<L> || is_node<R>) && (is_node<L> || is_number<L>::value) &&
+                             (is_node<R> || is_number<R>::value);
+
+template<typename L, typename R, typename = std::enable_if_t<either_node<L, R>>>
+constexpr auto operator+(L l, R r) { return make_add(wrap(l), wrap(r)); }
+template<typename L, typename R, typename = std::enable_if_t<either_node<L, R>>>
+constexpr auto operator-(L l, R r) { return make_sub(wrap(l), wrap(r)); }
+template<typename L, typename R, typename = std::enable_if_t<either_node<L, R>>>
+constexpr auto operator*(L l, R r) { return make_mul(wrap(l), wrap(r)); }
+template<typename L, typename R, typename = std::enable_if_t<either_node<L, R>>>
+constexpr auto operator/(L l, R r) { return make_div(wrap(l), wrap(r)); }
+template<typename L, typename R, typename = std::enable_if_t<either_node<L, R>>>
+constexpr auto pow(L l, R r) { return make_pow(wrap(l), wrap(r)); }
+
+template<typename A, typename = std::enable_if_t<is_node<A>>>
+constexpr auto sin(A a) { return unary<op_code::sin, A>(a); }
+template<typename A, typename = std::enable_if_t<is_node<A>>>
+constexpr auto cos(A a) { return unary<op_code::cos, A>(a); }
+template<typename A, typename = std::enable_if_t<is_node<A>>>
+constexpr auto ln(A a) { return unary<op_code::ln, A>(a); }
+template<typename A, typename = std::enable_if_t<is_node<A>>>
+constexpr auto exp(A a) { return unary<op_code::exp, A>(a); }
+
+
+// --- Дифференцирование по переменной var<Name...> ---
+template<char... Name, long N>
+constexpr auto differentiate(const constant<N>&) { return constant<0>{}; }
+
+template<char... Name, typename U>
+constexpr auto differentiate(const value<U>&) { return constant<0>{}; }
+
+template<char... Name, char... Other>
+constexpr auto differentiate(const var<Other...>&) {
+    if constexpr (std::is_same<var<Name...>, var<Other...>>::value) return constant<1>{};
+    else return constant<0>{};
+}
+
+template<char... Name, op_code Op, typename A>
+constexpr auto differentiate(const unary<Op, A> &e) {
+    const auto da = differentiate<Name...>(e.arg);
+    if constexpr (Op == op_code::sin) return make_mul(cos(e.arg), da);
+    else if constexpr (Op == op_code::cos) return make_mul(make_mul(constant<-1>{}, sin(e.arg)), da);
+    else if constexpr (Op == op_code::ln) return make_div(da, e.arg);
+    else return make_mul(e, da);
+}
+
+template<char... Name, op_code Op, typename L, typename R>
+constexpr auto differentiate(const binary<Op, L, R> &e) {
+    const auto dl = differentiate<Name...>(e.left);
+    const auto dr = differentiate<Name...>(e.right);
+    if constexpr (Op == op_code::add) return make_add(dl, dr);
+    else if constexpr (Op == op_code::sub) return make_sub(dl, dr);
+    else if constexpr (Op == op_code::mul) return make_add(make_mul(dl, e.right), make_mul(e.left, dr));
+    else if constexpr (Op == op_code::div)
+        return make_div(make_sub(make_mul(dl, e.right), make_mul(e.left, dr)), make_pow(e.right, constant<2>{}));
+    else if constexpr (is_constant<R>::value)
+        // (u^N)' = N * u^(N-1) * u'; показатель-число -- то же при выполнении
+        return make_mul(make_mul(e.right, make_pow(e.left, constant<R::n - 1>{})), dl);
+    else if constexpr (is_value<R>::value)
+        return make_mul(make_mul(e.right, make_pow(e.left, R(e.right.v - 1))), dl);
+    else
+        return make_mul(e, make_add(make_mul(dr, ln(e.left)), make_div(make_mul(e.right, dl), e.left)));
+}
+
+// --- Перевод в expression<T> ---
+template<typename T, long N>
+expression<T> to_expression(const constant<N>&) { return expression<T>(T(N)); }
+
+template<typename T, typename U>
+expression<T> to_expression(const value<U> &e) { return expression<T>(T(e.v)); }
+
+template<typename T, char... Name>
+expression<T> to_expression(const var<Name...>&) { return expression<T>(std::string(var<Name...>::name)); }
+
+template<typename T, op_code Op, typename A>
+expression<T> to_expression(const unary<Op, A> &e) {
+    return expression<T>::make_unary(op_code_name(Op), to_expression<T>(e.arg));
+}
+
+template<typename T, op_code Op, typename L, typename R>
+expression<T> to_expression(const binary<Op, L, R> &e) {
+    auto l = to_expression<T>(e.left);
+    auto r = to_expression<T>(e.right);
+    if constexpr (Op == op_code::add) return l + r;
+    else if constexpr (Op == op_code::sub) return l - r;
+    else if constexpr (Op == op_code::mul) return l * r;
+    else if constexpr (Op == op_code::div) return l / r;
+    else return l ^ r;
+}
+
+} // namespace static_expr
+
+#endif // STATIC_EXPRESSION_HPP
@@ -0,0 +1,95 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include "compiled.hpp"
+
+// ============================================================================
+// Инструментирование горячих путей. Счётчики и таймеры собираются, только
+// если библиотека и программа собраны с -DDIFFER_STATS (make STATS=1); без
+// него макросы ниже раскрываются в пустое выражение и ничего не стоят.
+// ============================================================================
+
+// Фазы, время которых измеряется
+enum class stats_phase : std::uint8_t {
+    parse,
+    differentiate,
+    evaluate,
+    count
+};
+
+constexpr std::size_t op_code_count = static_cast<std::size_t>(op_code::unknown) + 1;
+
+// Снимок счётчиков
+struct expression_stats {
+    bool enabled;
+    std::uint64_t node_allocations;    // новые узлы, созданные фабриками
+    std::uint64_t node_reuses;         // узлы, найденные в таблице hash-consing
+    std::uint64_t clones;              // вызовы node_base::clone()
+    std::uint64_t visits[op_code_count];  // вычисления узлов и инструкций по кодам операций
+    std::uint64_t calls[static_cast<std::size_t>(stats_phase::count)];
+    double milliseconds[static_cast<std::size_t>(stats_phase::count)];
+};
+
+expression_stats collect_stats();
+void reset_stats();
+const char* stats_phase_name(stats_phase phase);
+
+// Внутреннее хранилище счётчиков (доступно только при DIFFER_STATS)
+struct stats_counters {
+    std::atomic<std::uint64_t> node_allocations{0};
+    std::atomic<std::uint64_t> node_reuses{0};
+    std::atomic<std::uint64_t> clones{0};
+    std::atomic<std::uint64_t> visits[op_code_count] = {};
+    std::atomic<std::uint64_t> calls[static_cast<std::size_t>(stats_phase::count)] = {};
+    std::atomic<std::uint64_t> nanoseconds[static_cast<std::size_t>(stats_phase::count)] = {};
+};
+
+stats_counters& differ_stats_counters();
+
+// Таймер фазы; вложенные измерения той же фазы в потоке не суммируются
+class stats_timer {
+public:
+    explicit stats_timer(stats_phase phase) : phase_(static_cast<std::size_t>(phase)), outer_(depth()[phase_]++ == 0) {
+        if(outer_) start_ = std::chrono::steady_clock::now();
+    }
+    ~stats_timer() {
+        --depth()[phase_];
+        if(!outer_) return;
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_);
+        differ_stats_counters().calls[phase_].fetch_add(1, std::memory_order_relaxed);
+        differ_stats_counters().nanoseconds[phase_].fetch_add(static_cast<std::uint64_t>(ns.count()),
+                                                              std::memory_order_relaxed);
+    }
+    stats_timer(const stats_timer&) = delete;
+    stats_timer& operator=(const stats_timer&) = delete;
+
+private:
+    static int* depth() {
+        static thread_local int value[static_cast<std::size_t>(stats_phase::count)] = {};
+        return value;
+    }
+
+    std::size_t phase_;
+    bool outer_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+#ifdef DIFFER_STATS
+#define DIFFER_COUNT(counter) differ_stats_counters().counter.fetch_add(1, std::memory_order_relaxed)
+#define DIFFER_COUNT_N(counter, n) differ_stats_counters().counter.fetch_add((n), std::memory_order_relaxed)
+#define DIFFER_VISIT(op, n) \
+    differ_stats_counters().visits[static_cast<std::size_t>(op)].fetch_add((n), std::memory_order_relaxed)
+#define DIFFER_TIMER(phase) stats_timer differ_stats_timer_(stats_phase::phase)
+#else
+#define DIFFER_COUNT(counter) ((void)0)
+#define DIFFER_COUNT_N(counter, n) ((void)0)
+#define DIFFER_VISIT(op, n) ((void)0)
+#define DIFFER_TIMER(phase) ((void)0)
+#endif
+
+#endif // STATS_HPP
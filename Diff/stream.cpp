@@ -0,0 +1,257 @@
+#include <algorithm>
+#include <charconv>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "head.hpp"
+
+namespace {
+
+// Порция строк: значения по слотам переменных и результаты
+struct batch {
+    std::vector<std::vector<double>> columns;
+    std::vector<double> out;
+    std::size_t rows = 0;
+    std::size_t first_line = 0;
+};
+
+using batch_ptr = std::unique_ptr<batch>;
+
+// Ограниченная очередь между стадиями конвейера. После close() push
+// ничего не принимает, а pop возвращает false, когда очередь опустела.
+class channel {
+public:
+    explicit channel(std::size_t capacity) : capacity_(capacity) {}
+
+    bool push(batch_ptr item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [&]() { return closed_ || items_.size() < capacity_; });
+        if (closed_) return false;
+        items_.push_back(std::move(item));
+        not_empty_.notify_one();
+        return true;
+    }
+
+    bool pop(batch_ptr &item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [&]() { return closed_ || !items_.empty(); });
+        if (items_.empty()) return false;
+        item = std::move(items_.front());
+        items_.pop_front();
+        not_full_.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+
+private:
+    std::size_t capacity_;
+    std::deque<batch_ptr> items_;
+    bool closed_ = false;
+    std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+};
+
+// Построчное чтение большими блоками: строка -- окно в буфере без копирования
+class line_reader {
+public:
+    explicit line_reader(std::FILE *in) : in_(in), buffer_(1 << 20) {}
+
+    bool next(std::string_view &line) {
+        while (true) {
+            const char *begin = buffer_.data() + start_;
+            const char *end = buffer_.data() + filled_;
+            const char *newline = static_cast<const char*>(std::memchr(begin, '\n', end - begin));
+            if (newline || (eof_ && begin != end)) {
+                const char *stop = newline ? newline : end;
+                start_ = stop - buffer_.data() + (newline ? 1 : 0);
+                line = std::string_view(begin, stop - begin);
+                if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+                return true;
+            }
+            if (eof_) return false;
+            // Недочитанный хвост переносится в начало; длинная строка увеличивает буфер
+            std::memmove(buffer_.data(), begin, end - begin);
+            filled_ -= start_;
+            start_ = 0;
+            if (filled_ == buffer_.size()) buffer_.resize(buffer_.size() * 2);
+            std::size_t got = std::fread(buffer_.data() + filled_, 1, buffer_.size() - filled_, in_);
+            filled_ += got;
+            if (got == 0) eof_ = true;
+        }
+    }
+
+private:
+    std::FILE *in_;
+    std::vector<char> buffer_;
+    std::size_t start_ = 0;
+    std::size_t filled_ = 0;
+    bool eof_ = false;
+};
+
+std::string_view trim(std::string_view field) {
+    while (!field.empty() && (field.front() == ' ' || field.front() == '\t')) field.remove_prefix(1);
+    while (!field.empty() && (field.back() == ' ' || field.back() == '\t')) field.remove_suffix(1);
+    return field;
+}
+
+} // namespace
+
+std::size_t stream_evaluate(const expression<double> &expr, std::FILE *in, std::FILE *out,
+                            const stream_options &options) {
+    symbol_table symbols;
+    const compiled_expression<double> program = expr.bind(symbols);
+    const std::size_t batch_rows = std::max<std::size_t>(1, options.batch_rows);
+
+    line_reader reader(in);
+    std::string_view header;
+    if (!reader.next(header))
+        throw std::runtime_error("Empty input: header expected");
+    char delimiter = options.delimiter;
+    if (!delimiter) delimiter = header.find('\t') != std::string_view::npos ? '\t' : ',';
+
+    // Номер столбца -> слот переменной (или -1, если столбец не нужен)
+    std::vector<long> slot_of;
+    std::vector<bool> bound(program.slot_count(), false);
+    for (std::size_t pos = 0;;) {
+        std::size_t next = header.find(delimiter, pos);
+        std::string name(trim(header.substr(pos, next == std::string_view::npos ? next : next - pos)));
+        long slot = symbols.contains(name) ? static_cast<long>(symbols.slot(name)) : -1;
+        if (slot >= 0) {
+            if (bound[slot]) throw std::runtime_error("Duplicate column " + name);
+            bound[slot] = true;
+        }
+        slot_of.push_back(slot);
+        if (next == std::string_view::npos) break;
+        pos = next + 1;
+    }
+    for (std::size_t i = 0; i < program.variables().size(); ++i) {
+        if (!bound[program.slots()[i]])
+            throw std::runtime_error("Variable " + program.variables()[i] + " not found");
+    }
+    std::size_t last_needed = 0;
+    for (std::size_t c = 0; c < slot_of.size(); ++c)
+        if (slot_of[c] >= 0) last_needed = c;
+
+    // Конвейер: reader -> filled -> evaluator -> done -> writer -> free -> reader
+    const std::size_t depth = 4;
+    channel free_batches(depth), filled(depth), done(depth);
+    for (std::size_t i = 0; i < depth; ++i) {
+        auto b = std::make_unique<batch>();
+        b->columns.assign(program.slot_count(), std::vector<double>(batch_rows));
+        b->out.resize(batch_rows);
+        free_batches.push(std::move(b));
+    }
+
+    std::mutex error_mutex;
+    std::exception_ptr error;
+    auto fail = [&]() {
+        {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error) error = std::current_exception();
+        }
+        free_batches.close();
+        filled.close();
+        done.close();
+    };
+
+    std::size_t total = 0;
+    std::thread evaluator([&]() {
+        try {
+            std::vector<const double*> columns(program.slot_count());
+            batch_ptr b;
+            while (filled.pop(b)) {
+                for (std::size_t s = 0; s < columns.size(); ++s) columns[s] = b->columns[s].data();
+                try {
+                    program.evaluate_batch(columns.data(), b->out.data(), b->rows);
+                } catch (const std::runtime_error &ex) {
+                    throw std::runtime_error(std::string(ex.what()) + " in lines " + std::to_string(b->first_line) +
+                                             "-" + std::to_string(b->first_line + b->rows - 1));
+                }
+                if (!done.push(std::move(b))) return;
+            }
+            done.close();
+        } catch (...) {
+            fail();
+        }
+    });
+
+    std::thread writer([&]() {
+        try {
+            std::vector<char> text;
+            batch_ptr b;
+            while (done.pop(b)) {
+                text.resize(b->rows * 32);
+                char *cursor = text.data();
+                for (std::size_t r = 0; r < b->rows; ++r) {
+                    // Формат совпадает с --eval (operator<< для double)
+                    cursor += std::snprintf(cursor, 32, "%g\n", b->out[r]);
+                }
+                if (std::fwrite(text.data(), 1, cursor - text.data(), out) != static_cast<std::size_t>(cursor - text.data()))
+                    throw std::runtime_error("Write error");
+                total += b->rows;
+                if (!free_batches.push(std::move(b))) return;
+            }
+            std::fflush(out);
+        } catch (...) {
+            fail();
+        }
+    });
+
+    try {
+        std::size_t line_number = 1;
+        std::string_view line;
+        batch_ptr b;
+        bool more = true;
+        while (more && free_batches.pop(b)) {
+            b->rows = 0;
+            b->first_line = line_number + 1;
+            while (b->rows < batch_rows && (more = reader.next(line))) {
+                ++line_number;
+                if (trim(line).empty()) continue;
+                std::size_t column = 0, pos = 0;
+                while (column <= last_needed) {
+                    std::size_t next = line.find(delimiter, pos);
+                    std::size_t stop = next == std::string_view::npos ? line.size() : next;
+                    if (slot_of[column] >= 0) {
+                        std::string_view field = trim(line.substr(pos, stop - pos));
+                        double value = 0;
+                        auto result = std::from_chars(field.data(), field.data() + field.size(), value);
+                        if (field.empty() || result.ec != std::errc() || result.ptr != field.data() + field.size())
+                            throw std::runtime_error("Bad value '" + std::string(field) + "' in line " +
+                                                     std::to_string(line_number));
+                        b->columns[slot_of[column]][b->rows] = value;
+                    }
+                    ++column;
+                    if (next == std::string_view::npos) break;
+                    pos = next + 1;
+                }
+                if (column <= last_needed)
+                    throw std::runtime_error("Too few fields in line " + std::to_string(line_number));
+                ++b->rows;
+            }
+            if (b->rows && !filled.push(std::move(b))) break;
+        }
+        filled.close();
+    } catch (...) {
+        fail();
+    }
+
+    evaluator.join();
+    writer.join();
+    if (error) std::rethrow_exception(error);
+    return total;
+}
@@ -0,0 +1,32 @@
+#ifndef STREAM_HPP
+#define STREAM_HPP
+
+#include <cstddef>
+#include <cstdio>
+
+template<typename T>
+class expression;
+
+// Параметры потокового вычисления
+struct stream_options {
+    // Разделитель полей; 0 -- определить по заголовку (табуляция или запятая)
+    char delimiter = 0;
+    // Число строк в одной порции конвейера
+    std::size_t batch_rows = 4096;
+};
+
+// ============================================================================
+// Потоковое вычисление выражения по таблице CSV/TSV. Первая строка --
+// заголовок с именами столбцов; столбцы, совпадающие с переменными
+// выражения, подставляются, остальные пропускаются. На каждую строку данных
+// в out пишется одно значение. Выражение компилируется один раз; чтение и
+// разбор полей, вычисление и форматирование выполняются тремя потоками,
+// передающими друг другу порции строк, и перекрываются по времени. Порции
+// переиспользуются, поэтому в установившемся режиме память не выделяется.
+// Возвращает число обработанных строк; ошибки разбора и вычисления
+// бросаются как std::runtime_error с номером строки, где это возможно.
+// ============================================================================
+std::size_t stream_evaluate(const expression<double> &expr, std::FILE *in, std::FILE *out,
+                            const stream_options &options = stream_options());
+
+#endif // STREAM_HPP
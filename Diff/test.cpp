@@ -1,6 +1,18 @@
 #include <iostream>
 #include <stdexcept>
 #include <cmath>
+#include <cstdio>
+#include <algorithm>
+#include <vector>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
 #include "head.hpp"
 
 bool nearlyEqual(double a, double b, double epsilon = 1e-9) {
@@ -113,6 +125,48 @@ int main() {
         }
     });
 
+    run_test("Test Parser Non-ASCII Input", [](){
+        // Байты UTF-8 (отрицательные char) -- обычная ошибка разбора, а не UB в <cctype>
+        for (const char *text : {"x + \xd0\xb0", "\xff", "sin(\xe2\x88\x9a x)"}) {
+            bool thrown = false;
+            try {
+                ExpressionParserT<double>(text).parse();
+            } catch (const std::runtime_error &) {
+                thrown = true;
+            }
+            if (!thrown) throw std::runtime_error(std::string("Ожидалась ошибка разбора для ") + text);
+        }
+        // Парсер хранит view: временная строка не принимается
+        static_assert(!std::is_constructible<ExpressionParserT<double>, std::string&&>::value,
+                      "temporary std::string must be rejected");
+        static_assert(std::is_constructible<ExpressionParserT<double>, const std::string&>::value,
+                      "lvalue std::string must be accepted");
+        std::string source = "x * 2";
+        if (ExpressionParserT<double>(source).parse().evaluate({{"x", 4}}) != 8)
+            throw std::runtime_error("Разбор строки-переменной");
+    });
+
+    run_test("Test Parser Unary Minus", [](){
+        // Унарный минус связывает слабее '^' и сильнее '*'
+        const std::vector<std::pair<const char*, double>> cases = {
+            {"-2^2", -4}, {"2^-2", 0.25}, {"3*-2^2", -12}, {"x - -2", 3}, {"-x^2", -1},
+            {"-(x + 1) * 2", -4}, {"- -x", 1}, {"(-2)^2", 4}, {"-2 * 3", -6}, {"2^-x", 0.5}};
+        for (const auto &[text, expected] : cases) {
+            const double value = ExpressionParserT<double>(text).parse().evaluate({{"x", 1.0}});
+            if (!nearlyEqual(value, expected))
+                throw std::runtime_error(std::string("Неверный унарный минус: ") + text + " = " + std::to_string(value));
+        }
+        for (const char *text : {"-", "2 * -", "2 - + 3"}) {
+            bool thrown = false;
+            try {
+                ExpressionParserT<double>(text).parse();
+            } catch (const std::runtime_error &) {
+                thrown = true;
+            }
+            if (!thrown) throw std::runtime_error(std::string("Ожидалась ошибка разбора для ") + text);
+        }
+    });
+
     run_test("Test Substitution", [](){
         ExpressionParserT<double> parser("x^2");
         auto expr = parser.parse();
@@ -181,5 +235,1287 @@ int main() {
         std::cout << "Derivative of x^3 + 2*x: " << deriv.to_string() << std::endl;
     });
 
+    run_test("Test Compiled Matches Tree (double)", [](){
+        const char *sources[] = {
+            "1 + 2 * 3 - 4 / 2",
+            "x^3 + 2*x - y/x",
+            "sin(x) * cos(y) + exp(x - y) - ln(x + y)",
+            "2^3^2 + x*y*x"
+        };
+        std::map<std::string, double> vars{{"x", 1.7}, {"y", 0.4}};
+        for (const char *src : sources) {
+            auto expr = ExpressionParserT<double>(src).parse();
+            auto program = expr.compile();
+            double expected = expr.evaluate(vars);
+            double result = program.evaluate(vars);
+            if (result != expected)
+                throw std::runtime_error(std::string(src) + ": ожидалось " + std::to_string(expected) + ", получено " + std::to_string(result));
+        }
+    });
+
+    run_test("Test Compiled Matches Tree (complex)", [](){
+        using C = std::complex<double>;
+        auto expr = ExpressionParserT<C>("x^2 * i + sin(y) / (x - i) + ln(x*y) - exp(i*y)").parse();
+        auto program = expr.compile();
+        std::map<std::string, C> vars{{"x", C(0.5, -1.25)}, {"y", C(-2, 0.75)}};
+        if (program.evaluate(vars) != expr.evaluate(vars))
+            throw std::runtime_error("Результаты дерева и ленты различаются");
+        if (program.variables().size() != 2)
+            throw std::runtime_error("Ожидалось 2 слота переменных");
+    });
+
+    run_test("Test Compiled Errors", [](){
+        auto program = ExpressionParserT<double>("x / (y - y)").parse().compile();
+        try {
+            program.evaluate({{"x", 1}, {"y", 2}});
+            throw std::logic_error("Ожидалась ошибка деления на ноль");
+        } catch (const std::runtime_error &) {
+        }
+        try {
+            program.evaluate({{"x", 1}});
+            throw std::logic_error("Ожидалась ошибка отсутствующей переменной");
+        } catch (const std::runtime_error &) {
+        }
+    });
+
+    run_test("Test Slot Binding", [](){
+        symbol_table symbols;
+        auto f = ExpressionParserT<double>("x * y + z").parse().bind(symbols);
+        auto g = ExpressionParserT<double>("z - x").parse().bind(symbols);
+        if (symbols.size() != 3 || g.slot_count() != 3)
+            throw std::runtime_error("Ожидалось 3 общих слота");
+        double slots[3];
+        slots[symbols.slot("x")] = 2;
+        slots[symbols.slot("y")] = 5;
+        slots[symbols.slot("z")] = 1;
+        if (!nearlyEqual(f.evaluate(slots), 11) || !nearlyEqual(g.evaluate(slots), -1))
+            throw std::runtime_error("Неверный результат вычисления по слотам");
+        if (!nearlyEqual(g.evaluate({{"x", 2}, {"z", 1}}), -1))
+            throw std::runtime_error("Адаптер со словарём вернул неверный результат");
+    });
+
+    run_test("Test Batch Evaluation", [](){
+        symbol_table symbols;
+        auto expr = ExpressionParserT<double>("x*y - x/y + (x + 2)^2 + sin(y)").parse();
+        auto program = expr.bind(symbols);
+        const std::size_t rows = 1000;
+        std::vector<double> xs(rows), ys(rows), out(rows);
+        for (std::size_t i = 0; i < rows; ++i) {
+            xs[i] = 0.01 * i - 3;
+            ys[i] = 1.5 + 0.003 * i;
+        }
+        std::vector<const double*> columns(symbols.size());
+        columns[symbols.slot("x")] = xs.data();
+        columns[symbols.slot("y")] = ys.data();
+        for (simd_level level : {simd_level::scalar, simd_level::sse2, simd_level::avx2, simd_level::avx512}) {
+            program.evaluate_batch(columns.data(), out.data(), rows, level);
+            for (std::size_t i = 0; i < rows; ++i) {
+                double expected = expr.evaluate({{"x", xs[i]}, {"y", ys[i]}});
+                if (out[i] != expected)
+                    throw std::runtime_error(std::string("Расхождение на уровне ") + simd_level_name(level));
+            }
+        }
+    });
+
+    run_test("Test Structural Sharing", [](){
+        auto a = ExpressionParserT<double>("sin(x) * y + x^2").parse();
+        auto b = ExpressionParserT<double>("sin(x) * y + x^2").parse();
+        auto ma = a.metrics(), mb = (a + b).metrics();
+        if (mb.unique_nodes != ma.unique_nodes + 1 || mb.tree_nodes != 2 * ma.tree_nodes + 1)
+            throw std::runtime_error("Одинаковые поддеревья не объединены");
+        auto deriv = a;
+        for (int i = 0; i < 4; ++i)
+            deriv = deriv.differentiate("x", false);
+        auto md = deriv.metrics();
+        if (md.unique_nodes >= md.tree_nodes)
+            throw std::runtime_error("Производная не использует общие узлы");
+        if (!nearlyEqual(deriv.compile().evaluate({{"x", 0.7}, {"y", 2}}), deriv.evaluate({{"x", 0.7}, {"y", 2}})))
+            throw std::runtime_error("Лента с общими узлами вычислена неверно");
+    });
+
+    run_test("Test Simplification", [](){
+        auto square = ExpressionParserT<double>("x^2").parse().differentiate("x");
+        if (square.to_string() != "(2 * x)")
+            throw std::runtime_error("Ожидалось (2 * x), получено " + square.to_string());
+        auto like = ExpressionParserT<double>("x*y + 3*y*x - 2*(x*y) + 0*z + 1*x - x").parse().simplify();
+        if (like.to_string() != "(2 * (x * y))")
+            throw std::runtime_error("Ожидалось (2 * (x * y)), получено " + like.to_string());
+        auto folded = ExpressionParserT<double>("2^3 + exp(0) * x / 1 - x^1 * x^2").parse().simplify();
+        if (folded.to_string() != "((x - (x ^ 3)) + 8)")
+            throw std::runtime_error("Ожидалось ((x - (x ^ 3)) + 8), получено " + folded.to_string());
+        const char *sources[] = {"sin(x)^2 * exp(x/2) - ln(x + 3)", "x^x + (x - 1)/(x + 1)", "cos(x*x) / (2 + sin(x))"};
+        for (const char *src : sources) {
+            auto expr = ExpressionParserT<double>(src).parse();
+            auto raw = expr.differentiate("x", false).differentiate("x", false);
+            auto simple = expr.differentiate("x").differentiate("x");
+            if (simple.metrics().tree_nodes >= raw.metrics().tree_nodes)
+                throw std::runtime_error(std::string(src) + ": упрощение не уменьшило дерево");
+            double a = raw.evaluate({{"x", 0.8}}), b = simple.evaluate({{"x", 0.8}});
+            if (!nearlyEqual(a, b, 1e-9 * (1 + std::fabs(a))))
+                throw std::runtime_error(std::string(src) + ": значения различаются");
+        }
+    });
+
+    run_test("Test Simplification Keeps Errors", [](){
+        // Поглощающие правила не отбрасывают поддеревья, которые бросают
+        auto throws = [](const expression<double> &expr, const std::map<std::string, double> &point) {
+            try {
+                expr.evaluate(point);
+            } catch (const std::runtime_error &) {
+                return true;
+            }
+            return false;
+        };
+        for (const char *src : {"0 * ln(0 - 1) + x", "0 / (x - x) + 1"})
+            if (!throws(ExpressionParserT<double>(src).parse().simplify(), {{"x", 1.0}}))
+                throw std::runtime_error(std::string(src) + ": ошибка свёрнута в 0");
+        const char *failing[] = {"0 / (x + 1)", "ln(x) - ln(x)", "(1 / (x + 1))^0", "1^ln(x)",
+                                 "ln(x) * ln(x)^(0 - 1) + 2"};
+        for (const char *src : failing) {
+            auto expr = ExpressionParserT<double>(src).parse();
+            if (!throws(expr, {{"x", -1.0}}) || !throws(expr.simplify(), {{"x", -1.0}}))
+                throw std::runtime_error(std::string(src) + ": упрощение потеряло ошибку вычисления");
+            if (!nearlyEqual(expr.simplify().evaluate({{"x", 2.0}}), expr.evaluate({{"x", 2.0}})))
+                throw std::runtime_error(std::string(src) + ": значение после упрощения изменилось");
+        }
+        if (ExpressionParserT<double>("0 * sin(x) + x - x").parse().simplify().to_string() != "0")
+            throw std::runtime_error("Безопасные поддеревья по-прежнему должны сворачиваться");
+
+        // Производная по независимому показателю не содержит ln(x)
+        auto power = ExpressionParserT<double>("x^y + x^(1 + 1)").parse().differentiate("x");
+        if (!nearlyEqual(power.evaluate({{"x", -2.0}, {"y", 2.0}}), -8.0))
+            throw std::runtime_error("Производная x^y при x < 0 вычислена неверно: " + power.to_string());
+
+        expression_arena<double> arena;
+        auto root = arena.add(ExpressionParserT<double>("0 * ln(x) + x").parse());
+        // Производная 0 * (1 / x) + 1 при x = 0 -- деление на ноль
+        auto dx = arena.differentiate(root, "x");
+        bool failed = false;
+        try {
+            arena.evaluate(dx, {{"x", 0.0}});
+        } catch (const std::runtime_error &) {
+            failed = true;
+        }
+        if (!failed || !nearlyEqual(arena.evaluate(dx, {{"x", 2.0}}), 1.0))
+            throw std::runtime_error("Арена потеряла ошибку деления в производной");
+    });
+
+    run_test("Test Reverse Mode Gradient", [](){
+        const char *source = "x^y * sin(z) + cos(x*y) / (z + 2) - ln(x + z) * exp(y) + x^3";
+        std::map<std::string, double> point{{"x", 1.3}, {"y", 0.6}, {"z", 0.9}};
+        auto expr = ExpressionParserT<double>(source).parse();
+        auto grad = gradient(expr, point);
+        for (const auto &var : {"x", "y", "z"}) {
+            double expected = expr.differentiate(var).evaluate(point);
+            if (!nearlyEqual(grad[var], expected, 1e-12 * (1 + std::fabs(expected))))
+                throw std::runtime_error(std::string("d/d") + var + ": ожидалось " + std::to_string(expected) + ", получено " + std::to_string(grad[var]));
+        }
+
+        using C = std::complex<double>;
+        auto cexpr = ExpressionParserT<C>(source).parse();
+        std::map<std::string, C> cpoint{{"x", C(1.3, 0.2)}, {"y", C(0.6, -0.4)}, {"z", C(0.9, 0.1)}};
+        auto cgrad = gradient(cexpr, cpoint);
+        for (const auto &var : {"x", "y", "z"}) {
+            C expected = cexpr.differentiate(var).evaluate(cpoint);
+            if (std::abs(cgrad[var] - expected) > 1e-12 * (1 + std::abs(expected)))
+                throw std::runtime_error(std::string("complex d/d") + var + " не совпадает с символьной производной");
+        }
+
+        // Постоянный показатель без инструкции constant: ln(x) при x < 0 не нужен
+        auto square = ExpressionParserT<double>("x^(1 + 1) * y").parse();
+        auto sgrad = gradient(square, {{"x", -3.0}, {"y", 2.0}});
+        if (!nearlyEqual(sgrad["x"], -12.0) || !nearlyEqual(sgrad["y"], 9.0))
+            throw std::runtime_error("Градиент x^(1 + 1) при x < 0 вычислен неверно");
+    });
+
+    run_test("Test Dual Numbers", [](){
+        const char *source = "x^3 * sin(y) + exp(x / y) - ln(x*y + 1) / cos(x)";
+        std::map<std::string, double> point{{"x", 0.9}, {"y", 1.4}};
+        auto expr = ExpressionParserT<double>(source).parse();
+        double fx = expr.evaluate(point);
+        double dx = expr.differentiate("x").evaluate(point);
+
+        auto dual_expr = ExpressionParserT<dual<double>>(source).parse();
+        dual<double> result = dual_expr.evaluate({{"x", dual<double>(0.9, 1)}, {"y", dual<double>(1.4, 0)}});
+        if (!nearlyEqual(result.value, fx) || !nearlyEqual(result.derivative, dx))
+            throw std::runtime_error("expression<dual<double>> дал неверную производную");
+
+        symbol_table symbols;
+        auto program = expr.bind(symbols);
+        double slots[2], direction[2];
+        slots[symbols.slot("x")] = 0.9;
+        slots[symbols.slot("y")] = 1.4;
+        direction[symbols.slot("x")] = 2;
+        direction[symbols.slot("y")] = -1;
+        dual<double> directional = program.evaluate_dual(slots, direction);
+        double expected = 2 * dx - expr.differentiate("y").evaluate(point);
+        if (!nearlyEqual(directional.value, fx) || !nearlyEqual(directional.derivative, expected))
+            throw std::runtime_error("Производная по направлению вычислена неверно");
+
+        using C = std::complex<double>;
+        auto cexpr = ExpressionParserT<C>("x^2 * i + exp(x)").parse();
+        auto cdual = ExpressionParserT<dual<C>>("x^2 * i + exp(x)").parse();
+        C x(0.3, 0.7);
+        dual<C> cresult = cdual.evaluate({{"x", dual<C>(x, C(1))}});
+        if (std::abs(cresult.derivative - cexpr.differentiate("x").evaluate({{"x", x}})) > 1e-12)
+            throw std::runtime_error("dual<complex<double>> дал неверную производную");
+    });
+
+    run_test("Test Expression Arena", [](){
+        const char *source = "sin(x) * y^2 + exp(x / y) - ln(x + y) + x^y";
+        std::map<std::string, double> point{{"x", 0.8}, {"y", 1.7}};
+        auto expr = ExpressionParserT<double>(source).parse();
+        expression_arena<double> arena;
+        auto root = arena.add(expr);
+        if (!nearlyEqual(arena.evaluate(root, point), expr.evaluate(point)))
+            throw std::runtime_error("Арена вычислила неверное значение");
+        auto dx = arena.differentiate(root, "x");
+        auto dxy = arena.differentiate(dx, "y");
+        double expected = expr.differentiate("x").differentiate("y").evaluate(point);
+        if (!nearlyEqual(arena.evaluate(dxy, point), expected, 1e-9 * (1 + std::fabs(expected))))
+            throw std::runtime_error("Производная в арене вычислена неверно");
+        if (!nearlyEqual(arena.to_expression(dxy).evaluate(point), expected, 1e-9 * (1 + std::fabs(expected))))
+            throw std::runtime_error("Обратное преобразование арены в expression неверно");
+        if (arena.add(expr) != root)
+            throw std::runtime_error("Повторное добавление выражения должно дать тот же узел");
+        auto report = arena.memory_report();
+        if (report.arena_bytes_per_node >= report.shared_bytes_per_node)
+            throw std::runtime_error("Арена должна быть компактнее shared_ptr");
+        arena.clear();
+        if (arena.size() != 0)
+            throw std::runtime_error("clear() должен освободить все узлы");
+    });
+
+    run_test("Test Native Kernel", [](){
+        const char *source = "sin(x) * y^2 + exp(x / y) - ln(x + y) * 3.25";
+        auto expr = ExpressionParserT<double>(source).parse();
+        std::string code = expr.emit_cpp("f");
+        if (code.find("extern \"C\" int f(") == std::string::npos ||
+            code.find("f_batch(") == std::string::npos)
+            throw std::runtime_error("emit_cpp не сгенерировал функции");
+
+        auto kernel = jit_compile(expr);
+        auto program = expr.compile();
+        std::vector<double> xs{0.5, 1.2, 2.0}, ys{0.7, 1.9, 3.3}, out(3);
+        const double *columns[2];
+        columns[program.slots()[0]] = xs.data();
+        columns[program.slots()[1]] = ys.data();
+        kernel.evaluate_batch(columns, out.data(), xs.size());
+        for (std::size_t i = 0; i < xs.size(); ++i) {
+            double expected = expr.evaluate({{"x", xs[i]}, {"y", ys[i]}});
+            double slots[2];
+            slots[program.slots()[0]] = xs[i];
+            slots[program.slots()[1]] = ys[i];
+            if (!nearlyEqual(kernel.evaluate(slots), expected) || !nearlyEqual(out[i], expected))
+                throw std::runtime_error("Нативное ядро вычислило неверное значение");
+        }
+
+        // Ошибки области определения сохраняются и в нативном коде
+        auto bad = jit_compile(ExpressionParserT<double>("1 / (x - x)").parse());
+        bool thrown = false;
+        try { double x = 1; bad.evaluate(&x); } catch (const std::runtime_error&) { thrown = true; }
+        if (!thrown)
+            throw std::runtime_error("Деление на ноль в нативном ядре не обнаружено");
+
+        // Без компилятора ядро работает через интерпретатор
+        jit_options options;
+        options.compiler = "/nonexistent/c++";
+        auto fallback = jit_compile(ExpressionParserT<double>("x * 7 + 1").parse(), options);
+        double x = 2;
+        if (fallback.native() || !nearlyEqual(fallback.evaluate(&x), 15))
+            throw std::runtime_error("Запасной путь через интерпретатор не сработал");
+        if (!(fallback.compile_ms() > 0))
+            throw std::runtime_error("Время сборки не записано при откате на интерпретатор");
+
+        // Бесконечность и NaN в константах ленты -- корректный C++
+        auto infinite = ExpressionParserT<double>("x + exp(1000)").parse().simplify();
+        auto not_a_number = ExpressionParserT<double>("x + (exp(1000) - exp(1000))").parse().simplify();
+        auto inf_kernel = jit_compile(infinite), nan_kernel = jit_compile(not_a_number);
+        if (inf_kernel.native() != kernel.native() || nan_kernel.native() != kernel.native() ||
+            !std::isinf(inf_kernel.evaluate(&x)) || !std::isnan(nan_kernel.evaluate(&x)))
+            throw std::runtime_error("Неконечные константы в нативном ядре");
+
+        // Кэш, доступный на запись другим, и чужие библиотеки не загружаются;
+        // флаги не интерпретируются оболочкой
+        const std::string shared_dir = "/tmp/differ-jit-test-" + std::to_string(::getpid());
+        ::mkdir(shared_dir.c_str(), 0700);
+        ::chmod(shared_dir.c_str(), 0777);
+        jit_options shared;
+        shared.cache_dir = shared_dir;
+        auto refused = jit_compile(ExpressionParserT<double>("x * 5").parse(), shared);
+        if (refused.native() || !nearlyEqual(refused.evaluate(&x), 10))
+            throw std::runtime_error("Общий каталог кэша должен отвергаться");
+        ::chmod(shared_dir.c_str(), 0700);
+        auto built = jit_compile(ExpressionParserT<double>("x * 5").parse(), shared);
+        if (built.native()) {
+            ::chmod(built.library().c_str(), 0666);
+            auto planted = jit_compile(ExpressionParserT<double>("x * 5").parse(), shared);
+            if (planted.native())
+                throw std::runtime_error("Библиотека с записью для всех не должна загружаться");
+            std::remove(built.library().c_str());
+        }
+        const std::string marker = shared_dir + "/injected";
+        shared.flags = "-O2; touch " + marker;
+        jit_compile(ExpressionParserT<double>("x * 6").parse(), shared);
+        if (::access(marker.c_str(), F_OK) == 0)
+            throw std::runtime_error("Флаги компилятора выполнены оболочкой");
+        ::rmdir(shared_dir.c_str());
+
+        using C = std::complex<double>;
+        auto cexpr = ExpressionParserT<C>("x^2 * i + exp(x)").parse();
+        auto ckernel = jit_compile(cexpr);
+        C cx(0.3, 0.7);
+        if (std::abs(ckernel.evaluate(&cx) - cexpr.evaluate({{"x", cx}})) > 1e-12)
+            throw std::runtime_error("Нативное комплексное ядро вычислило неверное значение");
+    });
+
+    run_test("Test Large Expression Parsing", [](){
+        // Глубокая вложенность не должна переполнять стек ни при разборе,
+        // ни при освобождении выражения
+        const int depth = 200000;
+        std::string nested = std::string(depth, '(') + "x" + std::string(depth, ')');
+        if (ExpressionParserT<double>(nested).parse().to_string() != "x")
+            throw std::runtime_error("Вложенные скобки разобраны неверно");
+
+        const int terms = 200000;
+        std::string sum;
+        for (int k = 0; k < terms; ++k) {
+            if (k) sum += k % 2 ? " - " : " + ";
+            sum += std::to_string(k % 10) + ".5 * x";
+        }
+        {
+            auto program = ExpressionParserT<double>(sum).parse().compile();
+            double x = 2, expected = 0;
+            for (int k = 0; k < terms; ++k) expected += (k && k % 2 ? -1 : 1) * (k % 10 + 0.5) * x;
+            if (!nearlyEqual(program.evaluate(&x), expected))
+                throw std::runtime_error("Длинная сумма вычислена неверно");
+        }
+
+        bool thrown = false;
+        try { ExpressionParserT<double>("1.2.3 + x").parse(); } catch (const std::runtime_error&) { thrown = true; }
+        if (!thrown)
+            throw std::runtime_error("Некорректное число должно вызывать ошибку");
+    });
+
+    run_test("Test Printing Styles", [](){
+        auto expr = ExpressionParserT<double>("a - (b - c) + x * (y + z) / 2 ^ (k ^ 2) ^ 3 - sin(a * b)").parse();
+        if (expr.to_string(print_style::minimal) != "a - (b - c) + x * (y + z) / 2 ^ (k ^ 2) ^ 3 - sin(a * b)")
+            throw std::runtime_error("Неверная печать с минимальными скобками: " + expr.to_string(print_style::minimal));
+        if (expr.to_string(print_style::compact) != "a-(b-c)+x*(y+z)/2^(k^2)^3-sin(a*b)")
+            throw std::runtime_error("Неверная компактная печать: " + expr.to_string(print_style::compact));
+
+        // Печать и повторный разбор дают тот же общий узел
+        auto deriv = ExpressionParserT<double>("x^3 * sin(x / y) + ln(1 + x*y) / (x - y)").parse().differentiate("x");
+        for (print_style style : {print_style::minimal, print_style::compact}) {
+            const std::string text = deriv.to_string(style);
+            auto parsed = ExpressionParserT<double>(text).parse();
+            if (parsed.metrics().unique_nodes != deriv.metrics().unique_nodes ||
+                parsed.to_string() != deriv.to_string())
+                throw std::runtime_error("Повторный разбор изменил выражение");
+        }
+
+        std::ostringstream out;
+        deriv.print(out);
+        if (out.str() != deriv.to_string())
+            throw std::runtime_error("Печать в поток отличается от to_string()");
+    });
+
+    run_test("Test Print Round Trip", [](){
+        using E = expression<double>;
+        const E x("x"), y("y");
+        // Отрицательные константы слева, справа и в степени; числа с порядком
+        const std::vector<E> exact = {
+            E(-1) * E::make_unary("sin", x),
+            x ^ E(-1),
+            E(-2) ^ E(2),
+            x - E(-3) / y + E(-0.5),
+            E(1e-07) * x + E(2.5e+20) / (y ^ E(-1.5)),
+            E(-4),
+            ExpressionParserT<double>("-2^2").parse(),
+            ExpressionParserT<double>("2^-2 - -x").parse(),
+            ExpressionParserT<double>("x^3 * sin(x / y) + ln(1 + x*y) / (x - y)").parse().differentiate("y")};
+        // Числа, которые %g (печать full) не передаёт точно
+        const std::vector<E> precise = {E(1.0 / 3) * x - E(-2.0 / 7), x ^ E(-1e-300), E(0.1) + E(-123456.789) * y};
+        auto check = [](const E &expr, print_style style) {
+            const std::string text = expr.to_string(style);
+            E parsed = ExpressionParserT<double>(text).parse();
+            if (parsed.to_string(print_style::minimal) != expr.to_string(print_style::minimal) ||
+                parsed.metrics().unique_nodes != expr.metrics().unique_nodes)
+                throw std::runtime_error("Повторный разбор изменил выражение: " + text + " -> " +
+                                         parsed.to_string(print_style::minimal));
+        };
+        for (print_style style : {print_style::full, print_style::minimal, print_style::compact})
+            for (const E &expr : exact) check(expr, style);
+        for (print_style style : {print_style::minimal, print_style::compact})
+            for (const E &expr : precise) check(expr, style);
+        if ((x ^ E(-1)).to_string() != "(x ^ (-1))")
+            throw std::runtime_error("Отрицательная константа без скобок: " + (x ^ E(-1)).to_string());
+        if ((E(-1) * x).to_string(print_style::minimal) != "(-1) * x")
+            throw std::runtime_error("Отрицательная константа без скобок: " + (E(-1) * x).to_string(print_style::minimal));
+    });
+
+    run_test("Test Parallel Evaluation", [](){
+        auto expr = ExpressionParserT<double>("sin(x) * y^2 + exp(x / y) - ln(x + y)").parse();
+        auto program = expr.compile();
+        const std::size_t rows = 50000;
+        std::vector<double> xs(rows), ys(rows), expected(rows), out(rows);
+        for (std::size_t k = 0; k < rows; ++k) {
+            xs[k] = 0.5 + 1e-4 * k;
+            ys[k] = 2.0 - 1e-5 * k;
+        }
+        const double *columns[2];
+        columns[program.slots()[0]] = xs.data();
+        columns[program.slots()[1]] = ys.data();
+        program.evaluate_batch(columns, expected.data(), rows);
+        for (std::size_t threads : {1, 3, 4}) {
+            thread_pool pool(threads);
+            std::fill(out.begin(), out.end(), 0.0);
+            parallel_evaluate(program, columns, out.data(), rows, pool);
+            if (out != expected)
+                throw std::runtime_error("Параллельное вычисление разошлось с последовательным");
+        }
+
+        // Ошибка в одном из потоков доходит до вызывающего
+        xs[rows - 10] = -ys[rows - 10];
+        thread_pool pool(4);
+        bool thrown = false;
+        try { parallel_evaluate(program, columns, out.data(), rows, pool); }
+        catch (const std::runtime_error&) { thrown = true; }
+        if (!thrown)
+            throw std::runtime_error("Исключение из потока пула потеряно");
+    });
+
+    run_test("Test Stream Evaluation", [](){
+        auto expr = ExpressionParserT<double>("x * y + z / 2").parse();
+        std::FILE *in = std::tmpfile();
+        std::FILE *out = std::tmpfile();
+        std::string input = "z,skip,x,y\r\n";
+        const int rows = 10000;
+        for (int k = 0; k < rows; ++k)
+            input += std::to_string(k) + ",text," + std::to_string(k % 7) + ".5, " + std::to_string(k % 3) + "\n";
+        std::fwrite(input.data(), 1, input.size(), in);
+        std::rewind(in);
+        stream_options options;
+        options.batch_rows = 333;
+        if (stream_evaluate(expr, in, out, options) != static_cast<std::size_t>(rows))
+            throw std::runtime_error("Обработаны не все строки");
+        std::rewind(out);
+        for (int k = 0; k < rows; ++k) {
+            double value = 0;
+            if (std::fscanf(out, "%lf", &value) != 1)
+                throw std::runtime_error("Результатов меньше, чем строк");
+            double expected = (k % 7 + 0.5) * (k % 3) + k / 2.0;
+            if (!nearlyEqual(value, expected, 1e-5 * (1 + std::fabs(expected))))
+                throw std::runtime_error("Неверный результат в строке " + std::to_string(k + 2));
+        }
+        std::fclose(in);
+        std::fclose(out);
+
+        // Ошибка разбора сообщает номер строки
+        in = std::tmpfile();
+        out = std::tmpfile();
+        std::fputs("x\ty\n1\t2\n3\toops\n", in);
+        std::rewind(in);
+        std::string message;
+        try { stream_evaluate(expr.substitute("z", expression<double>(0.0)), in, out); }
+        catch (const std::runtime_error &ex) { message = ex.what(); }
+        if (message.find("line 3") == std::string::npos)
+            throw std::runtime_error("Ошибка разбора без номера строки: " + message);
+        std::fclose(in);
+        std::fclose(out);
+    });
+
+    run_test("Test Expression Server", [](){
+        expression_server server(2);
+        if (server.handle("eval x * y + 1 ; x=2 y=3") != "ok 7")
+            throw std::runtime_error("Неверный ответ eval");
+        if (server.handle("eval x*y +1; y=1 x=1") != "ok 2")
+            throw std::runtime_error("Нормализованный текст должен попасть в кэш");
+        if (server.handle("diff x^3 ; x") != "ok (3 * (x ^ 2))")
+            throw std::runtime_error("Неверный ответ diff");
+        if (server.handle("grad x*y + y ; x=2 y=5") != "ok x=5 y=3")
+            throw std::runtime_error("Неверный ответ grad: " + server.handle("grad x*y + y ; x=2 y=5"));
+        if (server.handle("eval x + 1").rfind("err ", 0) != 0)
+            throw std::runtime_error("Несвязанная переменная должна давать ошибку");
+        // Ёмкость 2: первое выражение вытеснено и разбирается заново
+        server.handle("eval x*y+1 ; x=1 y=1");
+        latency_report report = server.latency();
+        if (report.requests != 6 || report.cache_hits != 1 || report.cache_misses != 5)
+            throw std::runtime_error("Неверная статистика кэша");
+
+        const std::string path = "/tmp/differ-test-" + std::to_string(::getpid()) + ".sock";
+        std::thread thread([&]() { server.serve(path); });
+        int fd = -1;
+        for (int attempt = 0; attempt < 200 && fd < 0; ++attempt) {
+            fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            sockaddr_un address{};
+            address.sun_family = AF_UNIX;
+            std::strcpy(address.sun_path, path.c_str());
+            if (::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+                ::close(fd);
+                fd = -1;
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+        }
+        if (fd < 0) {
+            server.stop();
+            thread.join();
+            throw std::runtime_error("Не удалось подключиться к серверу");
+        }
+        const std::string request = "eval sin(x) ; x=0\nshutdown\n";
+        ::send(fd, request.data(), request.size(), 0);
+        std::string reply;
+        char chunk[256];
+        for (ssize_t n; (n = ::recv(fd, chunk, sizeof(chunk), 0)) > 0;) reply.append(chunk, n);
+        ::close(fd);
+        thread.join();
+        if (reply != "ok 0\nok\n")
+            throw std::runtime_error("Неверный ответ по сокету: " + reply);
+    });
+
+    run_test("Test Server Limits", [](){
+        const std::string path = "/tmp/differ-limits-" + std::to_string(::getpid()) + ".sock";
+        // Обычный файл по пути сокета не удаляется
+        std::FILE *file = std::fopen(path.c_str(), "w");
+        std::fclose(file);
+        bool refused = false;
+        try {
+            expression_server(2).serve(path);
+        } catch (const std::runtime_error &) {
+            refused = true;
+        }
+        struct stat info;
+        if (!refused || ::lstat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode))
+            throw std::runtime_error("serve() удалил обычный файл");
+        std::remove(path.c_str());
+
+        expression_server server(2, 1, 64);
+        std::thread thread([&]() { server.serve(path); });
+        auto connect = [&]() {
+            for (int attempt = 0; attempt < 200; ++attempt) {
+                int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+                sockaddr_un address{};
+                address.sun_family = AF_UNIX;
+                std::strcpy(address.sun_path, path.c_str());
+                if (::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0) return fd;
+                ::close(fd);
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+            return -1;
+        };
+        auto receive = [](int fd) {
+            std::string reply;
+            char chunk[256];
+            for (ssize_t n; (n = ::recv(fd, chunk, sizeof(chunk), 0)) > 0;) reply.append(chunk, n);
+            ::close(fd);
+            return reply;
+        };
+        std::string first_reply, second_reply, third_reply;
+        int first = connect();
+        if (first >= 0) {
+            // Первое соединение занимает единственное место
+            const std::string ping = "eval 1 + 1\n";
+            ::send(first, ping.data(), ping.size(), 0);
+            char chunk[16];
+            ::recv(first, chunk, sizeof(chunk), 0);
+            int second = connect();
+            if (second >= 0) second_reply = receive(second);
+            // Строка без перевода длиннее 64 байт закрывает соединение
+            const std::string flood(100, 'x');
+            ::send(first, flood.data(), flood.size(), 0);
+            first_reply = receive(first);
+        }
+        int third = connect();
+        if (third >= 0) {
+            ::send(third, "shutdown\n", 9, 0);
+            third_reply = receive(third);
+        } else {
+            server.stop();
+        }
+        thread.join();
+        if (second_reply != "err Too many connections\n")
+            throw std::runtime_error("Лишнее соединение не отклонено: " + second_reply);
+        if (first_reply != "err Request too long\n")
+            throw std::runtime_error("Длинный запрос не отклонён: " + first_reply);
+        if (third_reply != "ok\n")
+            throw std::runtime_error("Освободившееся место не используется: " + third_reply);
+        if (::lstat(path.c_str(), &info) == 0)
+            throw std::runtime_error("Сокет не удалён после serve()");
+    });
+
+    run_test("Test Differentiate All", [](){
+        // Буква i зарезервирована парсером под мнимую единицу
+        const std::string letters = "abcdefghjklmnopqrstuvwxyz";
+        std::vector<std::string> vars;
+        for (char first : letters)
+            for (char second : std::string("ab")) vars.push_back(std::string(1, first) + second);
+        std::string source;
+        std::map<std::string, double> point;
+        for (std::size_t k = 0; k < vars.size(); ++k) {
+            const std::string &v = vars[k], &next = vars[(k + 1) % vars.size()];
+            if (k) source += " + ";
+            source += "sin(" + v + " * " + next + ") * exp(" + v + " / 7) + " + v + "^3 / (1 + " + next + "^2)";
+            point[v] = 0.01 * (k + 3);
+        }
+        auto expr = ExpressionParserT<double>(source).parse();
+        auto request = vars;
+        request.push_back("zz");
+        request.push_back(vars[0]);
+        for (std::size_t threads : {1, 3}) {
+            auto partials = expr.differentiate_all(request, true, threads);
+            if (partials.size() != request.size())
+                throw std::runtime_error("differentiate_all вернул не все производные");
+            for (std::size_t k = 0; k < request.size(); ++k) {
+                auto single = expr.differentiate(request[k]);
+                if (partials[k].to_string() != single.to_string())
+                    throw std::runtime_error("Производная по " + request[k] + " отличается от differentiate");
+            }
+        }
+        auto raw = expr.differentiate_all({"ab", "bb"}, false);
+        if (!nearlyEqual(raw[0].evaluate(point), expr.differentiate("ab").evaluate(point)) ||
+            !nearlyEqual(raw[1].evaluate(point), expr.differentiate("bb").evaluate(point)))
+            throw std::runtime_error("Неупрощённые производные вычислены неверно");
+    });
+
+    run_test("Test Stats And Cost Breakdown", [](){
+        auto expr = ExpressionParserT<double>("(sin(x) + 1) * (sin(x) + 1) + y / 2").parse();
+        auto m = expr.metrics();
+        if (m.depth != 5 || m.tree_nodes != 13 || m.unique_nodes != 9)
+            throw std::runtime_error("Неверная глубина или размер выражения");
+
+        auto parts = expr.cost_breakdown(3);
+        if (parts.size() != 3 || !nearlyEqual(parts[0].share, 1.0) || parts[0].cost != 54)
+            throw std::runtime_error("Первым должно идти всё выражение");
+        // Произведение (47) дороже общего sin(x)+1 (2 вхождения по 23) и y/2 (6)
+        if (parts[1].text != "(sin(x)+1)*(sin(x)+1)" || parts[2].text != "sin(x)+1" ||
+            parts[2].occurrences != 2 || !nearlyEqual(parts[2].share, 46.0 / 54))
+            throw std::runtime_error("Неверный разбор стоимости: " + parts[1].text + ", " + parts[2].text);
+
+        reset_stats();
+        auto program = ExpressionParserT<double>("x * x + z").parse().compile();
+        double slots[] = {3, 1};
+        program.evaluate(slots);
+        expression_stats stats = collect_stats();
+        const std::size_t mul = static_cast<std::size_t>(op_code::mul);
+        if (stats.enabled) {
+            if (stats.visits[mul] != 1 || stats.calls[static_cast<std::size_t>(stats_phase::parse)] != 1 ||
+                stats.calls[static_cast<std::size_t>(stats_phase::evaluate)] != 1)
+                throw std::runtime_error("Счётчики посещений или фаз неверны");
+        } else if (stats.node_allocations || stats.clones || stats.visits[mul]) {
+            throw std::runtime_error("Без DIFFER_STATS счётчики должны быть нулевыми");
+        }
+    });
+
+    run_test("Test Strength Reduction", [](){
+        auto count = [](const compiled_expression<double> &program, op_code op) {
+            return std::count_if(program.code().begin(), program.code().end(),
+                                 [op](const auto &ins) { return ins.op == op; });
+        };
+        const std::vector<std::string> sources = {
+            "x^3", "3 * x^2 + 2 * x + 1", "(x + 1) * (x - 2) * (x + 3)", "x^10 + 1", "sin(x)^2 + cos(x)^2",
+            "(x + 1)^4 / (y^2 + 1) - x^(0 - 2)", "x^2.5 + x^0.5", "exp(y * (1 - x + x^2 / 2))"};
+        for (const std::string &source : sources) {
+            // simplify() сворачивает 0 - 2 в постоянный отрицательный показатель
+            auto program = ExpressionParserT<double>(source).parse().simplify().compile();
+            auto reduced = program.reduce_strength();
+            if (count(reduced, op_code::pow) > (source == "x^2.5 + x^0.5" ? 2 : 0))
+                throw std::runtime_error("Целая степень осталась вызовом pow: " + source);
+            std::vector<double> xs, ys, out(5), expected(5);
+            for (double x : {-1.5, -0.3, 0.7, 1.1, 2.4}) {
+                double slots[] = {std::fabs(x), 0.5 + x * x};
+                if (source.find("2.5") == std::string::npos) slots[0] = x;
+                xs.push_back(slots[0]);
+                ys.push_back(slots[1]);
+                const double a = program.evaluate(slots), b = reduced.evaluate(slots);
+                if (!nearlyEqual(a, b, 1e-9 * std::max(1.0, std::fabs(a))))
+                    throw std::runtime_error("Понижение стоимости изменило значение: " + source);
+                double ga[2], gb[2];
+                program.gradient(slots, ga);
+                reduced.gradient(slots, gb);
+                for (std::size_t k = 0; k < program.slot_count(); ++k)
+                    if (!nearlyEqual(ga[k], gb[k], 1e-8 * std::max(1.0, std::fabs(ga[k]))))
+                        throw std::runtime_error("Понижение стоимости изменило градиент: " + source);
+            }
+            const double *columns[] = {xs.data(), ys.data()};
+            program.evaluate_batch(columns, expected.data(), xs.size());
+            reduced.evaluate_batch(columns, out.data(), xs.size());
+            for (std::size_t k = 0; k < out.size(); ++k)
+                if (!nearlyEqual(out[k], expected[k], 1e-9 * std::max(1.0, std::fabs(out[k]))))
+                    throw std::runtime_error("Пакетное вычисление после понижения неверно: " + source);
+        }
+
+        // Плотный многочлен -- схема Горнера, разреженный -- powi
+        auto dense = ExpressionParserT<double>("x^3 + 2 * x^2 - 5 * x - 6").parse().compile().reduce_strength();
+        if (count(dense, op_code::fma) != 3 || count(dense, op_code::mul) != 0 || dense.size() != 8)
+            throw std::runtime_error("Многочлен не переписан по схеме Горнера");
+        auto sparse = ExpressionParserT<double>("x^10 + 1").parse().compile().reduce_strength();
+        if (count(sparse, op_code::powi) != 1 || count(sparse, op_code::fma) != 0)
+            throw std::runtime_error("Разреженный многочлен должен вычисляться через powi");
+        if (dense.emit_cpp("poly").find("differ_fma(") == std::string::npos)
+            throw std::runtime_error("emit_cpp не поддерживает fma");
+
+        // Степени и произведения сумм не раскрываются: точность у смещённого корня
+        auto shifted = ExpressionParserT<double>("(x - 1000)^4").parse().compile();
+        auto shiftedReduced = shifted.reduce_strength();
+        double nearRoot[] = {1000.001};
+        if (shiftedReduced.size() > shifted.size() || count(shiftedReduced, op_code::powi) != 1 ||
+            !nearlyEqual(shiftedReduced.evaluate(nearRoot), 1e-12, 1e-6 * 1e-12))
+            throw std::runtime_error("(x - 1000)^4 у корня потерял точность");
+        auto product = ExpressionParserT<double>("(x - 1) * (x - 1) * (x - 1) * (x - 1) * (x - 1) * (x - 1) * (x - 1)")
+                           .parse().compile();
+        auto productReduced = product.reduce_strength();
+        double nearOne[] = {1.0001};
+        if (count(productReduced, op_code::fma) != 0 ||
+            !nearlyEqual(productReduced.evaluate(nearOne), product.evaluate(nearOne), 1e-9 * 1e-28))
+            throw std::runtime_error("Произведение (x - 1) у корня потеряло точность");
+
+        auto complexTape = ExpressionParserT<std::complex<double>>("z^3 - 2 * z + i").parse().compile();
+        std::complex<double> z[] = {{0.3, -1.2}};
+        if (std::abs(complexTape.evaluate(z) - complexTape.reduce_strength().evaluate(z)) > 1e-12)
+            throw std::runtime_error("Понижение стоимости неверно для комплексных чисел");
+
+        bool thrown = false;
+        try {
+            double slots[] = {0.0};
+            ExpressionParserT<double>("1 / x^2").parse().compile().reduce_strength().evaluate(slots);
+        } catch (const std::runtime_error &) {
+            thrown = true;
+        }
+        if (!thrown)
+            throw std::runtime_error("Деление на ноль после понижения стоимости не обнаружено");
+    });
+
+    run_test("Test Mixed Real Complex", [](){
+        using C = std::complex<double>;
+        const std::vector<std::string> sources = {
+            "x^2 + y * sin(x) / (1 + x^2)", "z * exp(x) + cos(y)^3", "ln(x) + z^0.5 * y",
+            "2^x * z - (x - y)^3 / z", "sin(x * y) * (z + i)"};
+        for (const std::string &source : sources) {
+            symbol_table symbols;
+            auto program = ExpressionParserT<C>(source).parse().bind(symbols);
+            std::vector<C> slots(program.slot_count());
+            std::vector<bool> real(program.slot_count(), false);
+            for (const char *name : {"x", "y"}) {
+                if (!symbols.contains(name)) continue;
+                slots[symbols.slot(name)] = C(name[0] == 'x' ? -0.7 : 1.3, 0);
+                real[symbols.slot(name)] = true;
+            }
+            if (symbols.contains("z")) slots[symbols.slot("z")] = C(0.4, -1.1);
+            mixed_program mixed(program, real);
+            if (std::abs(mixed.evaluate(slots.data()) - program.evaluate(slots.data())) > 1e-12)
+                throw std::runtime_error("Смешанное вычисление отличается: " + source);
+        }
+
+        // Вещественная часть выражения считается в double, ln -- всегда комплексный
+        auto program = ExpressionParserT<C>("x^2 + y * sin(x) + ln(x)").parse().compile();
+        mixed_program mixed(program, {true, true});
+        if (mixed.real_instructions() + 2 != mixed.size())
+            throw std::runtime_error("Неверный вывод типов: " + std::to_string(mixed.real_instructions()));
+        C slots[] = {C(-1, 0), C(2, 0)};
+        if (std::abs(mixed.evaluate(slots) - program.evaluate(slots)) > 1e-12)
+            throw std::runtime_error("ln отрицательного аргумента должен быть комплексным");
+
+        bool thrown = false;
+        try {
+            C zero[] = {C(1, 0), C(0, 0)};
+            mixed_program(ExpressionParserT<C>("y / x").parse().compile(), {true, true}).evaluate(zero);
+        } catch (const std::runtime_error &) {
+            thrown = true;
+        }
+        if (!thrown)
+            throw std::runtime_error("Деление на ноль в вещественной части не обнаружено");
+
+        // Ошибки в вещественной и комплексной части печатаются так же, как у ленты
+        for (const char *source : {"y / x", "y / (x * i)"}) {
+            C zero[] = {C(0, 0), C(0, 0)};
+            auto tape = ExpressionParserT<C>(source).parse().compile();
+            auto output = [&](auto evaluate) {
+                std::ostringstream captured;
+                std::streambuf *saved = std::cout.rdbuf(captured.rdbuf());
+                try {
+                    evaluate();
+                } catch (const std::runtime_error &) {
+                }
+                std::cout.rdbuf(saved);
+                return captured.str();
+            };
+            const std::string expected = output([&]() { tape.evaluate(zero); });
+            const std::string actual = output([&]() { mixed_program(tape, {true, true}).evaluate(zero); });
+            if (actual != expected)
+                throw std::runtime_error(std::string("Смешанное вычисление печатает иначе, чем лента: ") + source +
+                                         " -> '" + actual + "', ожидалось '" + expected + "'");
+        }
+
+        // fma и powi после reduce_strength -- та же арифметика, что у ленты
+        auto fused = ExpressionParserT<C>("0.1 * x^3 + 0.7 * x^2 + 0.3 * x - 1 / 3 + x^7 * i").parse().compile().reduce_strength();
+        mixed_program fused_mixed(fused, {true});
+        for (double x : {0.3, 1.7, -2.9}) {
+            C point[] = {C(x, 0)};
+            if (fused_mixed.evaluate(point) != fused.evaluate(point))
+                throw std::runtime_error("fma в смешанном вычислении отличается от ленты");
+        }
+    });
+
+    run_test("Test Binary Format", [](){
+        const std::string path = "/tmp/differ-test-" + std::to_string(::getpid()) + ".bin";
+        auto expr = ExpressionParserT<double>("sin(x * y)^3 / (1 + ln(x)) + x * y").parse().differentiate("x", false) +
+                    ExpressionParserT<double>("foo(x)").parse();
+        expr.save(path);
+        auto loaded = expression<double>::load(path);
+        // Узлы уникальны, поэтому загруженное выражение -- то же дерево
+        if (loaded.to_string() != expr.to_string() || loaded.metrics().unique_nodes != expr.metrics().unique_nodes)
+            throw std::runtime_error("Загруженное выражение отличается: " + loaded.to_string());
+
+        auto program = ExpressionParserT<double>("3 * x^2 + 2 * x + y").parse().compile().reduce_strength();
+        program.save(path);
+        auto tape = compiled_expression<double>::load(path);
+        double slots[] = {1.5, -2};
+        if (tape.size() != program.size() || tape.variables() != program.variables() ||
+            tape.evaluate(slots) != program.evaluate(slots))
+            throw std::runtime_error("Загруженная лента отличается");
+
+        auto complexExpr = ExpressionParserT<std::complex<double>>("z * i + 2").parse();
+        complexExpr.save(path);
+        if (expression<std::complex<double>>::load(path).to_string() != complexExpr.to_string())
+            throw std::runtime_error("Комплексное выражение загружено неверно");
+
+        // Файл другого типа, обрезанный и испорченный файлы отвергаются
+        auto rejected = [&](auto load) {
+            try {
+                load();
+            } catch (const std::runtime_error &) {
+                return true;
+            }
+            return false;
+        };
+        if (!rejected([&]() { expression<double>::load(path); }) ||
+            !rejected([&]() { compiled_expression<std::complex<double>>::load(path); }))
+            throw std::runtime_error("Файл другого типа не отвергнут");
+        expr.save(path);
+        // Корень ссылается сам на себя
+        std::FILE *file = std::fopen(path.c_str(), "r+b");
+        binary_header header;
+        std::fread(&header, sizeof(header), 1, file);
+        auto align = [](long size) { return (size + 7) / 8 * 8; };
+        const long root = align(sizeof(header)) + align(long(header.constant_count) * header.scalar_size) +
+                          long(header.node_count - 1) * sizeof(binary_record);
+        const std::uint32_t self = header.node_count - 1;
+        std::fseek(file, root + 4, SEEK_SET);
+        std::fwrite(&self, sizeof(self), 1, file);
+        std::fseek(file, 0, SEEK_END);
+        const long size = std::ftell(file);
+        std::fclose(file);
+        if (!rejected([&]() { expression<double>::load(path); }))
+            throw std::runtime_error("Испорченный файл не отвергнут");
+        if (::truncate(path.c_str(), size / 2) != 0 || !rejected([&]() { expression<double>::load(path); }))
+            throw std::runtime_error("Обрезанный файл не отвергнут");
+
+        // Подобранные поля заголовка: сумма размеров разделов переполняется,
+        // код операции вне op_code
+        auto patch = [&](long offset, const void *value, std::size_t bytes) {
+            std::FILE *f = std::fopen(path.c_str(), "r+b");
+            std::fseek(f, offset, SEEK_SET);
+            std::fwrite(value, bytes, 1, f);
+            std::fclose(f);
+        };
+        const long first = align(sizeof(header)) + align(long(header.constant_count) * header.scalar_size);
+        for (std::uint64_t names_bytes : {~std::uint64_t(0), ~std::uint64_t(0) - 64, std::uint64_t(1) << 62}) {
+            expr.save(path);
+            patch(offsetof(binary_header, names_bytes), &names_bytes, sizeof(names_bytes));
+            if (!rejected([&]() { expression<double>::load(path); }))
+                throw std::runtime_error("Переполнение размера в заголовке не отвергнуто");
+        }
+        for (std::uint32_t op : {std::uint32_t(op_code::unknown) + 1, ~std::uint32_t(0)}) {
+            expr.save(path);
+            patch(first, &op, sizeof(op));
+            if (!rejected([&]() { expression<double>::load(path); }))
+                throw std::runtime_error("Неизвестный код операции в выражении не отвергнут");
+            program.save(path);
+            std::FILE *f = std::fopen(path.c_str(), "rb");
+            binary_header tape_header;
+            std::fread(&tape_header, sizeof(tape_header), 1, f);
+            std::fclose(f);
+            patch(align(sizeof(tape_header)) + align(long(tape_header.constant_count) * tape_header.scalar_size), &op,
+                  sizeof(op));
+            if (!rejected([&]() { compiled_expression<double>::load(path); }))
+                throw std::runtime_error("Неизвестный код операции в ленте не отвергнут");
+        }
+        std::remove(path.c_str());
+    });
+
+    run_test("Test Lazy Derivative", [](){
+        const char *source = "x^3 * sin(y) + exp(x / y) - ln(x*y + 1) / cos(x) + y^x";
+        std::map<std::string, double> point{{"x", 0.9}, {"y", 1.4}};
+        auto expr = ExpressionParserT<double>(source).parse();
+        for (const char *var : {"x", "y", "z"}) {
+            auto lazy = expr.differentiate_lazy(var);
+            auto eager = expr.differentiate(var);
+            if (!nearlyEqual(lazy.evaluate(point), eager.evaluate(point)) ||
+                !nearlyEqual(lazy.evaluate({{"x", 1.2}, {"y", 0.5}}), eager.evaluate({{"x", 1.2}, {"y", 0.5}})))
+                throw std::runtime_error(std::string("Ленивая производная по ") + var + " отличается");
+            // Любая другая операция работает с развёрнутым деревом
+            if (lazy.to_string() != eager.to_string() || lazy.compile().size() != eager.compile().size())
+                throw std::runtime_error("Развёрнутая ленивая производная отличается от differentiate");
+        }
+        auto second = expr.differentiate_lazy("x").differentiate_lazy("y");
+        if (!nearlyEqual(second.evaluate(point), expr.differentiate("x").differentiate("y").evaluate(point)))
+            throw std::runtime_error("Вторая ленивая производная вычислена неверно");
+        auto combined = expr.differentiate_lazy("x", false) * expression<double>("x");
+        if (!nearlyEqual(combined.evaluate(point), expr.differentiate("x").evaluate(point) * 0.9))
+            throw std::runtime_error("Ленивая производная внутри выражения вычислена неверно");
+        try {
+            expr.differentiate_lazy("x").evaluate({{"x", 0.9}});
+            throw std::logic_error("Отсутствующая переменная не обнаружена");
+        } catch (const std::runtime_error &) {
+        }
+
+        // Нужные переменные и ошибки -- как у производной differentiate: ни
+        // несвязанная независимая переменная, ни ошибка в независимой части
+        // исходного выражения, ни отсутствие var не отличаются
+        auto outcome = [](const expression<double> &e, const std::map<std::string, double> &vars) {
+            try {
+                return std::make_pair(false, e.evaluate(vars));
+            } catch (const std::runtime_error &) {
+                return std::make_pair(true, 0.0);
+            }
+        };
+        const std::vector<std::pair<const char*, std::map<std::string, double>>> cases = {
+            {"x^2 * 3 + z", {{"x", 0.5}}},
+            {"x^2 + ln(y)", {{"x", 0.5}, {"y", -1.0}}},
+            {"sin(x) / (y - y)", {{"x", 0.5}, {"y", 2.0}}},
+            {"ln(x) * y", {{"x", 0.0}, {"y", 2.0}}},
+            {"ln(x) * y", {{"x", 0.3}}},
+            {"x * y + exp(y / z)", {}},
+            {"x * y + exp(y / z)", {{"x", 0.5}, {"y", 1.0}, {"z", 0.0}}}};
+        for (const auto &[text, vars] : cases) {
+            auto source = ExpressionParserT<double>(text).parse();
+            for (const char *var : {"x", "y", "w"})
+                for (bool simplified : {false, true}) {
+                    auto lazy = outcome(source.differentiate_lazy(var, simplified), vars);
+                    auto eager = outcome(source.differentiate(var, simplified), vars);
+                    if (lazy.first != eager.first || !nearlyEqual(lazy.second, eager.second))
+                        throw std::runtime_error(std::string("Ленивая производная ") + text + " по " + var +
+                                                 " ведёт себя иначе, чем differentiate");
+                }
+        }
+
+        using C = std::complex<double>;
+        auto cexpr = ExpressionParserT<C>("x^2 * i + exp(x)").parse();
+        C x(0.3, 0.7);
+        if (std::abs(cexpr.differentiate_lazy("x").evaluate({{"x", x}}) - cexpr.differentiate("x").evaluate({{"x", x}})) > 1e-12)
+            throw std::runtime_error("Комплексная ленивая производная вычислена неверно");
+    });
+
+    run_test("Test Incremental Evaluation", [](){
+        const char *source = "sin(x) * exp(y / 3) + x^3 / (1 + y^2) - ln(1 + x*z) + z^2";
+        auto expr = ExpressionParserT<double>(source).parse();
+        std::map<std::string, double> point{{"x", 0.4}, {"y", 1.3}, {"z", 0.8}};
+        incremental_evaluator<double> inc(expr, point);
+        if (!nearlyEqual(inc.value(), expr.evaluate(point)) || inc.last_recomputed() != inc.program().size())
+            throw std::runtime_error("Первое вычисление неверно");
+        inc.value();
+        if (inc.last_recomputed() != 0)
+            throw std::runtime_error("Без изменений ничего не должно пересчитываться");
+
+        // y входит только в первые два слагаемых: ln(1 + x*z), z^2 и sin(x) не пересчитываются
+        point["y"] = 0.9;
+        inc.set("y", 0.9);
+        if (!nearlyEqual(inc.value(), expr.evaluate(point)) || inc.last_recomputed() + 5 > inc.program().size())
+            throw std::runtime_error("Изменение y пересчитано неверно");
+        point["x"] = 1.1;
+        point["z"] = 0.2;
+        inc.set("x", 1.1);
+        inc.set("z", 0.2);
+        inc.set("w", 5);
+        if (!nearlyEqual(inc.value(), expr.evaluate(point)))
+            throw std::runtime_error("Изменение x и z пересчитано неверно");
+        inc.set("x", 1.1);
+        inc.value();
+        if (inc.last_recomputed() != 0)
+            throw std::runtime_error("То же значение не должно пересчитываться");
+
+        // Ошибка оставляет изменение ожидающим
+        inc.set("z", -1 / 1.1);
+        bool failed = false;
+        try {
+            inc.value();
+        } catch (const std::runtime_error &) {
+            failed = true;
+        }
+        inc.set("z", 0.5);
+        point["z"] = 0.5;
+        if (!failed || !nearlyEqual(inc.value(), expr.evaluate(point)))
+            throw std::runtime_error("Состояние после ошибки неверно");
+        // Ошибка только бросается, в std::cout ничего не пишется
+        {
+            std::ostringstream captured;
+            std::streambuf *saved = std::cout.rdbuf(captured.rdbuf());
+            incremental_evaluator<double> broken(ExpressionParserT<double>("1 / (x - 1) + ln(x)").parse(), {{"x", 1}});
+            try { broken.value(); } catch (const std::runtime_error &) {}
+            broken.set("x", -1);
+            try { broken.value(); } catch (const std::runtime_error &) {}
+            std::cout.rdbuf(saved);
+            if (!captured.str().empty())
+                throw std::runtime_error("Инкрементальное вычисление печатает в std::cout: " + captured.str());
+        }
+        // Лента с fma после reduce_strength считается так же, как evaluate
+        {
+            auto fused = ExpressionParserT<double>("(0.1 * x^3 + 0.7 * x^2 + 0.3 * x - 1 / 3) / y").parse().compile().reduce_strength();
+            if (std::none_of(fused.code().begin(), fused.code().end(), [](const auto &c) { return c.op == op_code::fma; }))
+                throw std::runtime_error("В ленте нет fma");
+            incremental_evaluator<double> finc(fused);
+            for (double x : {0.3, 1.7, -2.9}) {
+                finc.set("x", x);
+                finc.set("y", x / 3);
+                if (finc.value() != fused.evaluate({{"x", x}, {"y", x / 3}}))
+                    throw std::runtime_error("fma в инкрементальном вычислении отличается от evaluate");
+            }
+        }
+
+        incremental_evaluator<double> unbound(expr, {{"x", 1}});
+        try {
+            unbound.value();
+            throw std::logic_error("Незаданная переменная не обнаружена");
+        } catch (const std::runtime_error &) {
+        }
+
+        using C = std::complex<double>;
+        auto cexpr = ExpressionParserT<C>("z^2 * i + exp(x) * z").parse();
+        incremental_evaluator<C> cinc(cexpr, {{"x", C(0.3)}, {"z", C(1, 2)}});
+        cinc.value();
+        cinc.set("z", C(-0.5, 0.1));
+        if (std::abs(cinc.value() - cexpr.evaluate({{"x", C(0.3)}, {"z", C(-0.5, 0.1)}})) > 1e-12)
+            throw std::runtime_error("Комплексное инкрементальное вычисление неверно");
+    });
+
+    run_test("Test Static Expressions", [](){
+        using namespace static_expr;
+        constexpr var<'x'> x;
+        constexpr var<'y'> y;
+        // Правила и свёртка выполняются компилятором
+        static_assert(std::is_same<decltype(differentiate<'x'>(num<3> * x)), constant<3>>::value,
+                      "d/dx (3 * x) должна свернуться в 3");
+        static_assert(std::is_same<decltype(differentiate<'y'>(pow(x, num<4>))), constant<0>>::value,
+                      "d/dy x^4 должна быть нулём");
+        constexpr auto poly = pow(x, num<3>) * num<2> - x * y + num<7>;
+        static_assert(poly.evaluate(at<'x'>(2.0), at<'y'>(0.5)) == 22.0, "constexpr вычисление");
+        static_assert(differentiate<'x'>(poly).evaluate(at<'x'>(2.0), at<'y'>(0.5)) == 23.5, "constexpr производная");
+        // Целые привязки вычисляются в double, тип -- общий для всех привязок
+        static_assert((x / num<2>).evaluate(at<'x'>(3)) == 1.5, "целая привязка");
+        static_assert((y / x).evaluate(at<'x'>(2), at<'y'>(1.0f)) == 0.5, "целая привязка не первой");
+        static_assert(std::is_same<decltype((x * y).evaluate(at<'x'>(2), at<'y'>(1.5f))), double>::value,
+                      "общий тип int и float -- double");
+        static_assert(std::is_same<decltype(x.evaluate(at<'x'>(1.5f))), float>::value, "float сохраняется");
+        static_assert(std::is_same<decltype((x * y).evaluate(at<'x'>(2), at<'y'>(std::complex<double>(1, 1)))),
+                                   std::complex<double>>::value, "целое и комплексное -- комплексное");
+
+        auto f = pow(x, num<3>) * sin(y) + exp(x / y) - ln(x * y + 1) / cos(x) + pow(y, x) * 0.5;
+        const char *source = "x^3 * sin(y) + exp(x / y) - ln(x * y + 1) / cos(x) + y^x * 0.5";
+        auto expr = ExpressionParserT<double>(source).parse();
+        std::map<std::string, double> point{{"x", 0.9}, {"y", 1.4}};
+        if (!nearlyEqual(f.evaluate(at<'x'>(0.9), at<'y'>(1.4)), expr.evaluate(point)))
+            throw std::runtime_error("Статическое вычисление отличается от дерева");
+        for (const char *var : {"x", "y"}) {
+            double expected = expr.differentiate(var).evaluate(point);
+            double actual = var[0] == 'x' ? differentiate<'x'>(f).evaluate(at<'y'>(1.4), at<'x'>(0.9))
+                                          : differentiate<'y'>(f).evaluate(at<'x'>(0.9), at<'y'>(1.4));
+            if (!nearlyEqual(actual, expected))
+                throw std::runtime_error(std::string("Статическая производная по ") + var + " отличается");
+        }
+        if (to_expression<double>(f).to_string() != expr.to_string())
+            throw std::runtime_error("to_expression: " + to_expression<double>(f).to_string());
+        if (!nearlyEqual(to_expression<double>(differentiate<'x'>(f)).evaluate(point), expr.differentiate("x").evaluate(point)))
+            throw std::runtime_error("Перевод производной в expression неверен");
+
+        using C = std::complex<double>;
+        auto g = pow(var<'z', 'w'>(), num<2>) * C(0, 1) + exp(var<'z', 'w'>());
+        auto cexpr = ExpressionParserT<C>("zw^2 * i + exp(zw)").parse();
+        C z(0.3, 0.7);
+        if (std::abs(differentiate<'z', 'w'>(g).evaluate(at<'z', 'w'>(z)) - cexpr.differentiate("zw").evaluate({{"zw", z}})) > 1e-12)
+            throw std::runtime_error("Комплексная статическая производная неверна");
+    });
+
+    run_test("Test Precisions", [](){
+        const char *source = "x^3 * sin(y) + exp(x / y) - ln(x*y + 1) / cos(x)";
+        auto expr = ExpressionParserT<double>(source).parse();
+        std::map<std::string, double> point{{"x", 0.9}, {"y", 1.4}};
+        const double value = expr.evaluate(point), dx = expr.differentiate("x").evaluate(point);
+
+        auto single = ExpressionParserT<float>(source).parse();
+        std::map<std::string, float> fpoint{{"x", 0.9f}, {"y", 1.4f}};
+        if (std::fabs(single.evaluate(fpoint) - value) > 1e-5 * std::fabs(value) ||
+            std::fabs(single.differentiate("x").evaluate(fpoint) - dx) > 1e-5 * std::fabs(dx))
+            throw std::runtime_error("expression<float> вычислено неверно");
+
+        // Литералы long double разбираются без округления до double
+        auto extended = ExpressionParserT<long double>("0.1 * x").parse();
+        if (extended.evaluate({{"x", 3.0L}}) != 0.1L * 3.0L)
+            throw std::runtime_error("Литерал long double округлён до double");
+        auto lexpr = ExpressionParserT<long double>(source).parse();
+        std::map<std::string, long double> lpoint{{"x", 0.9L}, {"y", 1.4L}};
+        if (std::fabs(static_cast<double>(lexpr.evaluate(lpoint)) - value) > 1e-12 ||
+            std::fabs(static_cast<double>(lexpr.differentiate("x").evaluate(lpoint)) - dx) > 1e-12)
+            throw std::runtime_error("expression<long double> вычислено неверно");
+
+        using CF = std::complex<float>;
+        auto cexpr = ExpressionParserT<CF>("x^2 * i + exp(x)").parse();
+        auto reference = ExpressionParserT<std::complex<double>>("x^2 * i + exp(x)").parse();
+        CF z(0.3f, 0.7f);
+        std::complex<double> zd(0.3f, 0.7f);
+        if (std::abs(std::complex<double>(cexpr.differentiate("x").evaluate({{"x", z}})) -
+                     reference.differentiate("x").evaluate({{"x", zd}})) > 1e-5)
+            throw std::runtime_error("expression<complex<float>> вычислено неверно");
+
+        // Пакетное вычисление float совпадает с построчным
+        auto program = single.compile();
+        std::vector<float> xs(1000), ys(1000), out(1000);
+        for (std::size_t k = 0; k < xs.size(); ++k) {
+            xs[k] = 0.5f + 0.001f * k;
+            ys[k] = 1.5f - 0.0005f * k;
+        }
+        const float *columns[2];
+        columns[program.slots()[0]] = program.variables()[0] == "x" ? xs.data() : ys.data();
+        columns[program.slots()[1]] = program.variables()[1] == "x" ? xs.data() : ys.data();
+        program.evaluate_batch(columns, out.data(), out.size());
+        for (std::size_t k = 0; k < xs.size(); ++k)
+            if (std::fabs(out[k] - program.evaluate({{"x", xs[k]}, {"y", ys[k]}})) > 1e-5f * (1 + std::fabs(out[k])))
+                throw std::runtime_error("Пакетное вычисление float отличается");
+    });
+
+    run_test("Test Mixed Precision Batch", [](){
+        // Сокращение (x - y) при близких x и y и большие аргументы exp требуют double
+        auto program = ExpressionParserT<double>("(x - y) / (x + y) + exp(x) * sin(y) + x^2").parse().compile();
+        const std::size_t rows = 1000;
+        std::vector<double> xs(rows), ys(rows), exact(rows), out(rows);
+        for (std::size_t k = 0; k < rows; ++k) {
+            xs[k] = 0.5 + 0.01 * k;
+            ys[k] = k % 10 == 0 ? xs[k] * (1 + 1e-9) : 1.7 - 0.001 * k;
+        }
+        xs[500] = 120;  // exp(120) не помещается во float
+        const double *columns[2];
+        for (std::size_t v = 0; v < 2; ++v)
+            columns[program.slots()[v]] = program.variables()[v] == "x" ? xs.data() : ys.data();
+        program.evaluate_batch(columns, exact.data(), rows);
+        mixed_precision_program mixed(program);
+        std::size_t rechecked = mixed.evaluate_batch(columns, out.data(), rows);
+        if (rechecked < rows / 10 + 1 || rechecked == rows)
+            throw std::runtime_error("Подозрительные строки определены неверно: " + std::to_string(rechecked));
+        for (std::size_t k = 0; k < rows; ++k)
+            if (std::fabs(out[k] - exact[k]) > 2e-6 * std::max(1.0, std::fabs(exact[k])))
+                throw std::runtime_error("Строка " + std::to_string(k) + " вычислена неточно");
+
+        // Деление на ноль обнаруживается при пересчёте в double
+        xs[3] = ys[3] = 0;
+        bool failed = false;
+        try {
+            mixed.evaluate_batch(columns, out.data(), rows);
+        } catch (const std::runtime_error &) {
+            failed = true;
+        }
+        if (!failed)
+            throw std::runtime_error("Деление на ноль не обнаружено");
+
+        // Каждая непересчитанная строка укладывается в заявленную ошибку:
+        // большие аргументы sin и exp, корни sin и cos, ln около единицы
+        struct range { const char *source; double first, last; };
+        for (const range &r : {range{"sin(x)", 3000, 3012}, range{"cos(x)", -3012, -3000},
+                               range{"sin(x)", -50, 50}, range{"cos(x) * 2", 1, 20},
+                               range{"exp(x)", -40, 40}, range{"ln(x)", 0.5, 1.5},
+                               range{"x^3.5 + 2^x", 0.1, 30}, range{"x^20", 0.5, 1.5}}) {
+            auto single = ExpressionParserT<double>(r.source).parse().compile().reduce_strength();
+            const std::size_t points = 1201;
+            std::vector<double> grid(points), want(points), got(points);
+            for (std::size_t k = 0; k < points; ++k) grid[k] = r.first + (r.last - r.first) * k / (points - 1);
+            const double *column = grid.data();
+            single.evaluate_batch(&column, want.data(), points);
+            std::size_t redone = mixed_precision_program(single).evaluate_batch(&column, got.data(), points);
+            for (std::size_t k = 0; k < points; ++k)
+                if (std::fabs(got[k] - want[k]) > 2e-6 * std::fabs(want[k]))
+                    throw std::runtime_error(std::string(r.source) + " при x = " + std::to_string(grid[k]) +
+                                             ": ошибка больше заявленной, пересчитано строк " +
+                                             std::to_string(redone));
+            if (std::string(r.source) == "sin(x)" && r.first == 3000 && redone != points)
+                throw std::runtime_error("sin при |x| > 16 должен пересчитываться в double");
+        }
+    });
+
+    run_test("Test Grid Tabulation", [](){
+        // Подвыражения от одной x, от одной y, от обеих и от трёх осей; корень
+        // как скаляр, как таблица внутренней оси и как переменная
+        std::vector<grid_axis<double>> axes{{"x", 0.5, 2.0, 7}, {"y", -1.0, 1.0, 300}, {"z", 0.1, 0.9, 5}};
+        for (const char *source : {"sin(x) * exp(x / 3) + x*y + ln(z + x) / (1 + y^2)",
+                                   "exp(x) * z^3 + sin(x*y) * (z - y) + 2",
+                                   "sin(x)^2 + cos(x)", "ln(z) * z + 1", "z", "y", "3 * 4"}) {
+            auto expr = ExpressionParserT<double>(source).parse();
+            std::vector<double> table = tabulate(expr, axes);
+            if (table.size() != 7 * 300 * 5)
+                throw std::runtime_error("Неверный размер таблицы");
+            std::size_t k = 0;
+            for (std::size_t i = 0; i < 7; ++i)
+                for (std::size_t j = 0; j < 300; ++j)
+                    for (std::size_t l = 0; l < 5; ++l, ++k) {
+                        double expected = expr.evaluate({{"x", axes[0].at(i)}, {"y", axes[1].at(j)}, {"z", axes[2].at(l)}});
+                        if (std::fabs(table[k] - expected) > 1e-12 * (1 + std::fabs(expected)))
+                            throw std::runtime_error(std::string("Неверное значение в сетке для ") + source);
+                    }
+        }
+
+        // Длинная внутренняя ось (несколько порций) и лента после reduce_strength
+        auto expr = ExpressionParserT<double>("x^3 + 2*x^2*y + y^4 * sin(x) - 7").parse();
+        auto program = expr.compile().reduce_strength();
+        std::vector<grid_axis<double>> wide{{"x", -1.0, 1.0, 3}, {"y", 0.0, 3.0, 1001}};
+        std::vector<double> table(3 * 1001);
+        tabulate(program, wide, table.data());
+        for (std::size_t i = 0; i < 3; ++i)
+            for (std::size_t j = 0; j < 1001; ++j) {
+                double expected = expr.evaluate({{"x", wide[0].at(i)}, {"y", wide[1].at(j)}});
+                if (std::fabs(table[i * 1001 + j] - expected) > 1e-10 * (1 + std::fabs(expected)))
+                    throw std::runtime_error("Неверное значение после reduce_strength");
+            }
+
+        using C = std::complex<double>;
+        auto cexpr = ExpressionParserT<C>("x^2 * i + exp(y)").parse();
+        std::vector<C> ctable = tabulate(cexpr, {{"x", C(0, 0), C(1, 1), 4}, {"y", C(1, 0), C(2, 0), 3}});
+        if (std::abs(ctable[3 * 3 + 2] - cexpr.evaluate({{"x", C(1, 1)}, {"y", C(2, 0)}})) > 1e-12)
+            throw std::runtime_error("Неверное комплексное значение в сетке");
+
+        auto expect_failure = [](const std::function<void()> &f, const std::string &what) {
+            try {
+                f();
+            } catch (const std::runtime_error &) {
+                return;
+            }
+            throw std::runtime_error(what + " не обнаружено");
+        };
+        auto ratio = ExpressionParserT<double>("x / y").parse();
+        expect_failure([&]() { tabulate(ratio, {{"x", 0.0, 1.0, 2}}); }, "Отсутствие оси");
+        expect_failure([&]() { tabulate(ratio, {{"x", 0.0, 1.0, 2}, {"x", 0.0, 1.0, 2}, {"y", 1.0, 2.0, 2}}); },
+                       "Повтор оси");
+        {
+            std::ostringstream captured;
+            std::streambuf *saved = std::cout.rdbuf(captured.rdbuf());
+            bool thrown = false;
+            try { tabulate(ratio, {{"x", 0.0, 1.0, 2}, {"y", -1.0, 1.0, 3}}); } catch (const std::runtime_error &) { thrown = true; }
+            std::cout.rdbuf(saved);
+            if (!thrown || !captured.str().empty())
+                throw std::runtime_error("Деление на ноль должно только бросать исключение: " + captured.str());
+        }
+        // fma и powi считаются так же, как в evaluate
+        auto fused = ExpressionParserT<double>("(0.1 * x^3 + 0.7 * x^2 + 0.3 * x - 1 / 3) * y^9").parse().compile().reduce_strength();
+        std::vector<grid_axis<double>> fused_axes{{"y", 0.5, 1.5, 3}, {"x", -3.0, 2.0, 301}};
+        std::vector<double> fused_table(3 * 301);
+        tabulate(fused, fused_axes, fused_table.data());
+        for (std::size_t row = 0; row < 3; ++row)
+            for (std::size_t k = 0; k < 301; ++k)
+                if (fused_table[row * 301 + k] != fused.evaluate({{"x", fused_axes[1].at(k)}, {"y", fused_axes[0].at(row)}}))
+                    throw std::runtime_error("fma на сетке отличается от evaluate");
+        // Произведение числа точек не помещается в size_t
+        const std::size_t huge = std::size_t(1) << (sizeof(std::size_t) * 4);
+        expect_failure([&]() { tabulate(ratio, {{"x", 0.0, 1.0, huge}, {"y", 1.0, 2.0, huge + 1}}); },
+                       "Переполнение размера сетки");
+        expect_failure([&]() { tabulate(ratio, {{"x", 0.0, 1.0, huge}, {"y", 1.0, 2.0, huge / 2}}); },
+                       "Слишком большая сетка");
+    });
+
     return 0;
 }